@@ -41,11 +41,10 @@ void print_status_82802ab(uint8_t status)
 	msg_cdbg("%s", status & 0x2 ? "WP|TBL#|WP#,ABORT:" : "UNLOCK:");
 }
 
-int probe_82802ab(struct flashchip *flash)
+/* Read the product ID and the normal flash contents at the same location. */
+static void read_ids_82802ab(struct flashchip *flash, uint8_t *ids)
 {
 	chipaddr bios = flash->virtual_memory;
-	uint8_t id1, id2;
-	uint8_t flashcontent1, flashcontent2;
 	int shifted = (flash->feature_bits & FEATURE_ADDR_SHIFTED) != 0;
 
 	/* Reset to get a clean state */
@@ -56,23 +55,42 @@ int probe_82802ab(struct flashchip *flash)
 	chip_writeb(0x90, bios);
 	programmer_delay(10);
 
-	id1 = chip_readb(bios + (0x00 << shifted));
-	id2 = chip_readb(bios + (0x01 << shifted));
+	ids[0] = chip_readb(bios + (0x00 << shifted));
+	ids[1] = chip_readb(bios + (0x01 << shifted));
 
 	/* Leave ID mode */
 	chip_writeb(0xFF, bios);
 
 	programmer_delay(10);
 
+	/* Read the product ID location again. We should now see normal flash contents. */
+	ids[2] = chip_readb(bios + (0x00 << shifted));
+	ids[3] = chip_readb(bios + (0x01 << shifted));
+}
+
+int probe_82802ab(struct flashchip *flash)
+{
+	uint8_t id1, id2;
+	uint8_t flashcontent1, flashcontent2;
+	uint8_t ids[4];
+	uint32_t cache_key;
+
+	cache_key = (flash->total_size << 8) |
+		    (flash->feature_bits & FEATURE_ADDR_SHIFTED);
+	if (!probe_cache_get(PROBE_82802AB, cache_key, 0, ids, sizeof(ids))) {
+		read_ids_82802ab(flash, ids);
+		probe_cache_put(PROBE_82802AB, cache_key, 0, ids, sizeof(ids));
+	}
+	id1 = ids[0];
+	id2 = ids[1];
+	flashcontent1 = ids[2];
+	flashcontent2 = ids[3];
+
 	msg_cdbg("%s: id1 0x%02x, id2 0x%02x", __func__, id1, id2);
 
 	if (!oddparity(id1))
 		msg_cdbg(", id1 parity violation");
 
-	/* Read the product ID location again. We should now see normal flash contents. */
-	flashcontent1 = chip_readb(bios + (0x00 << shifted));
-	flashcontent2 = chip_readb(bios + (0x01 << shifted));
-
 	if (id1 == flashcontent1)
 		msg_cdbg(", id1 is normal flash content");
 	if (id2 == flashcontent2)
@@ -72,8 +72,16 @@ int unlock_28f004s5(struct flashchip *flash);
 
 /* jedec.c */
 uint8_t oddparity(uint8_t val);
-void toggle_ready_jedec(chipaddr dst);
-void data_polling_jedec(chipaddr dst, uint8_t data);
+enum jedec_wait_op {
+	JEDEC_WAIT_PROGRAM,
+	JEDEC_WAIT_SECTOR_ERASE,
+	JEDEC_WAIT_BLOCK_ERASE,
+	JEDEC_WAIT_CHIP_ERASE,
+};
+int toggle_ready_jedec(struct flashchip *flash, chipaddr dst,
+		       enum jedec_wait_op op, unsigned int size);
+int data_polling_jedec(struct flashchip *flash, chipaddr dst, uint8_t data,
+		       enum jedec_wait_op op, unsigned int size);
 int write_byte_program_jedec(chipaddr bios, uint8_t *src,
 			     chipaddr dst);
 int probe_jedec(struct flashchip *flash);
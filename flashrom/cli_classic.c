@@ -31,6 +31,15 @@
 #include "flashchips.h"
 #include "programmer.h"
 
+/* Gang mode runs every programmer in a child process of its own. */
+#if !defined(__DJGPP__) && !defined(__LIBPAYLOAD__) && \
+    !defined(__WATCOMC__) && !defined(_WIN32)
+#define CLI_GANG 1
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
 static void cli_classic_usage(const char *name)
 {
 	printf("Usage: flashrom [-n] [-V] [-f] [-h|-R|-L|"
@@ -78,24 +87,169 @@ static void cli_classic_usage(const char *name)
 	         "in wiki syntax\n"
 #endif
 	       "   -p | --programmer <name>[:<param>] specify the programmer "
-	         "device\n");
+	         "device\n"
+	       "        --dry-run                    print the erase plan for "
+	         "-w/-E, don't write\n"
+	       "        --verify-written             after -w, only verify "
+	         "erased/written regions\n"
+	       "        --crc32                      print the CRC32 of the "
+	         "read/verified contents\n"
+	       "        --reference <file>           for -w, trust <file> as "
+	         "the current contents\n"
+	       "        --reference-crc32 <crc>      for -w, trust the cached "
+	         "image with this CRC32\n"
+	       "        --cache-dir <dir>            store images and delay "
+	         "calibration in <dir>\n"
+	       "        --events <fd>                write progress events "
+	         "as JSON lines to <fd>\n"
+	       "        --batch <file>               run the operations listed "
+	         "in <file>\n"
+#if CLI_GANG == 1
+	       "        --gang                       run the operation on all "
+	         "-p programmers at once\n"
+#endif
+	       );
 
 	list_programmers_linebreak(37, 80, 1);
 	printf("\nYou can specify one of -h, -R, -L, "
 #if CONFIG_PRINT_WIKI == 1
 	         "-z, "
 #endif
-	         "-E, -r, -w, -v or no operation.\n"
+	         "-E, -r, -w, -v, --batch or no operation.\n"
 	       "If no operation is specified, flashrom will only probe for "
 	         "flash chips.\n\n");
 }
 
+/* Long options without a short equivalent. */
+enum {
+	OPTION_DRY_RUN = 0x0100,
+	OPTION_VERIFY_WRITTEN,
+	OPTION_CRC32,
+	OPTION_REFERENCE,
+	OPTION_REFERENCE_CRC32,
+	OPTION_CACHE_DIR,
+	OPTION_EVENTS,
+	OPTION_BATCH,
+	OPTION_GANG,
+};
+
 static void cli_classic_abort_usage(void)
 {
 	printf("Please run \"flashrom --help\" for usage info.\n");
 	exit(1);
 }
 
+/* One programmer of a gang, with the state of its worker process. */
+struct gang_target {
+	const char *spec;
+	enum programmer programmer;
+	char *param;
+	FILE *log;
+	int pid;
+	int status;
+	unsigned long start;
+	unsigned long usecs;
+};
+
+static struct gang_target *gang_targets = NULL;
+static int gang_count = 0;
+
+static void gang_add_target(const char *spec, enum programmer prog,
+			    char *param)
+{
+	struct gang_target *t;
+
+	t = realloc(gang_targets, (gang_count + 1) * sizeof(*t));
+	if (!t) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(1);
+	}
+	gang_targets = t;
+	t += gang_count++;
+	memset(t, 0, sizeof(*t));
+	t->spec = spec;
+	t->programmer = prog;
+	t->param = param;
+}
+
+#if CLI_GANG == 1
+/*
+ * Fork one worker per gang target. Each worker owns a separate copy of the
+ * global programmer state and shares the delay calibration done before.
+ * Returns the target index in the worker and -1 in the parent.
+ */
+static int gang_start(void)
+{
+	struct gang_target *t;
+	int i;
+
+	for (i = 0; i < gang_count; i++) {
+		t = &gang_targets[i];
+		/* Workers write to their own log, shown when they finish. */
+		t->log = tmpfile();
+		if (!t->log) {
+			perror("Can't create gang log");
+			exit(1);
+		}
+		fflush(NULL);
+		t->start = timer_usecs();
+		t->pid = fork();
+		if (t->pid < 0) {
+			perror("Can't start gang worker");
+			exit(1);
+		}
+		if (!t->pid) {
+			dup2(fileno(t->log), STDOUT_FILENO);
+			dup2(fileno(t->log), STDERR_FILENO);
+			set_event_target(i);
+			programmer = t->programmer;
+			return i;
+		}
+		event("target", "\"target\":%i,\"programmer\":\"%s\"", i,
+		      event_str(t->spec));
+	}
+	return -1;
+}
+
+/* Wait for all workers, show their output and summarize the results. */
+static int gang_finish(void)
+{
+	struct gang_target *t;
+	char line[256];
+	int i, pid, status, failed = 0;
+
+	for (i = 0; i < gang_count; i++) {
+		pid = wait(&status);
+		for (t = gang_targets; t < gang_targets + gang_count; t++)
+			if (t->pid == pid)
+				break;
+		if (pid < 0 || t == gang_targets + gang_count)
+			break;
+		t->usecs = timer_usecs() - t->start;
+		t->status = (WIFEXITED(status) && !WEXITSTATUS(status)) ? 0 : 1;
+		rewind(t->log);
+		while (fgets(line, sizeof(line), t->log))
+			printf("[%i] %s", (int)(t - gang_targets), line);
+		fclose(t->log);
+		event("target_done", "\"target\":%i,\"duration_us\":%lu,"
+		      "\"status\":%i", (int)(t - gang_targets), t->usecs,
+		      t->status);
+	}
+
+	printf("Gang results:\n");
+	for (i = 0; i < gang_count; i++) {
+		t = &gang_targets[i];
+		printf("  [%i] %-6s %4lu.%03lu s  %s\n", i,
+		       t->status ? "FAILED" : "OK", t->usecs / 1000000,
+		       t->usecs / 1000 % 1000, t->spec);
+		failed += t->status;
+	}
+	printf("%i of %i targets succeeded.\n", gang_count - failed,
+	       gang_count);
+	return !!failed;
+}
+#endif
+
 int cli_classic(int argc, char *argv[])
 {
 	unsigned long size;
@@ -112,6 +266,9 @@ int cli_classic(int argc, char *argv[])
 	int list_supported_wiki = 0;
 #endif
 	int operation_specified = 0;
+	int event_fd = -1;
+	int gang = 0;
+	unsigned long start;
 	int i;
 
 	static const char optstring[] = "r:Rw:v:nVEfc:m:l:i:p:Lzh";
@@ -132,10 +289,20 @@ int cli_classic(int argc, char *argv[])
 		{"programmer", 1, 0, 'p'},
 		{"help", 0, 0, 'h'},
 		{"version", 0, 0, 'R'},
+		{"dry-run", 0, 0, OPTION_DRY_RUN},
+		{"verify-written", 0, 0, OPTION_VERIFY_WRITTEN},
+		{"crc32", 0, 0, OPTION_CRC32},
+		{"reference", 1, 0, OPTION_REFERENCE},
+		{"reference-crc32", 1, 0, OPTION_REFERENCE_CRC32},
+		{"cache-dir", 1, 0, OPTION_CACHE_DIR},
+		{"events", 1, 0, OPTION_EVENTS},
+		{"batch", 1, 0, OPTION_BATCH},
+		{"gang", 0, 0, OPTION_GANG},
 		{0, 0, 0, 0}
 	};
 
 	char *filename = NULL;
+	char *batch_file = NULL;
 
 	char *tempstr = NULL;
 	char *pparam = NULL;
@@ -284,6 +451,8 @@ int cli_classic(int argc, char *argv[])
 					"%s.\n", optarg);
 				cli_classic_abort_usage();
 			}
+			gang_add_target(optarg, programmer, pparam);
+			pparam = NULL;
 			break;
 		case 'R':
 			/* print_version() is always called during startup. */
@@ -303,6 +472,55 @@ int cli_classic(int argc, char *argv[])
 			cli_classic_usage(argv[0]);
 			exit(0);
 			break;
+		case OPTION_DRY_RUN:
+			dry_run = 1;
+			break;
+		case OPTION_VERIFY_WRITTEN:
+			verify_written_only = 1;
+			break;
+		case OPTION_CRC32:
+			print_crc32 = 1;
+			break;
+		case OPTION_REFERENCE:
+			reference_file = strdup(optarg);
+			break;
+		case OPTION_REFERENCE_CRC32:
+			reference_crc32 = strtoul(optarg, &tempstr, 16);
+			if (!strlen(optarg) || *tempstr) {
+				fprintf(stderr, "Error: Invalid CRC32 %s.\n",
+					optarg);
+				cli_classic_abort_usage();
+			}
+			reference_crc32_valid = 1;
+			break;
+		case OPTION_CACHE_DIR:
+			cache_dir = strdup(optarg);
+			break;
+		case OPTION_EVENTS:
+			event_fd = strtol(optarg, &tempstr, 0);
+			if (!strlen(optarg) || *tempstr || event_fd < 0) {
+				fprintf(stderr, "Error: Invalid file "
+					"descriptor %s.\n", optarg);
+				cli_classic_abort_usage();
+			}
+			break;
+		case OPTION_BATCH:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			batch_file = strdup(optarg);
+			break;
+		case OPTION_GANG:
+#if CLI_GANG == 1
+			gang = 1;
+#else
+			fprintf(stderr, "Error: Gang mode is not supported on "
+				"this platform. Aborting.\n");
+			cli_classic_abort_usage();
+#endif
+			break;
 		default:
 			cli_classic_abort_usage();
 			break;
@@ -328,7 +546,43 @@ int cli_classic(int argc, char *argv[])
 		cli_classic_abort_usage();
 	}
 
+	if ((reference_file || reference_crc32_valid) && !write_it) {
+		fprintf(stderr, "Error: --reference and --reference-crc32 "
+			"only apply to --write.\n");
+		cli_classic_abort_usage();
+	}
+	if (reference_crc32_valid && !reference_file) {
+		if (!cache_dir) {
+			fprintf(stderr, "Error: --reference-crc32 needs "
+				"--cache-dir or --reference.\n");
+			cli_classic_abort_usage();
+		}
+		reference_file = malloc(strlen(cache_dir) +
+					sizeof("/12345678.bin"));
+		if (!reference_file) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(1);
+		}
+		sprintf(reference_file, "%s/%08x.bin", cache_dir,
+			reference_crc32);
+	}
+
+	/* Without --gang, the last programmer given wins. */
+	if (gang_count)
+		pparam = gang_targets[gang_count - 1].param;
+	if (gang && gang_count < 2) {
+		fprintf(stderr, "Error: --gang needs at least two --programmer "
+			"options.\n");
+		cli_classic_abort_usage();
+	}
 #if CONFIG_INTERNAL == 1
+	for (i = 0; gang && i < gang_count; i++) {
+		if (gang_targets[i].programmer == PROGRAMMER_INTERNAL) {
+			fprintf(stderr, "Error: The internal programmer can't "
+				"be part of a gang. Aborting.\n");
+			cli_classic_abort_usage();
+		}
+	}
 	if ((programmer != PROGRAMMER_INTERNAL) && (lb_part || lb_vendor)) {
 		fprintf(stderr, "Error: --mainboard requires the internal "
 				"programmer. Aborting.\n");
@@ -351,15 +605,31 @@ int cli_classic(int argc, char *argv[])
 		flash = NULL;
 	}
 
+	if (event_fd >= 0 && open_event_stream(event_fd))
+		exit(1);
+
 	/* FIXME: Delay calibration should happen in programmer code. */
 	myusec_calibrate_delay();
 
+#if CLI_GANG == 1
+	if (gang) {
+		i = gang_start();
+		if (i < 0)
+			return gang_finish();
+		pparam = gang_targets[i].param;
+	}
+#endif
+
+	start = timer_usecs();
 	if (programmer_init(pparam)) {
+		event_phase("init", timer_usecs() - start, 0, 1);
 		fprintf(stderr, "Error: Programmer initialization failed.\n");
 		exit(1);
 	}
+	event_phase("init", timer_usecs() - start, 0, 0);
 
 	/* FIXME: Delay calibration should happen in programmer code. */
+	start = timer_usecs();
 	for (i = 0; i < ARRAY_SIZE(flashes); i++) {
 		flashes[i] =
 		    probe_flash(i ? flashes[i - 1] + 1 : flashchips, 0);
@@ -367,6 +637,12 @@ int cli_classic(int argc, char *argv[])
 			for (i++; i < ARRAY_SIZE(flashes); i++)
 				flashes[i] = NULL;
 	}
+	event_phase("probe", timer_usecs() - start, 0, !flashes[0]);
+	for (i = 0; i < ARRAY_SIZE(flashes) && flashes[i]; i++)
+		event("chip", "\"name\":\"%s\",\"vendor\":\"%s\","
+		      "\"size\":%i", event_str(flashes[i]->name),
+		      event_str(flashes[i]->vendor),
+		      flashes[i]->total_size * 1024);
 
 	if (flashes[1]) {
 		printf("Multiple flash chips were detected:");
@@ -409,6 +685,12 @@ int cli_classic(int argc, char *argv[])
 		return 1;
 	}
 
+	if (batch_file) {
+		/* FIXME: We should issue an unconditional chip reset here. */
+		programmer_delay(100000);
+		return doit_batch(flash, force, batch_file, !dont_verify_it);
+	}
+
 	if (!(read_it | write_it | verify_it | erase_it)) {
 		printf("No operations were specified.\n");
 		// FIXME: flash writes stay enabled!
@@ -423,8 +705,15 @@ int cli_classic(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (dry_run && !(write_it || erase_it)) {
+		fprintf(stderr, "Error: --dry-run only applies to --write and "
+			"--erase.\n");
+		programmer_shutdown();
+		exit(1);
+	}
+
 	/* Always verify write operations unless -n is used. */
-	if (write_it && !dont_verify_it)
+	if (write_it && !dont_verify_it && !dry_run)
 		verify_it = 1;
 
 	/* FIXME: We should issue an unconditional chip reset here. This can be
@@ -434,3 +723,8 @@ int cli_classic(int argc, char *argv[])
 	programmer_delay(100000);
 	return doit(flash, force, filename, read_it, write_it, erase_it, verify_it);
 }
+
+int main(int argc, char *argv[])
+{
+	return cli_classic(argc, argv);
+}
@@ -19,8 +19,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <time.h>
 #include "flash.h"
+#include "programmer.h"
 
 int print(int type, const char *fmt, ...)
 {
@@ -49,3 +53,88 @@ int print(int type, const char *fmt, ...)
 	va_end(ap);
 	return ret;
 }
+
+/* Machine readable event stream, one JSON object per line. Every event has
+ * its type and the microseconds since the stream was opened, the other
+ * fields depend on the type.
+ */
+static FILE *event_file = NULL;
+static unsigned long event_start;
+/* Gang mode tags the events of each target with its index. */
+static int event_target = -1;
+
+int open_event_stream(int fd)
+{
+	event_file = fdopen(fd, "w");
+	if (!event_file) {
+		perror("Can't open event stream");
+		return 1;
+	}
+	/* Consumers follow the stream live, so flush every line. */
+	setvbuf(event_file, NULL, _IOLBF, BUFSIZ);
+	event_start = timer_usecs();
+	event("start", "\"time\":%lu,\"version\":\"%s\"",
+	      (unsigned long)time(NULL), event_str(flashrom_version));
+	return 0;
+}
+
+void set_event_target(int target)
+{
+	event_target = target;
+}
+
+/* Escape a string for use inside the quotes of an event field. The result
+ * stays valid during the next three calls, enough for one event.
+ */
+const char *event_str(const char *s)
+{
+	static char *bufs[4];
+	static int next = 0;
+	char *buf, *p;
+
+	if (!event_file)
+		return s;
+	free(bufs[next]);
+	/* \u00XX is the longest escape sequence. */
+	buf = bufs[next] = malloc(strlen(s) * 6 + 1);
+	next = (next + 1) % 4;
+	if (!buf)
+		return "";
+	for (p = buf; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if (c < 0x20) {
+			p += sprintf(p, "\\u%04x", c);
+		} else {
+			*p++ = c;
+		}
+	}
+	*p = '\0';
+	return buf;
+}
+
+void event(const char *type, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!event_file)
+		return;
+	fprintf(event_file, "{\"event\":\"%s\",\"us\":%lu,", type,
+		timer_usecs() - event_start);
+	if (event_target >= 0)
+		fprintf(event_file, "\"target\":%i,", event_target);
+	va_start(ap, fmt);
+	vfprintf(event_file, fmt, ap);
+	va_end(ap);
+	fprintf(event_file, "}\n");
+}
+
+void event_phase(const char *phase, unsigned long usecs, unsigned long bytes,
+		 int ret)
+{
+	event("phase", "\"phase\":\"%s\",\"duration_us\":%lu,\"bytes\":%lu,"
+	      "\"status\":%i", event_str(phase), usecs, bytes, ret);
+}
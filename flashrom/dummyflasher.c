@@ -29,6 +29,8 @@
 #if EMULATE_SPI_CHIP
 #define EMULATE_CHIP 1
 #include "spi.h"
+/* Parallel JEDEC chips share the timing and statistics code. */
+#define EMULATE_PARALLEL_CHIP 1
 #endif
 
 #if EMULATE_CHIP
@@ -36,6 +38,24 @@
 #include <sys/stat.h>
 #endif
 
+/* Map the persistent image instead of reading and writing it in one go. */
+#if EMULATE_CHIP && !defined(__DJGPP__) && !defined(__LIBPAYLOAD__) && \
+    !defined(__WATCOMC__) && !defined(_WIN32)
+#define EMULATE_CHIP_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+
+/* The ICH SPI controller model drives ichspi.c, which is only built with the
+ * internal programmer.
+ */
+#if EMULATE_SPI_CHIP && CONFIG_INTERNAL == 1 && \
+    (defined(__i386__) || defined(__x86_64__))
+#define EMULATE_ICH_SPI 1
+#endif
+
 #if EMULATE_CHIP
 static uint8_t *flashchip_contents = NULL;
 enum emu_chip {
@@ -43,9 +63,14 @@ enum emu_chip {
 	EMULATE_ST_M25P10_RES,
 	EMULATE_SST_SST25VF040_REMS,
 	EMULATE_SST_SST25VF032B,
+	EMULATE_GENERIC_SPI,
+	EMULATE_GENERIC_PARALLEL,
 };
 static enum emu_chip emu_chip = EMULATE_NONE;
 static char *emu_persistent_image = NULL;
+#if EMULATE_CHIP_MMAP
+static int emu_image_mapped = 0;
+#endif
 static int emu_chip_size = 0;
 #if EMULATE_SPI_CHIP
 static int emu_max_byteprogram_size = 0;
@@ -55,11 +80,389 @@ static int emu_jedec_be_52_size = 0;
 static int emu_jedec_be_d8_size = 0;
 static int emu_jedec_ce_60_size = 0;
 static int emu_jedec_ce_c7_size = 0;
+static int emu_jedec_be_d7_size = 0;
+
+/* ID response of a chip taken from flashchips.c. */
+static unsigned char emu_id_cmd = 0;
+static unsigned char emu_id[4];
+static int emu_id_len = 0;
+
+/* Timing simulation. Busy times are scaled by emu_latency percent before
+ * the chip reports WIP, so 0 means the chip is never busy.
+ */
+static int emu_latency = 0;
+static unsigned long emu_busy_until = 0;
+
+/* Statistics, printed at shutdown. */
+static unsigned long emu_bytes_programmed = 0;
+static unsigned long emu_program_ops = 0;
+static unsigned long emu_erase_ops = 0;
+static unsigned long emu_status_reads = 0;
+static uint64_t emu_busy_usecs = 0;
+/* Erase cycles for each block of the smallest erase granularity. */
+static unsigned int *emu_erase_cycles = NULL;
+static int emu_erase_granularity = 0;
+#endif
+#if EMULATE_PARALLEL_CHIP
+/* Parallel chip taken from flashchips.c and its JEDEC command state. */
+static const struct flashchip *emu_parallel_chip = NULL;
+static unsigned int emu_jedec_mask = 0;
+static int emu_jedec_block = 0;
+static int emu_jedec_unlock = 0;
+static int emu_jedec_erase = 0;
+/* The next write is program data. Page write chips take data until the
+ * next read.
+ */
+static int emu_jedec_program = 0;
+static int emu_jedec_id_mode = 0;
+static uint8_t emu_jedec_toggle = 0;
 #endif
 #endif
 
+#if EMULATE_ICH_SPI
+/* Register file of the emulated ICH SPI controller, 0 if not emulated. */
+static int ich_emu_generation = 0;
+static uint32_t ich_emu_regs[0x100 / 4];
+static unsigned long ich_emu_cycles = 0;
+static unsigned long ich_emu_data_bytes = 0;
+#endif
+
 static int spi_write_256_chunksize = 256;
 
+#if EMULATE_SPI_CHIP
+/* Typical datasheet timings in microseconds. */
+static unsigned long emu_program_time(int bytes)
+{
+	return 10 + bytes * 23 / 10;
+}
+
+static unsigned long emu_erase_time(int bytes)
+{
+	return 40 * 1000 + bytes / 1024 * 2000;
+}
+
+/* Returns the eraseblock size if the eraser uses a uniform layout, else 0. */
+static int emu_uniform_eraser(const struct flashchip *chip,
+			      const struct block_eraser *eraser)
+{
+	if (eraser->eraseblocks[1].count)
+		return 0;
+	if (eraser->eraseblocks[0].size * eraser->eraseblocks[0].count !=
+	    chip->total_size * 1024)
+		return 0;
+	return eraser->eraseblocks[0].size;
+}
+
+/* Set up emulation of any SPI chip from flashchips.c. */
+static int emulate_generic_spi_chip(const char *name)
+{
+	const struct flashchip *chip;
+	const struct block_eraser *eraser;
+	int i, size;
+
+	for (chip = flashchips; chip->name; chip++)
+		if ((chip->bustype & CHIP_BUSTYPE_SPI) &&
+		    !strcmp(chip->name, name))
+			break;
+	if (!chip->name)
+		return 1;
+
+	emu_chip_size = chip->total_size * 1024;
+	if (chip->probe == probe_spi_rdid || chip->probe == probe_spi_rdid4) {
+		emu_id_cmd = JEDEC_RDID;
+		emu_id_len = 0;
+		if (chip->manufacture_id > 0xff)
+			emu_id[emu_id_len++] = chip->manufacture_id >> 8;
+		emu_id[emu_id_len++] = chip->manufacture_id & 0xff;
+		if (chip->model_id > 0xff || chip->manufacture_id <= 0xff)
+			emu_id[emu_id_len++] = (chip->model_id >> 8) & 0xff;
+		emu_id[emu_id_len++] = chip->model_id & 0xff;
+	} else if (chip->probe == probe_spi_rems) {
+		emu_id_cmd = JEDEC_REMS;
+		emu_id[0] = chip->manufacture_id;
+		emu_id[1] = chip->model_id;
+		emu_id_len = 2;
+	} else if (chip->probe == probe_spi_res1) {
+		emu_id_cmd = JEDEC_RES;
+		emu_id[0] = chip->model_id;
+		emu_id_len = 1;
+	} else if (chip->probe == probe_spi_res2) {
+		emu_id_cmd = JEDEC_RES;
+		emu_id[0] = chip->manufacture_id;
+		emu_id[1] = chip->model_id;
+		emu_id_len = 2;
+	} else {
+		msg_perr("Can't emulate the probe method of %s.\n", chip->name);
+		return 1;
+	}
+
+	if (chip->write == spi_chip_write_256) {
+		emu_max_byteprogram_size = chip->page_size;
+	} else if (chip->write == spi_chip_write_1) {
+		emu_max_byteprogram_size = 1;
+	} else if (chip->write == spi_aai_write) {
+		emu_max_byteprogram_size = 1;
+		emu_max_aai_size = 2;
+	} else {
+		msg_pdbg("Write method of %s is not emulated.\n", chip->name);
+	}
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		eraser = &chip->block_erasers[i];
+		if (!eraser->block_erase)
+			continue;
+		size = emu_uniform_eraser(chip, eraser);
+		if (!size) {
+			msg_pdbg("Non-uniform erase function %i of %s is not "
+				 "emulated.\n", i, chip->name);
+			continue;
+		}
+		if (eraser->block_erase == spi_block_erase_20)
+			emu_jedec_se_size = size;
+		else if (eraser->block_erase == spi_block_erase_52)
+			emu_jedec_be_52_size = size;
+		else if (eraser->block_erase == spi_block_erase_d7)
+			emu_jedec_be_d7_size = size;
+		else if (eraser->block_erase == spi_block_erase_d8)
+			emu_jedec_be_d8_size = size;
+		else if (eraser->block_erase == spi_block_erase_60)
+			emu_jedec_ce_60_size = size;
+		else if (eraser->block_erase == spi_block_erase_c7)
+			emu_jedec_ce_c7_size = size;
+		else
+			msg_pdbg("Erase function %i of %s is not emulated.\n",
+				 i, chip->name);
+	}
+	msg_pdbg("Emulating %s %s SPI flash chip (%i kB)\n", chip->vendor,
+		 chip->name, chip->total_size);
+	emu_chip = EMULATE_GENERIC_SPI;
+	return 0;
+}
+#endif
+
+#if EMULATE_PARALLEL_CHIP
+/* Set up emulation of a parallel, LPC or FWH chip from flashchips.c which
+ * uses the JEDEC command set.
+ */
+static int emulate_generic_parallel_chip(const char *name)
+{
+	const struct flashchip *chip;
+	const struct block_eraser *eraser;
+	int i, j;
+
+	for (chip = flashchips; chip->name; chip++)
+		if ((chip->bustype & CHIP_BUSTYPE_NONSPI) &&
+		    !strcmp(chip->name, name))
+			break;
+	if (!chip->name)
+		return 1;
+	if (chip->probe != probe_jedec) {
+		msg_perr("Can't emulate the probe method of %s.\n", chip->name);
+		return 1;
+	}
+	if (chip->write != write_jedec_1 && chip->write != write_jedec)
+		msg_pdbg("Write method of %s is not emulated.\n", chip->name);
+
+	switch (chip->feature_bits & FEATURE_ADDR_MASK) {
+	case FEATURE_ADDR_2AA:
+		emu_jedec_mask = 0x7ff;
+		break;
+	case FEATURE_ADDR_AAA:
+		emu_jedec_mask = 0xfff;
+		break;
+	default:
+		emu_jedec_mask = 0xffff;
+		break;
+	}
+
+	emu_chip_size = chip->total_size * 1024;
+	emu_jedec_block = emu_chip_size;
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		eraser = &chip->block_erasers[i];
+		if (!eraser->block_erase)
+			continue;
+		if (eraser->block_erase != erase_sector_jedec &&
+		    eraser->block_erase != erase_block_jedec &&
+		    eraser->block_erase != erase_chip_block_jedec) {
+			msg_pdbg("Erase function %i of %s is not emulated.\n",
+				 i, chip->name);
+			continue;
+		}
+		for (j = 0; j < NUM_ERASEREGIONS; j++)
+			if (eraser->eraseblocks[j].count)
+				emu_jedec_block = min(emu_jedec_block,
+						eraser->eraseblocks[j].size);
+	}
+	msg_pdbg("Emulating %s %s parallel flash chip (%i kB)\n",
+		 chip->vendor, chip->name, chip->total_size);
+	emu_parallel_chip = chip;
+	emu_chip = EMULATE_GENERIC_PARALLEL;
+	return 0;
+}
+#endif
+
+#if EMULATE_CHIP_MMAP
+/* Back the emulated chip with a shared mapping of the image file, so
+ * nothing has to be read at startup and every write lands in the file
+ * right away. A read-only image gets a private mapping which several
+ * processes can use at the same time, writes are not persisted then.
+ */
+static int emu_map_image(const char *name, int readonly)
+{
+	struct stat image_stat;
+	void *contents;
+	int fd, fill = 0;
+
+	fd = open(name, readonly ? O_RDONLY : (O_RDWR | O_CREAT), 0644);
+	if (fd < 0) {
+		msg_perr("Can't open %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &image_stat)) {
+		msg_perr("Can't stat %s: %s\n", name, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	msg_pdbg("Found persistent image %s, size %li ", name,
+		 (long)image_stat.st_size);
+	if (image_stat.st_size == emu_chip_size) {
+		msg_pdbg("matches.\n");
+	} else if (readonly) {
+		msg_pdbg("doesn't match.\n");
+		msg_perr("Read-only image %s has the wrong size.\n", name);
+		close(fd);
+		return 1;
+	} else {
+		msg_pdbg("doesn't match, resizing.\n");
+		if (ftruncate(fd, emu_chip_size)) {
+			msg_perr("Can't resize %s: %s\n", name,
+				 strerror(errno));
+			close(fd);
+			return 1;
+		}
+		fill = 1;
+	}
+
+	contents = mmap(NULL, emu_chip_size, PROT_READ | PROT_WRITE,
+			readonly ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	/* The mapping stays valid after close. */
+	close(fd);
+	if (contents == MAP_FAILED) {
+		msg_perr("Can't map %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+	msg_pdbg("Mapped %s%s\n", name, readonly ? " read-only" : "");
+	flashchip_contents = contents;
+	emu_image_mapped = 1;
+	if (fill) {
+		msg_pdbg("Filling fake flash chip with 0xff, size %i\n",
+			 emu_chip_size);
+		memset(flashchip_contents, 0xff, emu_chip_size);
+	}
+	return 0;
+}
+#endif
+
+#if EMULATE_ICH_SPI
+/* Register offsets and the SPIC layout, see ichspi.c. On ICH9 the control
+ * bits live in SSFC, one byte above the SSFS status byte.
+ */
+#define ICH_EMU_SCGO		(1 << 1)
+#define ICH_EMU_ACS		(1 << 2)
+#define ICH_EMU_SPOP		(1 << 3)
+#define ICH_EMU_DS		(1 << 14)
+#define ICH_EMU_CDS		(1 << 2)
+#define ICH_EMU_FCERR		(1 << 3)
+
+static uint8_t *ich_emu_reg(int reg)
+{
+	return (uint8_t *)ich_emu_regs + reg;
+}
+
+/* Run the SPI cycle described by the SPIC bits in ctrl. Returns nonzero on
+ * a transaction error.
+ */
+static int ich_emu_run_cycle(uint32_t ctrl)
+{
+	int ich7 = (ich_emu_generation == 7);
+	int index = (ctrl >> 4) & 0x7;
+	uint8_t *data = ich_emu_reg(ich7 ? 0x08 : 0x10);
+	uint8_t *opmenu = ich_emu_reg(ich7 ? 0x58 : 0x98);
+	uint8_t *preop = ich_emu_reg(ich7 ? 0x54 : 0x94);
+	uint16_t optype;
+	uint32_t addr;
+	unsigned char cmd[4 + 64];
+	unsigned char dummy;
+	unsigned int len = 0, writecnt = 1;
+	int type;
+
+	memcpy(&optype, ich_emu_reg(ich7 ? 0x56 : 0x96), 2);
+	type = (optype >> (index * 2)) & 0x3;
+	if (ctrl & ICH_EMU_DS)
+		len = ((ctrl >> 8) & 0x3f) + 1;
+
+	ich_emu_cycles++;
+	ich_emu_data_bytes += len;
+	if (ctrl & ICH_EMU_ACS) {
+		cmd[0] = preop[(ctrl & ICH_EMU_SPOP) ? 1 : 0];
+		if (dummy_spi_send_command(1, 0, cmd, &dummy))
+			return 1;
+	}
+
+	cmd[0] = opmenu[index];
+	/* Types 2 and 3 carry an address, types 1 and 3 write data. */
+	if (type & 0x2) {
+		memcpy(&addr, ich_emu_reg(ich7 ? 0x04 : 0x08), 4);
+		cmd[writecnt++] = (addr >> 16) & 0xff;
+		cmd[writecnt++] = (addr >> 8) & 0xff;
+		cmd[writecnt++] = addr & 0xff;
+	}
+	if (type & 0x1) {
+		memcpy(cmd + writecnt, data, len);
+		return dummy_spi_send_command(writecnt + len, 0, cmd, &dummy);
+	}
+	return dummy_spi_send_command(writecnt, len, cmd, data);
+}
+
+/* Register write hook for ichspi.c. Status bits are write-1-to-clear and
+ * setting the cycle go bit runs the whole cycle at once.
+ */
+static void ich_emu_write(int reg, uint32_t val, int width)
+{
+	int status = (ich_emu_generation == 7) ? 0x00 : 0x90;
+	uint32_t ctrl = 0;
+	uint8_t *sts = ich_emu_reg(status);
+
+	if (reg == status) {
+		*sts &= ~(val & (ICH_EMU_CDS | ICH_EMU_FCERR));
+		if (ich_emu_generation != 7 && width > 1) {
+			ctrl = val >> 8;
+			val &= ~(ICH_EMU_SCGO << 8);
+			memcpy(sts + 1, (uint8_t *)&val + 1, width - 1);
+		}
+	} else {
+		if (ich_emu_generation == 7 && reg == 0x02) {
+			ctrl = val;
+			val &= ~ICH_EMU_SCGO;
+		}
+		memcpy(ich_emu_reg(reg), &val, width);
+	}
+	if (!(ctrl & ICH_EMU_SCGO))
+		return;
+	*sts |= ICH_EMU_CDS;
+	if (ich_emu_run_cycle(ctrl))
+		*sts |= ICH_EMU_FCERR;
+}
+
+static void ich_emu_print_stats(void)
+{
+	msg_pdbg("Emulated ICH%i SPI controller: %lu cycles, %lu data "
+		 "bytes\n", ich_emu_generation, ich_emu_cycles,
+		 ich_emu_data_bytes);
+	ich_print_opcode_stats();
+}
+#endif
+
 int dummy_init(void)
 {
 	char *bustext = NULL;
@@ -67,6 +470,9 @@ int dummy_init(void)
 #if EMULATE_CHIP
 	struct stat image_stat;
 #endif
+#if EMULATE_CHIP_MMAP
+	int image_readonly;
+#endif
 
 	msg_pspew("%s\n", __func__);
 
@@ -156,6 +562,12 @@ int dummy_init(void)
 		msg_pdbg("Emulating SST SST25VF032B SPI flash chip (RDID, AAI "
 			 "write)\n");
 	}
+	if (emu_chip == EMULATE_NONE)
+		emulate_generic_spi_chip(tmp);
+#endif
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_NONE)
+		emulate_generic_parallel_chip(tmp);
 #endif
 	if (emu_chip == EMULATE_NONE) {
 		msg_perr("Invalid chip specified for emulation: %s\n", tmp);
@@ -163,6 +575,72 @@ int dummy_init(void)
 		return 1;
 	}
 	free(tmp);
+
+#if EMULATE_SPI_CHIP
+	tmp = extract_programmer_param("latency");
+	if (tmp) {
+		emu_latency = atoi(tmp);
+		free(tmp);
+		if (emu_latency < 0) {
+			msg_perr("invalid latency\n");
+			return 1;
+		}
+	}
+	emu_erase_granularity = emu_chip_size;
+	if (emu_jedec_se_size)
+		emu_erase_granularity = min(emu_erase_granularity, emu_jedec_se_size);
+	if (emu_jedec_be_52_size)
+		emu_erase_granularity = min(emu_erase_granularity, emu_jedec_be_52_size);
+	if (emu_jedec_be_d7_size)
+		emu_erase_granularity = min(emu_erase_granularity, emu_jedec_be_d7_size);
+	if (emu_jedec_be_d8_size)
+		emu_erase_granularity = min(emu_erase_granularity, emu_jedec_be_d8_size);
+#if EMULATE_PARALLEL_CHIP
+	if (emu_parallel_chip)
+		emu_erase_granularity = emu_jedec_block;
+#endif
+	emu_erase_cycles = calloc(emu_chip_size / emu_erase_granularity,
+				  sizeof(*emu_erase_cycles));
+	if (!emu_erase_cycles) {
+		msg_perr("Out of memory!\n");
+		return 1;
+	}
+#endif
+#if EMULATE_ICH_SPI
+	tmp = extract_programmer_param("ich");
+	if (tmp) {
+		ich_emu_generation = atoi(tmp);
+		free(tmp);
+		if (ich_emu_generation != 7 && ich_emu_generation != 9) {
+			msg_perr("invalid ich, use 7 or 9\n");
+			return 1;
+		}
+		if (!(buses_supported & CHIP_BUSTYPE_SPI)) {
+			msg_perr("ich needs SPI bus support\n");
+			return 1;
+		}
+		msg_pdbg("Emulating an ICH%i SPI controller\n",
+			 ich_emu_generation);
+		memset(ich_emu_regs, 0, sizeof(ich_emu_regs));
+		if (ich_init_emulated(ich_emu_regs, ich_emu_generation,
+				      ich_emu_write))
+			return 1;
+	}
+#endif
+
+	emu_persistent_image = extract_programmer_param("image");
+#if EMULATE_CHIP_MMAP
+	tmp = extract_programmer_param("image_readonly");
+	if (tmp && strcmp(tmp, "yes")) {
+		msg_perr("invalid image_readonly\n");
+		free(tmp);
+		return 1;
+	}
+	image_readonly = (tmp != NULL);
+	free(tmp);
+	if (emu_persistent_image)
+		return emu_map_image(emu_persistent_image, image_readonly);
+#endif
 	flashchip_contents = malloc(emu_chip_size);
 	if (!flashchip_contents) {
 		msg_perr("Out of memory!\n");
@@ -171,7 +649,6 @@ int dummy_init(void)
 	msg_pdbg("Filling fake flash chip with 0xff, size %i\n", emu_chip_size);
 	memset(flashchip_contents, 0xff, emu_chip_size);
 
-	emu_persistent_image = extract_programmer_param("image");
 	if (!emu_persistent_image) {
 		/* Nothing else to do. */
 		return 0;
@@ -192,11 +669,56 @@ int dummy_init(void)
 	return 0;
 }
 
+#if EMULATE_SPI_CHIP
+static void emu_print_stats(void)
+{
+	unsigned int i, blocks, erased = 0, maxcycles = 0;
+
+	blocks = emu_chip_size / emu_erase_granularity;
+	for (i = 0; i < blocks; i++) {
+		if (!emu_erase_cycles[i])
+			continue;
+		erased++;
+		maxcycles = max(maxcycles, emu_erase_cycles[i]);
+	}
+	msg_pdbg("Emulated chip statistics:\n");
+	msg_pdbg("  %lu bytes programmed in %lu operations\n",
+		 emu_bytes_programmed, emu_program_ops);
+	msg_pdbg("  %lu erase operations, %u of %u blocks of %i bytes "
+		 "erased, at most %u times\n", emu_erase_ops, erased,
+		 blocks, emu_erase_granularity, maxcycles);
+	msg_pdbg("  %lu status reads, %lu.%03lu s simulated busy time\n",
+		 emu_status_reads, (unsigned long)(emu_busy_usecs / 1000000),
+		 (unsigned long)(emu_busy_usecs / 1000 % 1000));
+	for (i = 0; i < blocks; i++)
+		if (emu_erase_cycles[i])
+			msg_pspew("  block 0x%06x erased %u times\n",
+				  i * emu_erase_granularity,
+				  emu_erase_cycles[i]);
+}
+#endif
+
 int dummy_shutdown(void)
 {
 	msg_pspew("%s\n", __func__);
 #if EMULATE_CHIP
 	if (emu_chip != EMULATE_NONE) {
+#if EMULATE_ICH_SPI
+		if (ich_emu_generation)
+			ich_emu_print_stats();
+#endif
+#if EMULATE_SPI_CHIP
+		emu_print_stats();
+		free(emu_erase_cycles);
+#endif
+#if EMULATE_CHIP_MMAP
+		if (emu_image_mapped) {
+			/* Everything written so far is already in the file. */
+			munmap(flashchip_contents, emu_chip_size);
+			emu_image_mapped = 0;
+			return 0;
+		}
+#endif
 		if (emu_persistent_image) {
 			msg_pdbg("Writing %s\n", emu_persistent_image);
 			write_buf_to_file(flashchip_contents, emu_chip_size,
@@ -221,19 +743,40 @@ void dummy_unmap(void *virt_addr, size_t len)
 		  __func__, (unsigned long)len, virt_addr);
 }
 
+#if EMULATE_PARALLEL_CHIP
+static void emulate_jedec_write(uint8_t val, unsigned int offs);
+static uint8_t emulate_jedec_read(unsigned int offs);
+#endif
+
 void dummy_chip_writeb(uint8_t val, chipaddr addr)
 {
 	msg_pspew("%s: addr=0x%lx, val=0x%02x\n", __func__, addr, val);
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL)
+		emulate_jedec_write(val, addr % emu_chip_size);
+#endif
 }
 
 void dummy_chip_writew(uint16_t val, chipaddr addr)
 {
 	msg_pspew("%s: addr=0x%lx, val=0x%04x\n", __func__, addr, val);
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL) {
+		emulate_jedec_write(val & 0xff, addr % emu_chip_size);
+		emulate_jedec_write(val >> 8, (addr + 1) % emu_chip_size);
+	}
+#endif
 }
 
 void dummy_chip_writel(uint32_t val, chipaddr addr)
 {
 	msg_pspew("%s: addr=0x%lx, val=0x%08x\n", __func__, addr, val);
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL) {
+		dummy_chip_writew(val & 0xffff, addr);
+		dummy_chip_writew(val >> 16, addr + 2);
+	}
+#endif
 }
 
 void dummy_chip_writen(uint8_t *buf, chipaddr addr, size_t len)
@@ -246,28 +789,55 @@ void dummy_chip_writen(uint8_t *buf, chipaddr addr, size_t len)
 			msg_pspew("\n");
 		msg_pspew("%02x ", buf[i]);
 	}
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL)
+		for (i = 0; i < len; i++)
+			emulate_jedec_write(buf[i], (addr + i) % emu_chip_size);
+#endif
 }
 
 uint8_t dummy_chip_readb(const chipaddr addr)
 {
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL)
+		return emulate_jedec_read(addr % emu_chip_size);
+#endif
 	msg_pspew("%s:  addr=0x%lx, returning 0xff\n", __func__, addr);
 	return 0xff;
 }
 
 uint16_t dummy_chip_readw(const chipaddr addr)
 {
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL)
+		return dummy_chip_readb(addr) | dummy_chip_readb(addr + 1) << 8;
+#endif
 	msg_pspew("%s:  addr=0x%lx, returning 0xffff\n", __func__, addr);
 	return 0xffff;
 }
 
 uint32_t dummy_chip_readl(const chipaddr addr)
 {
+#if EMULATE_PARALLEL_CHIP
+	if (emu_chip == EMULATE_GENERIC_PARALLEL)
+		return dummy_chip_readw(addr) |
+		       (uint32_t)dummy_chip_readw(addr + 2) << 16;
+#endif
 	msg_pspew("%s:  addr=0x%lx, returning 0xffffffff\n", __func__, addr);
 	return 0xffffffff;
 }
 
 void dummy_chip_readn(uint8_t *buf, const chipaddr addr, size_t len)
 {
+#if EMULATE_PARALLEL_CHIP
+	size_t i;
+
+	if (emu_chip == EMULATE_GENERIC_PARALLEL) {
+		for (i = 0; i < len; i++)
+			buf[i] = emulate_jedec_read((addr + i) % emu_chip_size);
+		return;
+	}
+#endif
 	msg_pspew("%s:  addr=0x%lx, len=0x%lx, returning array of 0xff\n",
 		  __func__, addr, (unsigned long)len);
 	memset(buf, 0xff, len);
@@ -275,6 +845,167 @@ void dummy_chip_readn(uint8_t *buf, const chipaddr addr, size_t len)
 }
 
 #if EMULATE_SPI_CHIP
+/* Make the chip busy for usecs. */
+static void emu_set_busy(unsigned long usecs)
+{
+	emu_busy_usecs += usecs;
+	emu_busy_until = timer_usecs() + usecs / 100 * emu_latency +
+			 usecs % 100 * emu_latency / 100;
+}
+
+static int emu_busy(void)
+{
+	return (long)(emu_busy_until - timer_usecs()) > 0;
+}
+
+static void emu_program(int offs, const unsigned char *buf, int len)
+{
+	memcpy(flashchip_contents + offs, buf, len);
+	emu_bytes_programmed += len;
+	emu_program_ops++;
+	emu_set_busy(emu_program_time(len));
+}
+
+static void emu_erase(int offs, int size)
+{
+	int i;
+
+	memset(flashchip_contents + offs, 0xff, size);
+	for (i = offs; i < offs + size; i += emu_erase_granularity)
+		emu_erase_cycles[i / emu_erase_granularity]++;
+	emu_erase_ops++;
+	emu_set_busy(emu_erase_time(size));
+}
+
+#if EMULATE_PARALLEL_CHIP
+/* Erase the block of the erase function @func which contains @offs. */
+static void emu_jedec_erase_block(int (*func) (struct flashchip *flash,
+					       unsigned int blockaddr,
+					       unsigned int blocklen),
+				  unsigned int offs)
+{
+	const struct block_eraser *eraser;
+	unsigned int start, len;
+	int i;
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		eraser = &emu_parallel_chip->block_erasers[i];
+		if (eraser->block_erase == func &&
+		    find_eraseblock(eraser, offs, &start, &len) >= 0) {
+			emu_erase(start, len);
+			return;
+		}
+	}
+	msg_pdbg("%s: erase at 0x%06x not supported by the chip\n",
+		 __func__, offs);
+}
+
+/* JEDEC command sequences: two unlock cycles (0xaa at 0x5555, 0x55 at
+ * 0x2aaa, both masked with the address mask of the chip) followed by the
+ * command. Erase needs the 0x80 setup command and a second unlock.
+ */
+static void emulate_jedec_write(uint8_t val, unsigned int offs)
+{
+	unsigned int cmd = offs & emu_jedec_mask;
+
+	if (emu_busy()) {
+		msg_pdbg("%s: write to 0x%06x while the chip is busy\n",
+			 __func__, offs);
+		return;
+	}
+	if (emu_jedec_program) {
+		/* Programming can only clear bits. */
+		val &= flashchip_contents[offs];
+		emu_program(offs, &val, 1);
+		if (emu_parallel_chip->write != write_jedec)
+			emu_jedec_program = 0;
+		return;
+	}
+	/* Reset and ID exit are accepted in any state. */
+	if (val == 0xf0) {
+		emu_jedec_unlock = 0;
+		emu_jedec_erase = 0;
+		emu_jedec_id_mode = 0;
+		return;
+	}
+	switch (emu_jedec_unlock) {
+	case 0:
+		if (val == 0xaa && cmd == (0x5555 & emu_jedec_mask)) {
+			emu_jedec_unlock = 1;
+			return;
+		}
+		break;
+	case 1:
+		if (val == 0x55 && cmd == (0x2aaa & emu_jedec_mask)) {
+			emu_jedec_unlock = 2;
+			return;
+		}
+		break;
+	case 2:
+		emu_jedec_unlock = 0;
+		if (emu_jedec_erase) {
+			emu_jedec_erase = 0;
+			if (val == 0x10 && cmd == (0x5555 & emu_jedec_mask)) {
+				emu_jedec_erase_block(erase_chip_block_jedec,
+						      offs);
+				return;
+			}
+			if (val == 0x30) {
+				emu_jedec_erase_block(erase_sector_jedec,
+						      offs);
+				return;
+			}
+			if (val == 0x50) {
+				emu_jedec_erase_block(erase_block_jedec, offs);
+				return;
+			}
+			break;
+		}
+		if (cmd != (0x5555 & emu_jedec_mask))
+			break;
+		switch (val) {
+		case 0x90:
+			emu_jedec_id_mode = 1;
+			return;
+		case 0xa0:
+			emu_jedec_program = 1;
+			return;
+		case 0x80:
+			emu_jedec_erase = 1;
+			return;
+		}
+		break;
+	}
+	msg_pspew("%s: ignoring 0x%02x at 0x%06x\n", __func__, val, offs);
+	emu_jedec_unlock = 0;
+	emu_jedec_erase = 0;
+}
+
+/* IDs above 0xff start with the continuation code 0x7f. */
+static uint8_t emu_jedec_id(uint32_t id, unsigned int offs)
+{
+	if (id > 0xff)
+		return (offs & 0x100) ? id & 0xff : 0x7f;
+	return id;
+}
+
+static uint8_t emulate_jedec_read(unsigned int offs)
+{
+	/* A read ends the page load of page write chips. */
+	emu_jedec_program = 0;
+	if (emu_busy()) {
+		/* The toggle bit changes on every read while busy. */
+		emu_status_reads++;
+		emu_jedec_toggle ^= 0x40;
+		return emu_jedec_toggle;
+	}
+	if (emu_jedec_id_mode)
+		return emu_jedec_id((offs & 1) ? emu_parallel_chip->model_id :
+				    emu_parallel_chip->manufacture_id, offs);
+	return flashchip_contents[offs];
+}
+#endif
+
 static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt,
 		      const unsigned char *writearr, unsigned char *readarr)
 {
@@ -286,6 +1017,16 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 		msg_perr("No command sent to the chip!\n");
 		return 1;
 	}
+	/* A busy chip only answers status register reads. */
+	if (writearr[0] != JEDEC_RDSR && emu_busy()) {
+		msg_perr("Command 0x%02x sent while the chip is busy!\n",
+			 writearr[0]);
+		return 1;
+	}
+	if (emu_chip == EMULATE_GENERIC_SPI && writearr[0] == emu_id_cmd) {
+		memcpy(readarr, emu_id, min(readcnt, emu_id_len));
+		return 0;
+	}
 	/* TODO: Implement command blacklists here. */
 	switch (writearr[0]) {
 	case JEDEC_RES:
@@ -319,6 +1060,10 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 		memset(readarr, 0, readcnt);
 		if (aai_active)
 			memset(readarr, 1 << 6, readcnt);
+		if (emu_busy())
+			for (offs = 0; offs < readcnt; offs++)
+				readarr[offs] |= JEDEC_RDSR_BIT_WIP;
+		emu_status_reads++;
 		break;
 	case JEDEC_READ:
 		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
@@ -339,7 +1084,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 			msg_perr("Max BYTE PROGRAM size exceeded!\n");
 			return 1;
 		}
-		memcpy(flashchip_contents + offs, writearr + 4, writecnt - 4);
+		emu_program(offs, writearr + 4, writecnt - 4);
 		break;
 	case JEDEC_AAI_WORD_PROGRAM:
 		if (!emu_max_aai_size)
@@ -360,7 +1105,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 				   writearr[3];
 			/* Truncate to emu_chip_size. */
 			aai_offs %= emu_chip_size;
-			memcpy(flashchip_contents + aai_offs, writearr + 4, 2);
+			emu_program(aai_offs, writearr + 4, 2);
 			aai_offs += 2;
 		} else {
 			if (writecnt < JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE) {
@@ -373,7 +1118,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 					 "too long!\n");
 				return 1;
 			}
-			memcpy(flashchip_contents + aai_offs, writearr + 1, 2);
+			emu_program(aai_offs, writearr + 1, 2);
 			aai_offs += 2;
 		}
 		break;
@@ -397,7 +1142,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 		if (offs & (emu_jedec_se_size - 1))
 			msg_pdbg("Unaligned SECTOR ERASE 0x20\n");
 		offs &= ~(emu_jedec_se_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_se_size);
+		emu_erase(offs, emu_jedec_se_size);
 		break;
 	case JEDEC_BE_52:
 		if (!emu_jedec_be_52_size)
@@ -414,7 +1159,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 		if (offs & (emu_jedec_be_52_size - 1))
 			msg_pdbg("Unaligned BLOCK ERASE 0x52\n");
 		offs &= ~(emu_jedec_be_52_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_be_52_size);
+		emu_erase(offs, emu_jedec_be_52_size);
 		break;
 	case JEDEC_BE_D8:
 		if (!emu_jedec_be_d8_size)
@@ -431,7 +1176,24 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 		if (offs & (emu_jedec_be_d8_size - 1))
 			msg_pdbg("Unaligned BLOCK ERASE 0xd8\n");
 		offs &= ~(emu_jedec_be_d8_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_be_d8_size);
+		emu_erase(offs, emu_jedec_be_d8_size);
+		break;
+	case JEDEC_BE_D7:
+		if (!emu_jedec_be_d7_size)
+			break;
+		if (writecnt != JEDEC_BE_D7_OUTSIZE) {
+			msg_perr("BLOCK ERASE 0xd7 outsize invalid!\n");
+			return 1;
+		}
+		if (readcnt != JEDEC_BE_D7_INSIZE) {
+			msg_perr("BLOCK ERASE 0xd7 insize invalid!\n");
+			return 1;
+		}
+		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
+		if (offs & (emu_jedec_be_d7_size - 1))
+			msg_pdbg("Unaligned BLOCK ERASE 0xd7\n");
+		offs &= ~(emu_jedec_be_d7_size - 1);
+		emu_erase(offs, emu_jedec_be_d7_size);
 		break;
 	case JEDEC_CE_60:
 		if (!emu_jedec_ce_60_size)
@@ -449,7 +1211,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 			msg_pdbg("Unaligned CHIP ERASE 0x60\n");
 		offs &= ~(emu_jedec_ce_60_size - 1);
 		/* emu_jedec_ce_60_size is emu_chip_size. */
-		memset(flashchip_contents + offs, 0xff, emu_jedec_ce_60_size);
+		emu_erase(offs, emu_jedec_ce_60_size);
 		break;
 	case JEDEC_CE_C7:
 		if (!emu_jedec_ce_c7_size)
@@ -467,7 +1229,7 @@ static int emulate_spi_chip_response(unsigned int writecnt, unsigned int readcnt
 			msg_pdbg("Unaligned CHIP ERASE 0xc7\n");
 		offs &= ~(emu_jedec_ce_c7_size - 1);
 		/* emu_jedec_ce_c7_size is emu_chip_size. */
-		memset(flashchip_contents, 0xff, emu_jedec_ce_c7_size);
+		emu_erase(0, emu_jedec_ce_c7_size);
 		break;
 	default:
 		/* No special response. */
@@ -495,6 +1257,7 @@ int dummy_spi_send_command(unsigned int writecnt, unsigned int readcnt,
 	case EMULATE_ST_M25P10_RES:
 	case EMULATE_SST_SST25VF040_REMS:
 	case EMULATE_SST_SST25VF032B:
+	case EMULATE_GENERIC_SPI:
 		if (emulate_spi_chip_response(writecnt, readcnt, writearr,
 					      readarr)) {
 			msg_perr("Invalid command sent to flash chip!\n");
@@ -206,13 +206,32 @@ enum write_granularity {
 	write_gran_1byte,
 	write_gran_256bytes,
 };
+enum probe_method {
+	PROBE_SPI_RDID,
+	PROBE_SPI_REMS,
+	PROBE_SPI_RES,
+	PROBE_JEDEC,
+	PROBE_82802AB,
+};
 extern enum chipbustype buses_supported;
 extern int verbose;
+extern int dry_run;
+extern int verify_written_only;
+extern int print_crc32;
+extern char *reference_file;
+extern int reference_crc32_valid;
+extern uint32_t reference_crc32;
+extern char *cache_dir;
 extern const char flashrom_version[];
 extern char *chip_to_probe;
 void map_flash_registers(struct flashchip *flash);
 int read_memmapped(struct flashchip *flash, uint8_t *buf, int start, int len);
 int erase_flash(struct flashchip *flash);
+void probe_cache_reset(void);
+int probe_cache_get(enum probe_method method, uint32_t param1,
+		    uint32_t param2, void *data, int len);
+void probe_cache_put(enum probe_method method, uint32_t param1,
+		     uint32_t param2, const void *data, int len);
 struct flashchip *probe_flash(struct flashchip *first_flash, int force);
 int read_flash_to_file(struct flashchip *flash, char *filename);
 #ifndef min
@@ -221,17 +240,22 @@ int min(int a, int b);
 #ifndef max
 int max(int a, int b);
 #endif
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, unsigned long len);
 void tolower_string(char *str);
 char *extract_param(char **haystack, char *needle, char *delim);
 int check_erased_range(struct flashchip *flash, int start, int len);
 int verify_range(struct flashchip *flash, uint8_t *cmpbuf, int start, int len, char *message);
-int need_erase(uint8_t *have, uint8_t *want, int len, enum write_granularity gran);
 char *strcat_realloc(char *dest, const char *src);
 void print_version(void);
 void print_banner(void);
 void list_programmers_linebreak(int startcol, int cols, int paren);
 int selfcheck(void);
+int selfcheck_eraseblocks(struct flashchip *flash);
+int find_eraseblock(const struct block_eraser *eraser, unsigned int addr,
+		    unsigned int *start, unsigned int *len);
 int doit(struct flashchip *flash, int force, char *filename, int read_it, int write_it, int erase_it, int verify_it);
+int doit_batch(struct flashchip *flash, int force, char *batchfile,
+	       int verify_writes);
 int read_buf_from_file(unsigned char *buf, unsigned long size, char *filename);
 int write_buf_to_file(unsigned char *buf, unsigned long size, char *filename);
 
@@ -264,6 +288,16 @@ int print(int type, const char *fmt, ...);
 #define msg_gspew(...)	print(MSG_BARF, __VA_ARGS__)	/* general debug barf  */
 #define msg_pspew(...)	print(MSG_BARF, __VA_ARGS__)	/* programmer debug barf  */
 #define msg_cspew(...)	print(MSG_BARF, __VA_ARGS__)	/* chip debug barf  */
+int open_event_stream(int fd);
+void set_event_target(int target);
+const char *event_str(const char *s);
+#ifndef __WATCOMC__
+void event(const char *type, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#else
+void event(const char *type, const char *fmt, ...);
+#endif
+void event_phase(const char *phase, unsigned long usecs, unsigned long bytes,
+		 int ret);
 
 /* cli_classic.c */
 int cli_classic(int argc, char *argv[]);
@@ -271,18 +305,42 @@ int cli_classic(int argc, char *argv[]);
 /* layout.c */
 int read_romlayout(char *name);
 int find_romentry(char *name);
+void set_romentries_included(int included);
+int find_next_included_range(unsigned int start, unsigned int size,
+			     unsigned int *first, unsigned int *last);
 int handle_romentries(struct flashchip *flash, uint8_t *oldcontents, uint8_t *newcontents);
 
+/* memdiff.c */
+int need_erase(uint8_t *have, uint8_t *want, int len, enum write_granularity gran);
+int get_next_write(uint8_t *have, uint8_t *want, int len,
+		   int *first_start, enum write_granularity gran);
+
 /* spi.c */
 struct spi_command {
 	unsigned int writecnt;
 	unsigned int readcnt;
 	const unsigned char *writearr;
 	unsigned char *readarr;
+	unsigned int flags;
 };
+/* Poll the status register after this command until WIP is cleared. */
+#define SPI_CMD_WAIT_WIP	(1 << 0)
 int spi_send_command(unsigned int writecnt, unsigned int readcnt,
 		const unsigned char *writearr, unsigned char *readarr);
 int spi_send_multicommand(struct spi_command *cmds);
+int spi_batch_size(void);
+int spi_batch_program(struct flashchip *flash, int addr, uint8_t *bytes,
+		      int len);
+int spi_batch_flush(void);
 uint32_t spi_get_valid_read_addr(void);
 
+/* spi25.c */
+void spi_wait_page_program(struct flashchip *flash);
+void spi_print_wip_stats(void);
+
+/* jedec.c */
+unsigned long jedec_erase_estimate(struct flashchip *flash, unsigned int len);
+unsigned long jedec_write_estimate(struct flashchip *flash, unsigned int len);
+void jedec_print_wait_stats(void);
+
 #endif				/* !__FLASH_H__ */
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
 #include <getopt.h>
 #if HAVE_UTSNAME == 1
 #include <sys/utsname.h>
@@ -41,6 +42,15 @@
 const char flashrom_version[] = FLASHROM_VERSION;
 char *chip_to_probe = NULL;
 int verbose = 0;
+int dry_run = 0;
+int verify_written_only = 0;
+int print_crc32 = 0;
+/* Trusted image of the current chip contents, used instead of a full read. */
+char *reference_file = NULL;
+int reference_crc32_valid = 0;
+uint32_t reference_crc32 = 0;
+/* Directory where written images are stored under their CRC32. */
+char *cache_dir = NULL;
 
 #if CONFIG_INTERNAL == 1
 enum programmer programmer = PROGRAMMER_INTERNAL;
@@ -521,6 +531,8 @@ int programmer_init(char *param)
 	may_register_shutdown = 1;
 	/* Default to allowing writes. Broken programmers set this to 0. */
 	programmer_may_write = 1;
+	/* IDs read through another programmer are meaningless. */
+	probe_cache_reset();
 
 	programmer_param = param;
 	msg_pdbg("Initializing %s programmer\n",
@@ -636,6 +648,31 @@ int bitcount(unsigned long a)
 	return i;
 }
 
+/* CRC-32 as used by zlib and most checksum tools (polynomial 0xedb88320). Pass
+ * 0 as crc for the first buffer and the previous result for the following ones.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	static uint32_t table[256];
+	static int table_ready = 0;
+	uint32_t c;
+	int i, j;
+
+	if (!table_ready) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+			table[i] = c;
+		}
+		table_ready = 1;
+	}
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
 void tolower_string(char *str)
 {
 	for (; *str != '\0'; str++)
@@ -736,57 +773,61 @@ int check_erased_range(struct flashchip *flash, int start, int len)
 	return ret;
 }
 
-/*
- * @cmpbuf	buffer to compare against, cmpbuf[0] is expected to match the
-		flash content at location start
- * @start	offset to the base address of the flash chip
- * @len		length of the verified area
- * @message	string to print in the "FAILED" message
- * @return	0 for success, -1 for failure
- */
-int verify_range(struct flashchip *flash, uint8_t *cmpbuf, int start, int len, char *message)
+/* Read back and compare in chunks of this size. */
+#define VERIFY_CHUNK_SIZE	(256 * 1024)
+
+static int verify_range_crc32(struct flashchip *flash, uint8_t *cmpbuf,
+			      int start, int len, char *message,
+			      uint32_t *crc)
 {
-	int i, ret = 0;
-	uint8_t *readbuf = malloc(len);
+	int i, pos, chunk, ret = 0;
+	uint8_t *readbuf;
 	int failcount = 0;
 
 	if (!len)
-		goto out_free;
+		return 0;
 
 	if (!flash->read) {
 		msg_cerr("ERROR: flashrom has no read function for this flash chip.\n");
 		return 1;
 	}
-	if (!readbuf) {
-		msg_gerr("Could not allocate memory!\n");
-		exit(1);
-	}
 
 	if (start + len > flash->total_size * 1024) {
 		msg_gerr("Error: %s called with start 0x%x + len 0x%x >"
 			" total_size 0x%x\n", __func__, start, len,
 			flash->total_size * 1024);
-		ret = -1;
-		goto out_free;
+		return -1;
 	}
 	if (!message)
 		message = "VERIFY";
-	
-	ret = flash->read(flash, readbuf, start, len);
-	if (ret) {
-		msg_gerr("Verification impossible because read failed "
-			 "at 0x%x (len 0x%x)\n", start, len);
-		return ret;
-	}
-
-	for (i = 0; i < len; i++) {
-		if (cmpbuf[i] != readbuf[i]) {
-			/* Only print the first failure. */
-			if (!failcount++)
-				msg_cerr("%s FAILED at 0x%08x! "
-					 "Expected=0x%02x, Read=0x%02x,",
-					 message, start + i, cmpbuf[i],
-					 readbuf[i]);
+
+	readbuf = malloc(min(len, VERIFY_CHUNK_SIZE));
+	if (!readbuf) {
+		msg_gerr("Could not allocate memory!\n");
+		exit(1);
+	}
+
+	for (pos = 0; pos < len; pos += chunk) {
+		chunk = min(len - pos, VERIFY_CHUNK_SIZE);
+		ret = flash->read(flash, readbuf, start + pos, chunk);
+		if (ret) {
+			msg_gerr("Verification impossible because read failed "
+				 "at 0x%x (len 0x%x)\n", start + pos, chunk);
+			goto out_free;
+		}
+		if (crc)
+			*crc = crc32_update(*crc, readbuf, chunk);
+		if (!memcmp(cmpbuf + pos, readbuf, chunk))
+			continue;
+		for (i = 0; i < chunk; i++) {
+			if (cmpbuf[pos + i] != readbuf[i]) {
+				/* Only print the first failure. */
+				if (!failcount++)
+					msg_cerr("%s FAILED at 0x%08x! "
+						 "Expected=0x%02x, Read=0x%02x,",
+						 message, start + pos + i,
+						 cmpbuf[pos + i], readbuf[i]);
+			}
 		}
 	}
 	if (failcount) {
@@ -801,139 +842,16 @@ out_free:
 }
 
 /*
- * Check if the buffer @have can be programmed to the content of @want without
- * erasing. This is only possible if all chunks of size @gran are either kept
- * as-is or changed from an all-ones state to any other state.
- *
- * The following write granularities (enum @gran) are known:
- * - 1 bit. Each bit can be cleared individually.
- * - 1 byte. A byte can be written once. Further writes to an already written
- *   byte cause the contents to be either undefined or to stay unchanged.
- * - 128 bytes. If less than 128 bytes are written, the rest will be
- *   erased. Each write to a 128-byte region will trigger an automatic erase
- *   before anything is written. Very uncommon behaviour and unsupported by
- *   this function.
- * - 256 bytes. If less than 256 bytes are written, the contents of the
- *   unwritten bytes are undefined.
- * Warning: This function assumes that @have and @want point to naturally
- * aligned regions.
- *
- * @have        buffer with current content
- * @want        buffer with desired content
- * @len		length of the checked area
- * @gran	write granularity (enum, not count)
- * @return      0 if no erase is needed, 1 otherwise
- */
-int need_erase(uint8_t *have, uint8_t *want, int len, enum write_granularity gran)
-{
-	int result = 0;
-	int i, j, limit;
-
-	switch (gran) {
-	case write_gran_1bit:
-		for (i = 0; i < len; i++)
-			if ((have[i] & want[i]) != want[i]) {
-				result = 1;
-				break;
-			}
-		break;
-	case write_gran_1byte:
-		for (i = 0; i < len; i++)
-			if ((have[i] != want[i]) && (have[i] != 0xff)) {
-				result = 1;
-				break;
-			}
-		break;
-	case write_gran_256bytes:
-		for (j = 0; j < len / 256; j++) {
-			limit = min (256, len - j * 256);
-			/* Are 'have' and 'want' identical? */
-			if (!memcmp(have + j * 256, want + j * 256, limit))
-				continue;
-			/* have needs to be in erased state. */
-			for (i = 0; i < limit; i++)
-				if (have[j * 256 + i] != 0xff) {
-					result = 1;
-					break;
-				}
-			if (result)
-				break;
-		}
-		break;
-	default:
-		msg_cerr("%s: Unsupported granularity! Please report a bug at "
-			 "flashrom@flashrom.org\n", __func__);
-	}
-	return result;
-}
-
-/**
- * Check if the buffer @have needs to be programmed to get the content of @want.
- * If yes, return 1 and fill in first_start with the start address of the
- * write operation and first_len with the length of the first to-be-written
- * chunk. If not, return 0 and leave first_start and first_len undefined.
- *
- * Warning: This function assumes that @have and @want point to naturally
- * aligned regions.
- *
- * @have	buffer with current content
- * @want	buffer with desired content
- * @len		length of the checked area
- * @gran	write granularity (enum, not count)
- * @first_start	offset of the first byte which needs to be written (passed in
- *		value is increased by the offset of the first needed write
- *		relative to have/want or unchanged if no write is needed)
- * @return	length of the first contiguous area which needs to be written
- *		0 if no write is needed
- *
- * FIXME: This function needs a parameter which tells it about coalescing
- * in relation to the max write length of the programmer and the max write
- * length of the chip.
+ * @cmpbuf	buffer to compare against, cmpbuf[0] is expected to match the
+		flash content at location start
+ * @start	offset to the base address of the flash chip
+ * @len		length of the verified area
+ * @message	string to print in the "FAILED" message
+ * @return	0 for success, -1 for failure
  */
-static int get_next_write(uint8_t *have, uint8_t *want, int len,
-			  int *first_start, enum write_granularity gran)
+int verify_range(struct flashchip *flash, uint8_t *cmpbuf, int start, int len, char *message)
 {
-	int need_write = 0, rel_start = 0, first_len = 0;
-	int i, limit, stride;
-
-	switch (gran) {
-	case write_gran_1bit:
-	case write_gran_1byte:
-		stride = 1;
-		break;
-	case write_gran_256bytes:
-		stride = 256;
-		break;
-	default:
-		msg_cerr("%s: Unsupported granularity! Please report a bug at "
-			 "flashrom@flashrom.org\n", __func__);
-		/* Claim that no write was needed. A write with unknown
-		 * granularity is too dangerous to try.
-		 */
-		return 0;
-	}
-	for (i = 0; i < len / stride; i++) {
-		limit = min(stride, len - i * stride);
-		/* Are 'have' and 'want' identical? */
-		if (memcmp(have + i * stride, want + i * stride, limit)) {
-			if (!need_write) {
-				/* First location where have and want differ. */
-				need_write = 1;
-				rel_start = i * stride;
-			}
-		} else {
-			if (need_write) {
-				/* First location where have and want
-				 * do not differ anymore.
-				 */
-				break;
-			}
-		}
-	}
-	if (need_write)
-		first_len = min(i * stride - rel_start, len);
-	*first_start += rel_start;
-	return first_len;
+	return verify_range_crc32(flash, cmpbuf, start, len, message, NULL);
 }
 
 /* This function generates various test patterns useful for testing controller
@@ -1121,6 +1039,62 @@ int check_max_decode(enum chipbustype buses, uint32_t size)
 	return 1;
 }
 
+/* ID bytes read by the probe functions. Most chips in flashchips[] share a
+ * handful of probe commands, and a command sent again with the same
+ * parameters gives the same answer. With the cache, every distinct command is
+ * sent once and later chips are compared against the stored bytes.
+ * @method and the parameters identify the command, they are chosen by the
+ * probe function. The cache is cleared by programmer_init().
+ */
+#define PROBE_CACHE_ENTRIES	32
+#define PROBE_CACHE_DATA	16
+
+struct probe_cache_entry {
+	enum probe_method method;
+	uint32_t param1;
+	uint32_t param2;
+	uint8_t data[PROBE_CACHE_DATA];
+};
+
+static struct probe_cache_entry probe_cache[PROBE_CACHE_ENTRIES];
+static int probe_cache_count = 0;
+
+void probe_cache_reset(void)
+{
+	probe_cache_count = 0;
+}
+
+/* Returns 1 and fills in @data if the answer is cached, 0 otherwise. */
+int probe_cache_get(enum probe_method method, uint32_t param1,
+		    uint32_t param2, void *data, int len)
+{
+	int i;
+
+	for (i = 0; i < probe_cache_count; i++) {
+		if (probe_cache[i].method != method ||
+		    probe_cache[i].param1 != param1 ||
+		    probe_cache[i].param2 != param2)
+			continue;
+		memcpy(data, probe_cache[i].data, len);
+		return 1;
+	}
+	return 0;
+}
+
+void probe_cache_put(enum probe_method method, uint32_t param1,
+		     uint32_t param2, const void *data, int len)
+{
+	/* A full cache only means that commands are sent again. */
+	if (probe_cache_count >= PROBE_CACHE_ENTRIES ||
+	    len > PROBE_CACHE_DATA)
+		return;
+	probe_cache[probe_cache_count].method = method;
+	probe_cache[probe_cache_count].param1 = param1;
+	probe_cache[probe_cache_count].param2 = param2;
+	memcpy(probe_cache[probe_cache_count].data, data, len);
+	probe_cache_count++;
+}
+
 struct flashchip *probe_flash(struct flashchip *first_flash, int force)
 {
 	struct flashchip *flash;
@@ -1198,17 +1172,494 @@ notfound:
 	return flash;
 }
 
+/* Regions which were erased or written by erase_and_write_flash(), one bit per
+ * DIRTY_GRANULARITY bytes. Everything else was found to be identical to the
+ * new image when the old contents were read.
+ */
+#define DIRTY_GRANULARITY	256
+static uint8_t *dirty_map = NULL;
+static unsigned long dirty_map_size = 0;
+
+static int reset_dirty_map(unsigned long size)
+{
+	free(dirty_map);
+	dirty_map_size = 0;
+	dirty_map = calloc((size / DIRTY_GRANULARITY + 7) / 8, 1);
+	if (!dirty_map) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	dirty_map_size = size;
+	return 0;
+}
+
+static void mark_dirty(unsigned int start, unsigned int len)
+{
+	unsigned long i;
+
+	if (!dirty_map || !len)
+		return;
+	for (i = start / DIRTY_GRANULARITY;
+	     i <= (start + len - 1) / DIRTY_GRANULARITY; i++)
+		dirty_map[i / 8] |= 1 << (i % 8);
+}
+
+static int is_dirty(unsigned long block)
+{
+	return dirty_map[block / 8] & (1 << (block % 8));
+}
+
+/* Number of bytes compared by the last verification. */
+static unsigned long verified_bytes = 0;
+
+/* Only compare regions touched by the last erase_and_write_flash() call.
+ * Adjacent dirty blocks are merged so the readback happens in large chunks.
+ */
+static int verify_written_regions(struct flashchip *flash, uint8_t *buf)
+{
+	unsigned long blocks = dirty_map_size / DIRTY_GRANULARITY;
+	unsigned long i, first, bytes = 0;
+	int ranges = 0, ret = 0;
+	uint32_t crc = 0;
+
+	for (i = 0; i < blocks; i++) {
+		if (is_dirty(i)) {
+			bytes += DIRTY_GRANULARITY;
+			if (!i || !is_dirty(i - 1))
+				ranges++;
+		}
+	}
+	msg_cinfo("Verifying %lu kB written in %i region(s)... ", bytes / 1024,
+		  ranges);
+	verified_bytes = 0;
+
+	for (i = 0; i < blocks && !ret; i++) {
+		if (!is_dirty(i))
+			continue;
+		for (first = i; i < blocks && is_dirty(i); i++)
+			;
+		ret = verify_range_crc32(flash,
+					 buf + first * DIRTY_GRANULARITY,
+					 first * DIRTY_GRANULARITY,
+					 (i - first) * DIRTY_GRANULARITY, NULL,
+					 print_crc32 ? &crc : NULL);
+		verified_bytes += (i - first) * DIRTY_GRANULARITY;
+	}
+
+	if (!ret) {
+		msg_cinfo("VERIFIED.          \n");
+		if (print_crc32)
+			msg_cinfo("CRC32 of the written regions is 0x%08x.\n",
+				  crc);
+	}
+	return ret;
+}
+
+/* Areas of the chip which were read by read_included_regions(). If
+ * known_count is 0, the whole chip contents are known.
+ */
+struct chip_range {
+	unsigned int start;
+	unsigned int len;
+};
+static struct chip_range *known_ranges = NULL;
+static int known_count = 0;
+
+static void forget_known_ranges(void)
+{
+	free(known_ranges);
+	known_ranges = NULL;
+	known_count = 0;
+}
+
+/* Ranges have to be added in ascending order of their start address. */
+static int add_known_range(unsigned int start, unsigned int len)
+{
+	struct chip_range *last, *tmp;
+
+	if (known_count) {
+		last = &known_ranges[known_count - 1];
+		if (start <= last->start + last->len) {
+			if (start + len > last->start + last->len)
+				last->len = start + len - last->start;
+			return 0;
+		}
+	}
+	tmp = realloc(known_ranges, (known_count + 1) * sizeof(*tmp));
+	if (!tmp) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	known_ranges = tmp;
+	known_ranges[known_count].start = start;
+	known_ranges[known_count].len = len;
+	known_count++;
+	return 0;
+}
+
+static int range_is_known(unsigned int start, unsigned int len)
+{
+	int i;
+
+	if (!known_count)
+		return 1;
+	for (i = 0; i < known_count; i++)
+		if (start >= known_ranges[i].start &&
+		    start + len <= known_ranges[i].start + known_ranges[i].len)
+			return 1;
+	return 0;
+}
+
+/* Number of bytes in the known areas of a chip with @size bytes. */
+static unsigned long known_size(unsigned long size)
+{
+	unsigned long total = 0;
+	int i;
+
+	if (!known_count)
+		return size;
+	for (i = 0; i < known_count; i++)
+		total += known_ranges[i].len;
+	return total;
+}
+
+/* Compare two images, but only in the areas of the chip which are known. */
+static int compare_known_ranges(uint8_t *a, uint8_t *b, unsigned long size)
+{
+	int i;
+
+	if (!known_count)
+		return memcmp(a, b, size);
+	for (i = 0; i < known_count; i++)
+		if (memcmp(a + known_ranges[i].start, b + known_ranges[i].start,
+			   known_ranges[i].len))
+			return 1;
+	return 0;
+}
+
+/* Chip contents read during a batch session, so operations on the same chip
+ * read every region at most once. One flag per SESSION_GRANULARITY bytes in
+ * session_map tells which parts of session_image are valid. Regions touched
+ * by erase_and_write_flash() only become valid again after a successful
+ * verification.
+ */
+#define SESSION_GRANULARITY	256
+static uint8_t *session_image = NULL;
+static uint8_t *session_map = NULL;
+static unsigned long session_size = 0;
+
+static void end_session(void)
+{
+	free(session_image);
+	free(session_map);
+	session_image = NULL;
+	session_map = NULL;
+	session_size = 0;
+}
+
+static int start_session(unsigned long size)
+{
+	end_session();
+	session_image = malloc(size);
+	session_map = calloc(size / SESSION_GRANULARITY, 1);
+	if (!session_image || !session_map) {
+		msg_gerr("Out of memory!\n");
+		end_session();
+		return 1;
+	}
+	session_size = size;
+	return 0;
+}
+
+/* Remember @buf as the chip contents from @start to @start + @len - 1. Only
+ * chunks which are covered completely are stored.
+ */
+static void session_store(uint8_t *buf, unsigned int start, unsigned int len)
+{
+	unsigned long i;
+
+	if (!session_image)
+		return;
+	for (i = (start + SESSION_GRANULARITY - 1) / SESSION_GRANULARITY;
+	     (i + 1) * SESSION_GRANULARITY <= start + len; i++) {
+		memcpy(session_image + i * SESSION_GRANULARITY,
+		       buf + i * SESSION_GRANULARITY - start,
+		       SESSION_GRANULARITY);
+		session_map[i] = 1;
+	}
+}
+
+/* Forget everything erase_and_write_flash() may have changed. */
+static void session_forget_dirty(void)
+{
+	unsigned long i;
+
+	if (!session_image)
+		return;
+	if (!dirty_map || dirty_map_size != session_size) {
+		memset(session_map, 0, session_size / SESSION_GRANULARITY);
+		return;
+	}
+	for (i = 0; i < session_size / SESSION_GRANULARITY; i++)
+		if (is_dirty(i))
+			session_map[i] = 0;
+}
+
+/* Read the parts of the given area which are not valid in the session image
+ * yet, in as few chunks as possible.
+ */
+static int session_fill(struct flashchip *flash, unsigned int start,
+			unsigned int len)
+{
+	unsigned long i, first, last;
+
+	last = (start + len - 1) / SESSION_GRANULARITY;
+	for (i = start / SESSION_GRANULARITY; i <= last; i++) {
+		if (session_map[i])
+			continue;
+		for (first = i; i <= last && !session_map[i]; i++)
+			;
+		if (flash->read(flash, session_image +
+				first * SESSION_GRANULARITY,
+				first * SESSION_GRANULARITY,
+				(i - first) * SESSION_GRANULARITY))
+			return 1;
+		memset(session_map + first, 1, i - first);
+	}
+	return 0;
+}
+
+/* Read from the chip, or from the session image where it is valid. */
+static int read_chip(struct flashchip *flash, uint8_t *buf, unsigned int start,
+		     unsigned int len)
+{
+	if (!session_image)
+		return flash->read(flash, buf, start, len);
+	if (session_fill(flash, start, len))
+		return 1;
+	memcpy(buf, session_image + start, len);
+	return 0;
+}
+
+/* After a successful verification the chip matches @buf in all known areas. */
+static void session_store_known(uint8_t *buf, unsigned long size)
+{
+	int i;
+
+	if (!known_count) {
+		session_store(buf, 0, size);
+		return;
+	}
+	for (i = 0; i < known_count; i++)
+		session_store(buf + known_ranges[i].start,
+			      known_ranges[i].start, known_ranges[i].len);
+}
+
+/* Like verify_flash(), but against the contents read in this session. */
+static int verify_session(struct flashchip *flash, uint8_t *buf)
+{
+	unsigned long size = flash->total_size * 1024;
+	unsigned long start, len, i;
+	int r, ret = 0;
+
+	msg_cinfo("Verifying flash against the session image... ");
+	verified_bytes = 0;
+	for (r = 0; r < max(known_count, 1) && !ret; r++) {
+		start = known_count ? known_ranges[r].start : 0;
+		len = known_count ? known_ranges[r].len : size;
+		if (session_fill(flash, start, len)) {
+			msg_gerr("Verification impossible because read "
+				 "failed.\n");
+			return 1;
+		}
+		verified_bytes += len;
+		if (!memcmp(session_image + start, buf + start, len))
+			continue;
+		for (i = start; buf[i] == session_image[i]; i++)
+			;
+		msg_cerr("VERIFY FAILED at 0x%08lx! Expected=0x%02x, "
+			 "Read=0x%02x\n", i, buf[i], session_image[i]);
+		ret = -1;
+	}
+	if (!ret)
+		msg_cinfo("VERIFIED.          \n");
+	return ret;
+}
+
+static int check_block_eraser(struct flashchip *flash, int k, int log);
+
+/* Find the erase block of @eraser which contains @addr. Whole regions are
+ * skipped at once, so the cost only depends on NUM_ERASEREGIONS and not on
+ * the number of blocks.
+ * Returns the block number and stores the block boundaries in @start and
+ * @len, or returns -1 if @addr is beyond the eraseblock layout.
+ */
+int find_eraseblock(const struct block_eraser *eraser, unsigned int addr,
+		    unsigned int *start, unsigned int *len)
+{
+	unsigned int region_start = 0, region_len, n;
+	int i, block = 0;
+
+	for (i = 0; i < NUM_ERASEREGIONS; i++) {
+		region_len = eraser->eraseblocks[i].size *
+			     eraser->eraseblocks[i].count;
+		if (addr - region_start < region_len) {
+			*len = eraser->eraseblocks[i].size;
+			n = (addr - region_start) / *len;
+			*start = region_start + n * *len;
+			return block + n;
+		}
+		region_start += region_len;
+		block += eraser->eraseblocks[i].count;
+	}
+	return -1;
+}
+
+/* Grow the area @first-@last to the nearest erase block boundaries. For each
+ * end the smallest block of any usable erase function is used, so the erase
+ * planner can work on the area without touching unknown chip contents.
+ */
+static void align_to_eraseblocks(struct flashchip *flash, unsigned int *first,
+				 unsigned int *last)
+{
+	unsigned int size = flash->total_size * 1024;
+	unsigned int new_first = 0, new_last = size - 1;
+	unsigned int start, len;
+	int k;
+
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		struct block_eraser *eraser = &flash->block_erasers[k];
+
+		if (check_block_eraser(flash, k, 0))
+			continue;
+		if (find_eraseblock(eraser, *first, &start, &len) >= 0 &&
+		    start > new_first)
+			new_first = start;
+		if (find_eraseblock(eraser, *last, &start, &len) >= 0 &&
+		    start + len - 1 < new_last)
+			new_last = start + len - 1;
+	}
+	*first = new_first;
+	*last = new_last;
+}
+
+/* Read only the areas of the chip covered by included romentries into @buf.
+ * With @align, the areas are grown to erase block boundaries first, which is
+ * needed if the contents are used to erase and write the chip.
+ * If @buf is NULL, the areas are only recorded as known.
+ * Returns 0 on success.
+ */
+static int read_included_regions(struct flashchip *flash, uint8_t *buf,
+				 int align)
+{
+	unsigned int size = flash->total_size * 1024;
+	unsigned int start = 0, first, last;
+	unsigned long bytes = 0;
+
+	forget_known_ranges();
+	while (find_next_included_range(start, size, &first, &last)) {
+		if (align)
+			align_to_eraseblocks(flash, &first, &last);
+		/* Growing may have covered a part of the next area already. */
+		if (first < start)
+			first = start;
+		if (buf) {
+			msg_cdbg("Reading 0x%06x-0x%06x...\n", first, last);
+			if (read_chip(flash, buf + first, first,
+				      last - first + 1)) {
+				forget_known_ranges();
+				return 1;
+			}
+		}
+		if (add_known_range(first, last - first + 1)) {
+			forget_known_ranges();
+			return 1;
+		}
+		bytes += last - first + 1;
+		if (last == size - 1)
+			break;
+		start = last + 1;
+	}
+	msg_cdbg("Using %lu kB of %u kB in %i region(s) of the chip.\n",
+		 bytes / 1024, size / 1024, known_count);
+	return 0;
+}
+
+/* Read the areas skipped by read_included_regions() into @buf. They are not
+ * part of an included romentry, so their contents stay unchanged and are
+ * copied to @oldcontents and @newcontents as well.
+ */
+static int read_unknown_regions(struct flashchip *flash, uint8_t *buf,
+				uint8_t *oldcontents, uint8_t *newcontents)
+{
+	unsigned int size = flash->total_size * 1024;
+	unsigned int start = 0, end;
+	int i;
+
+	if (!known_count)
+		return 0;
+	for (i = 0; i <= known_count; i++) {
+		end = (i < known_count) ? known_ranges[i].start : size;
+		if (end > start) {
+			msg_cdbg("Reading 0x%06x-0x%06x...\n", start, end - 1);
+			if (read_chip(flash, buf + start, start, end - start))
+				return 1;
+			memcpy(oldcontents + start, buf + start, end - start);
+			memcpy(newcontents + start, buf + start, end - start);
+		}
+		if (i < known_count)
+			start = known_ranges[i].start + known_ranges[i].len;
+	}
+	forget_known_ranges();
+	return 0;
+}
+
+/* Only compare the areas read by read_included_regions(). */
+static int verify_known_regions(struct flashchip *flash, uint8_t *buf)
+{
+	unsigned long bytes = 0;
+	int i, ret = 0;
+
+	for (i = 0; i < known_count; i++)
+		bytes += known_ranges[i].len;
+	msg_cinfo("Verifying %lu kB in %i region(s)... ", bytes / 1024,
+		  known_count);
+	verified_bytes = 0;
+
+	for (i = 0; i < known_count && !ret; i++) {
+		ret = verify_range(flash, buf + known_ranges[i].start,
+				   known_ranges[i].start, known_ranges[i].len,
+				   NULL);
+		verified_bytes += known_ranges[i].len;
+	}
+
+	if (!ret)
+		msg_cinfo("VERIFIED.          \n");
+	return ret;
+}
+
 int verify_flash(struct flashchip *flash, uint8_t *buf)
 {
 	int ret;
 	int total_size = flash->total_size * 1024;
+	uint32_t crc = 0;
+
+	if (verify_written_only && dirty_map && dirty_map_size == total_size)
+		return verify_written_regions(flash, buf);
+	if (known_count)
+		return verify_known_regions(flash, buf);
 
 	msg_cinfo("Verifying flash... ");
 
-	ret = verify_range(flash, buf, 0, total_size, NULL);
+	ret = verify_range_crc32(flash, buf, 0, total_size, NULL,
+				 print_crc32 ? &crc : NULL);
+	verified_bytes = total_size;
 
-	if (!ret)
+	if (!ret) {
 		msg_cinfo("VERIFIED.          \n");
+		if (print_crc32)
+			msg_cinfo("CRC32 of flash contents is 0x%08x.\n", crc);
+	}
 
 	return ret;
 }
@@ -1274,6 +1725,8 @@ int read_flash_to_file(struct flashchip *flash, char *filename)
 {
 	unsigned long size = flash->total_size * 1024;
 	unsigned char *buf = calloc(size, sizeof(char));
+	unsigned int first, last;
+	unsigned long start;
 	int ret = 0;
 
 	msg_cinfo("Reading flash... ");
@@ -1287,12 +1740,29 @@ int read_flash_to_file(struct flashchip *flash, char *filename)
 		ret = 1;
 		goto out_free;
 	}
-	if (flash->read(flash, buf, 0, size)) {
+	/* With included romentries only those are read, the rest of the
+	 * image is left erased.
+	 */
+	start = timer_usecs();
+	if (find_next_included_range(0, size, &first, &last)) {
+		memset(buf, 0xff, size);
+		ret = read_included_regions(flash, buf, 0);
+		event_phase("read", timer_usecs() - start, known_size(size),
+			    ret);
+		forget_known_ranges();
+	} else {
+		ret = read_chip(flash, buf, 0, size);
+		event_phase("read", timer_usecs() - start, size, ret);
+	}
+	if (ret) {
 		msg_cerr("Read operation failed!\n");
 		ret = 1;
 		goto out_free;
 	}
 
+	if (print_crc32)
+		msg_cinfo("CRC32 0x%08x... ", crc32_update(0, buf, size));
+
 	ret = write_buf_to_file(buf, flash->total_size * 1024, filename);
 out_free:
 	free(buf);
@@ -1303,8 +1773,10 @@ out_free:
 /* This function shares a lot of its structure with erase_and_write_flash() and
  * walk_eraseregions().
  * Even if an error is found, the function will keep going and check the rest.
+ * It only depends on flashchips.c, so it runs at build time with "make check"
+ * instead of on every start.
  */
-static int selfcheck_eraseblocks(struct flashchip *flash)
+int selfcheck_eraseblocks(struct flashchip *flash)
 {
 	int i, j, k;
 	int ret = 0;
@@ -1369,6 +1841,11 @@ static int selfcheck_eraseblocks(struct flashchip *flash)
 	return ret;
 }
 
+/* Time spent in and bytes handled by erase and write functions during the
+ * current erase_and_write_flash(), for the event stream.
+ */
+static unsigned long erase_usecs, erase_bytes, write_usecs, write_bytes;
+
 static int erase_and_write_block_helper(struct flashchip *flash,
 					unsigned int start, unsigned int len,
 					uint8_t *curcontents,
@@ -1382,6 +1859,7 @@ static int erase_and_write_block_helper(struct flashchip *flash,
 	int ret = 0;
 	int skip = 1;
 	int writecount = 0;
+	unsigned long usecs;
 	enum write_granularity gran = write_gran_256bytes; /* FIXME */
 
 	/* curcontents and newcontents are opaque to walk_eraseregions, and
@@ -1393,7 +1871,14 @@ static int erase_and_write_block_helper(struct flashchip *flash,
 	/* FIXME: Assume 256 byte granularity for now to play it safe. */
 	if (need_erase(curcontents, newcontents, len, gran)) {
 		msg_cdbg("E");
+		mark_dirty(start, len);
+		usecs = timer_usecs();
 		ret = erasefn(flash, start, len);
+		usecs = timer_usecs() - usecs;
+		event("erase", "\"start\":%u,\"len\":%u,\"duration_us\":%lu,"
+		      "\"status\":%i", start, len, usecs, ret);
+		erase_usecs += usecs;
+		erase_bytes += len;
 		if (ret)
 			return ret;
 		/* Erase was successful. Adjust curcontents. */
@@ -1406,16 +1891,25 @@ static int erase_and_write_block_helper(struct flashchip *flash,
 					 len - starthere, &starthere, gran))) {
 		if (!writecount++)
 			msg_cdbg("W");
+		mark_dirty(start + starthere, lenhere);
+		usecs = timer_usecs();
 		/* Needs the partial write function signature. */
 		ret = flash->write(flash, newcontents + starthere,
 				   start + starthere, lenhere);
+		usecs = timer_usecs() - usecs;
+		event("write", "\"start\":%u,\"len\":%i,\"duration_us\":%lu,"
+		      "\"status\":%i", start + starthere, lenhere, usecs, ret);
+		write_usecs += usecs;
+		write_bytes += lenhere;
 		if (ret)
 			return ret;
 		starthere += lenhere;
 		skip = 0;
 	}
-	if (skip)
+	if (skip) {
 		msg_cdbg("S");
+		event("skip", "\"start\":%u,\"len\":%u", start, len);
+	}
 	return ret;
 }
 
@@ -1482,27 +1976,441 @@ static int check_block_eraser(struct flashchip *flash, int k, int log)
 	return 0;
 }
 
+/* Rough timing model used by the erase planner. The values are typical for
+ * SPI and FWH parts (4 kB sector ~40 ms, 64 kB block ~0.3 s, 256 byte page
+ * ~1 ms). They only need to be good enough to rank erase block sizes.
+ */
+#define PLAN_ERASE_BASE_US	20000
+#define PLAN_ERASE_PER_KB_US	5000
+#define PLAN_WRITE_PER_256_US	1000
+#define PLAN_COST_UNUSABLE	((unsigned long)-1)
+
+struct erase_plan_block {
+	unsigned int start;
+	unsigned int len;
+	int erasefunction;
+	int need_erase;
+	unsigned long cost;
+};
+
+struct erase_plan {
+	int count;
+	struct erase_plan_block *blocks;
+	unsigned long cost;
+};
+
+static unsigned long plan_erase_cost(unsigned int len)
+{
+	return PLAN_ERASE_BASE_US + (unsigned long)(len / 1024) * PLAN_ERASE_PER_KB_US;
+}
+
+/* Count the 256 byte chunks in @want which differ from @have. If @have is NULL,
+ * the area is assumed to be erased.
+ */
+static unsigned long plan_write_chunks(uint8_t *have, uint8_t *want, unsigned int len)
+{
+	unsigned long chunks = 0;
+	unsigned int i, j, limit;
+
+	for (i = 0; i < len; i += 256) {
+		limit = min(256, len - i);
+		if (have) {
+			if (memcmp(have + i, want + i, limit))
+				chunks++;
+			continue;
+		}
+		for (j = 0; j < limit; j++)
+			if (want[i + j] != 0xff) {
+				chunks++;
+				break;
+			}
+	}
+	return chunks;
+}
+
+static void plan_fill_block(struct erase_plan_block *block, uint8_t *have,
+			    uint8_t *want)
+{
+	have += block->start;
+	want += block->start;
+	block->need_erase = need_erase(have, want, block->len,
+				       write_gran_256bytes);
+	/* Erasing a block which was only read partially would destroy the
+	 * unread part.
+	 */
+	if (block->need_erase && !range_is_known(block->start, block->len))
+		block->cost = PLAN_COST_UNUSABLE;
+	else if (block->need_erase)
+		block->cost = plan_erase_cost(block->len) +
+			      plan_write_chunks(NULL, want, block->len) *
+			      PLAN_WRITE_PER_256_US;
+	else
+		block->cost = plan_write_chunks(have, want, block->len) *
+			      PLAN_WRITE_PER_256_US;
+}
+
+static int plan_compare_start(const void *a, const void *b)
+{
+	const struct erase_plan_block *x = a;
+	const struct erase_plan_block *y = b;
+
+	if (x->start != y->start)
+		return (x->start < y->start) ? -1 : 1;
+	return x->erasefunction - y->erasefunction;
+}
+
+static int plan_compare_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Find the index of @addr in the sorted array @bounds, -1 if not found. */
+static int plan_find_bound(unsigned int *bounds, int count, unsigned int addr)
+{
+	int lo = 0, hi = count - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (bounds[mid] == addr)
+			return mid;
+		if (bounds[mid] < addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/* Estimate the cost of handling the whole chip with a single erase function,
+ * i.e. what walk_eraseregions() would do with erase_and_write_block_helper().
+ */
+static unsigned long plan_single_eraser_cost(struct flashchip *flash, int k,
+					     uint8_t *have, uint8_t *want)
+{
+	struct block_eraser eraser = flash->block_erasers[k];
+	struct erase_plan_block block;
+	unsigned long cost = 0;
+	unsigned int start = 0;
+	int i, j;
+
+	for (i = 0; i < NUM_ERASEREGIONS; i++) {
+		for (j = 0; j < eraser.eraseblocks[i].count; j++) {
+			block.start = start;
+			block.len = eraser.eraseblocks[i].size;
+			plan_fill_block(&block, have, want);
+			if (block.cost == PLAN_COST_UNUSABLE)
+				return PLAN_COST_UNUSABLE;
+			cost += block.cost;
+			start += block.len;
+		}
+	}
+	return cost;
+}
+
+/* Build the cheapest combination of erase blocks from all usable erase
+ * functions which covers the whole chip. Blocks of different erase functions
+ * can be mixed freely as long as their boundaries line up, so this is a
+ * shortest path search over all block boundaries.
+ * Returns 0 on success, 1 if no plan could be built.
+ */
+static int plan_erase_blocks(struct flashchip *flash, uint8_t *have,
+			     uint8_t *want, struct erase_plan *plan)
+{
+	struct erase_plan_block *cand = NULL;
+	unsigned int *bounds = NULL;
+	unsigned long *best = NULL;
+	int *prev = NULL;
+	int ncand = 0, nbounds = 0;
+	int i, j, k, from, to;
+	unsigned int start;
+	unsigned int size = flash->total_size * 1024;
+	int ret = 1;
+
+	plan->count = 0;
+	plan->blocks = NULL;
+	plan->cost = 0;
+
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		if (check_block_eraser(flash, k, 0))
+			continue;
+		for (i = 0; i < NUM_ERASEREGIONS; i++)
+			ncand += flash->block_erasers[k].eraseblocks[i].count;
+	}
+	if (!ncand)
+		return 1;
+
+	cand = malloc(ncand * sizeof(*cand));
+	bounds = malloc((ncand + 1) * sizeof(*bounds));
+	if (!cand || !bounds) {
+		msg_gerr("Out of memory!\n");
+		goto out;
+	}
+
+	ncand = 0;
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		struct block_eraser eraser = flash->block_erasers[k];
+
+		if (check_block_eraser(flash, k, 0))
+			continue;
+		start = 0;
+		for (i = 0; i < NUM_ERASEREGIONS; i++) {
+			for (j = 0; j < eraser.eraseblocks[i].count; j++) {
+				cand[ncand].start = start;
+				cand[ncand].len = eraser.eraseblocks[i].size;
+				cand[ncand].erasefunction = k;
+				plan_fill_block(&cand[ncand], have, want);
+				bounds[ncand] = start;
+				start += eraser.eraseblocks[i].size;
+				ncand++;
+			}
+		}
+	}
+	bounds[ncand] = size;
+	qsort(cand, ncand, sizeof(*cand), plan_compare_start);
+	qsort(bounds, ncand + 1, sizeof(*bounds), plan_compare_uint);
+	for (i = 1, nbounds = 1; i <= ncand; i++)
+		if (bounds[i] != bounds[nbounds - 1])
+			bounds[nbounds++] = bounds[i];
+
+	best = malloc(nbounds * sizeof(*best));
+	prev = malloc(nbounds * sizeof(*prev));
+	if (!best || !prev) {
+		msg_gerr("Out of memory!\n");
+		goto out;
+	}
+	for (i = 0; i < nbounds; i++) {
+		best[i] = (unsigned long)-1;
+		prev[i] = -1;
+	}
+	best[0] = 0;
+
+	/* Candidates are sorted by start address, so every boundary has its
+	 * final cost before any block starting there is looked at.
+	 */
+	for (i = 0; i < ncand; i++) {
+		from = plan_find_bound(bounds, nbounds, cand[i].start);
+		to = plan_find_bound(bounds, nbounds,
+				     cand[i].start + cand[i].len);
+		if (from < 0 || to < 0 || best[from] == (unsigned long)-1 ||
+		    cand[i].cost == PLAN_COST_UNUSABLE)
+			continue;
+		if (best[from] + cand[i].cost < best[to]) {
+			best[to] = best[from] + cand[i].cost;
+			prev[to] = i;
+		}
+	}
+	if (bounds[nbounds - 1] != size || prev[nbounds - 1] < 0)
+		goto out;
+
+	/* Walk back from the end of the chip to count and collect blocks. */
+	for (to = nbounds - 1; to > 0; to = from) {
+		from = plan_find_bound(bounds, nbounds, cand[prev[to]].start);
+		plan->count++;
+	}
+	plan->blocks = malloc(plan->count * sizeof(*plan->blocks));
+	if (!plan->blocks) {
+		msg_gerr("Out of memory!\n");
+		plan->count = 0;
+		goto out;
+	}
+	i = plan->count;
+	for (to = nbounds - 1; to > 0; to = from) {
+		plan->blocks[--i] = cand[prev[to]];
+		from = plan_find_bound(bounds, nbounds, cand[prev[to]].start);
+	}
+	plan->cost = best[nbounds - 1];
+	ret = 0;
+out:
+	free(prev);
+	free(best);
+	free(bounds);
+	free(cand);
+	return ret;
+}
+
+static void print_erase_plan(struct flashchip *flash, struct erase_plan *plan,
+			     uint8_t *have, uint8_t *want)
+{
+	int i, k;
+	unsigned long erased = 0, erases = 0, written = 0, chunks, cost;
+	struct erase_plan_block *block;
+
+	msg_cinfo("\nErase plan:\n");
+	for (i = 0; i < plan->count; i++) {
+		block = &plan->blocks[i];
+		if (block->need_erase) {
+			erases++;
+			erased += block->len;
+			chunks = plan_write_chunks(NULL, want + block->start,
+						   block->len);
+		} else {
+			chunks = plan_write_chunks(have + block->start,
+						   want + block->start,
+						   block->len);
+		}
+		written += chunks * 256;
+		if (!block->need_erase && !chunks)
+			continue;
+		msg_cinfo("0x%06x-0x%06x %s with erase function %i, "
+			  "~%lu ms\n", block->start,
+			  block->start + block->len - 1,
+			  block->need_erase ? (chunks ? "erase+write" : "erase") :
+			  "write", block->erasefunction, block->cost / 1000);
+	}
+	msg_cinfo("Planned %lu erase(s) covering %lu kB, ~%lu kB to write, "
+		  "estimated %lu ms.\n", erases, erased / 1024, written / 1024,
+		  plan->cost / 1000);
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		if (check_block_eraser(flash, k, 0))
+			continue;
+		cost = plan_single_eraser_cost(flash, k, have, want);
+		if (cost == PLAN_COST_UNUSABLE)
+			msg_cinfo("Using only erase function %i: needs a read "
+				  "of the whole chip.\n", k);
+		else
+			msg_cinfo("Using only erase function %i: estimated "
+				  "%lu ms.\n", k, cost / 1000);
+	}
+}
+
+/* Like the plan cost of @block, but with the erase and program latencies
+ * measured on @flash so far where there are any.
+ */
+static unsigned long plan_block_estimate(struct flashchip *flash,
+					 struct erase_plan_block *block,
+					 uint8_t *have, uint8_t *want)
+{
+	unsigned long erase = 0, write, chunks;
+
+	if (block->need_erase) {
+		erase = jedec_erase_estimate(flash, block->len);
+		if (!erase)
+			erase = plan_erase_cost(block->len);
+		chunks = plan_write_chunks(NULL, want + block->start,
+					   block->len);
+	} else {
+		chunks = plan_write_chunks(have + block->start,
+					   want + block->start, block->len);
+	}
+	write = jedec_write_estimate(flash, chunks * 256);
+	if (!write)
+		write = chunks * PLAN_WRITE_PER_256_US;
+	return erase + write;
+}
+
+/* Minimum time between two estimates of the remaining time. */
+#define PLAN_ETA_INTERVAL_US	(2 * 1000 * 1000)
+
+static int execute_erase_plan(struct flashchip *flash, struct erase_plan *plan,
+			      uint8_t *curcontents, uint8_t *newcontents)
+{
+	int i, j;
+	struct erase_plan_block *block;
+	unsigned long now, last, remaining;
+
+	last = timer_usecs();
+	for (i = 0; i < plan->count; i++) {
+		block = &plan->blocks[i];
+		if (i)
+			msg_cdbg(", ");
+		msg_cdbg("0x%06x-0x%06x", block->start,
+			 block->start + block->len - 1);
+		if (erase_and_write_block_helper(flash, block->start,
+				block->len, curcontents, newcontents,
+				flash->block_erasers[block->erasefunction].block_erase)) {
+			msg_cdbg("\n");
+			return 1;
+		}
+		now = timer_usecs();
+		if (now - last < PLAN_ETA_INTERVAL_US)
+			continue;
+		last = now;
+		/* The blocks not done yet still have their old contents in
+		 * curcontents.
+		 */
+		remaining = 0;
+		for (j = i + 1; j < plan->count; j++)
+			remaining += plan_block_estimate(flash, &plan->blocks[j],
+							 curcontents,
+							 newcontents);
+		if (remaining >= 1000 * 1000)
+			msg_cinfo("[%i%%, ~%lu s left] ",
+				  (i + 1) * 100 / plan->count,
+				  remaining / (1000 * 1000));
+	}
+	msg_cdbg("\n");
+	return 0;
+}
+
 int erase_and_write_flash(struct flashchip *flash, uint8_t *oldcontents, uint8_t *newcontents)
 {
 	int k, ret = 0;
 	uint8_t *curcontents;
 	unsigned long size = flash->total_size * 1024;
 	int usable_erasefunctions = 0;
+	struct erase_plan plan;
 
 	for (k = 0; k < NUM_ERASEFUNCTIONS; k++)
 		if (!check_block_eraser(flash, k, 0))
 			usable_erasefunctions++;
-	msg_cinfo("Erasing and writing flash chip... ");
+	if (!dry_run)
+		msg_cinfo("Erasing and writing flash chip... ");
 	if (!usable_erasefunctions) {
 		msg_cerr("ERROR: flashrom has no erase function for this flash "
 			 "chip.\n");
 		return 1;
 	}
 
+	if (!dry_run && reset_dirty_map(size))
+		return 1;
+	erase_usecs = erase_bytes = write_usecs = write_bytes = 0;
+
 	curcontents = (uint8_t *) malloc(size);
 	/* Copy oldcontents to curcontents to avoid clobbering oldcontents. */
 	memcpy(curcontents, oldcontents, size);
 
+	/* Pick the cheapest mix of erase block sizes first. The single erase
+	 * function walk below is the fallback if the plan can't be built or
+	 * executing it fails.
+	 */
+	if (plan_erase_blocks(flash, curcontents, newcontents, &plan)) {
+		if (dry_run) {
+			msg_cerr("Could not build an erase plan.\n");
+			free(curcontents);
+			return 1;
+		}
+	} else if (dry_run) {
+		print_erase_plan(flash, &plan, curcontents, newcontents);
+		free(plan.blocks);
+		free(curcontents);
+		return 0;
+	} else {
+		msg_cdbg("Using erase plan with %i blocks, estimated %lu ms... ",
+			 plan.count, plan.cost / 1000);
+		ret = execute_erase_plan(flash, &plan, curcontents, newcontents);
+		free(plan.blocks);
+		if (!ret)
+			goto out;
+		msg_cdbg("Erase plan failed, looking at single erase "
+			 "functions.\n");
+		if (flash->read(flash, curcontents, 0, size)) {
+			msg_cerr("Can't read anymore!\n");
+			goto out;
+		}
+	}
+
+	/* Walking a single erase function may erase blocks which were not
+	 * read before, so their contents are needed now.
+	 */
+	if (read_unknown_regions(flash, curcontents, oldcontents, newcontents)) {
+		msg_cerr("Can't read anymore!\n");
+		ret = 1;
+		goto out;
+	}
+
 	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
 		msg_cdbg("Looking at blockwise erase function %i... ", k);
 		if (check_block_eraser(flash, k, 1) && usable_erasefunctions) {
@@ -1533,8 +2441,11 @@ int erase_and_write_flash(struct flashchip *flash, uint8_t *oldcontents, uint8_t
 			break;
 		}
 	}
+out:
 	/* Free the scratchpad. */
 	free(curcontents);
+	event_phase("erase", erase_usecs, erase_bytes, ret);
+	event_phase("write", write_usecs, write_bytes, ret);
 
 	if (ret) {
 		msg_cerr("FAILED!\n");
@@ -1685,7 +2596,6 @@ void print_banner(void)
 int selfcheck(void)
 {
 	int ret = 0;
-	struct flashchip *flash;
 
 	/* Safety check. Instead of aborting after the first error, check
 	 * if more errors exist.
@@ -1698,9 +2608,6 @@ int selfcheck(void)
 		msg_gerr("SPI programmer table miscompilation!\n");
 		ret = 1;
 	}
-	for (flash = flashchips; flash && flash->name; flash++)
-		if (selfcheck_eraseblocks(flash))
-			ret = 1;
 	return ret;
 }
 
@@ -1753,11 +2660,6 @@ void check_chip_supported(struct flashchip *flash)
 	}
 }
 
-int main(int argc, char *argv[])
-{
-	return cli_classic(argc, argv);
-}
-
 /* FIXME: This function signature needs to be improved once doit() has a better
  * function signature.
  */
@@ -1814,16 +2716,95 @@ int chip_safety_check(struct flashchip *flash, int force, char *filename, int re
 	return 0;
 }
 
+/* Number and size of the blocks read to check a reference image. */
+#define SPOT_CHECK_BLOCKS	16
+#define SPOT_CHECK_SIZE		(4 * 1024)
+
+/* Fill oldcontents from reference_file instead of reading the whole chip.
+ * A sample of blocks spread over the chip is read back to catch a stale
+ * reference. The samples start at a different block on every run, so
+ * repeated runs eventually cover the whole chip.
+ * Returns 0 if the reference can be used.
+ */
+static int use_reference_image(struct flashchip *flash, uint8_t *oldcontents)
+{
+	unsigned long size = flash->total_size * 1024;
+	unsigned long blocks, samples, first, start, len, i;
+	uint8_t *buf;
+	int ret = 1;
+
+	msg_cdbg("Reading reference image %s...\n", reference_file);
+	if (read_buf_from_file(oldcontents, size, reference_file))
+		return 1;
+	if (reference_crc32_valid &&
+	    crc32_update(0, oldcontents, size) != reference_crc32) {
+		msg_cerr("Reference image %s doesn't have CRC32 0x%08x.\n",
+			 reference_file, reference_crc32);
+		return 1;
+	}
+
+	buf = malloc(SPOT_CHECK_SIZE);
+	if (!buf) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	blocks = (size + SPOT_CHECK_SIZE - 1) / SPOT_CHECK_SIZE;
+	samples = min(SPOT_CHECK_BLOCKS, blocks);
+	first = time(NULL) % blocks;
+	for (i = 0; i < samples; i++) {
+		start = (first + i * blocks / samples) % blocks *
+			SPOT_CHECK_SIZE;
+		len = min(SPOT_CHECK_SIZE, size - start);
+		if (flash->read(flash, buf, start, len))
+			goto out;
+		if (memcmp(buf, oldcontents + start, len)) {
+			msg_cinfo("Chip contents at 0x%06lx differ from the "
+				  "reference image.\n", start);
+			goto out;
+		}
+	}
+	msg_cdbg("Reference image matches %lu sampled blocks.\n", samples);
+	ret = 0;
+out:
+	free(buf);
+	return ret;
+}
+
+/* Store the new chip contents in cache_dir, named after their CRC32, so a
+ * later run can use them with --reference-crc32.
+ */
+static void store_cached_image(uint8_t *contents, unsigned long size)
+{
+	uint32_t crc = crc32_update(0, contents, size);
+	char *path;
+
+	path = malloc(strlen(cache_dir) + sizeof("/12345678.bin"));
+	if (!path) {
+		msg_gerr("Out of memory!\n");
+		return;
+	}
+	sprintf(path, "%s/%08x.bin", cache_dir, crc);
+	if (!write_buf_to_file(contents, size, path))
+		msg_cinfo("Stored the chip contents as %s.\n", path);
+	free(path);
+}
+
 /* This function signature is horrible. We need to design a better interface,
  * but right now it allows us to split off the CLI code.
  * Besides that, the function itself is a textbook example of abysmal code flow.
  */
-int doit(struct flashchip *flash, int force, char *filename, int read_it, int write_it, int erase_it, int verify_it)
+static int doit_operation(struct flashchip *flash, int force, char *filename,
+			  int read_it, int write_it, int erase_it,
+			  int verify_it)
 {
 	uint8_t *oldcontents;
 	uint8_t *newcontents;
 	int ret = 0;
+	int used_reference = 0;
+	int saved_verify_written_only = verify_written_only;
 	unsigned long size = flash->total_size * 1024;
+	unsigned long start;
+	unsigned int first, last;
 
 	if (chip_safety_check(flash, force, filename, read_it, write_it, erase_it, verify_it)) {
 		msg_cerr("Aborting.\n");
@@ -1854,7 +2835,10 @@ int doit(struct flashchip *flash, int force, char *filename, int read_it, int wr
 	 * before we can write.
 	 */
 
-	if (erase_it) {
+	/* With included romentries, erase only those, like a write of an
+	 * erased image. Otherwise erase the whole chip right away.
+	 */
+	if (erase_it && !find_next_included_range(0, size, &first, &last)) {
 		/* FIXME: Do we really want the scary warning if erase failed?
 		 * After all, after erase the chip is either blank or partially
 		 * blank or it has the old contents. A blank chip won't boot,
@@ -1862,9 +2846,11 @@ int doit(struct flashchip *flash, int force, char *filename, int read_it, int wr
 		 * knows very well that booting won't work.
 		 */
 		if (erase_and_write_flash(flash, oldcontents, newcontents)) {
-			emergency_help_message();
+			if (!dry_run)
+				emergency_help_message();
 			ret = 1;
 		}
+		session_forget_dirty();
 		goto out;
 	}
 
@@ -1885,11 +2871,51 @@ int doit(struct flashchip *flash, int force, char *filename, int read_it, int wr
 	 * The alternative would be to read only the regions which are to be
 	 * preserved, but in that case we might perform unneeded erase which
 	 * takes time as well.
+	 * A trusted reference image saves the full read. With included
+	 * romentries only those are read, plus the rest of their erase blocks
+	 * if the chip is going to be written.
 	 */
-	msg_cdbg("Reading old flash chip contents...\n");
-	if (flash->read(flash, oldcontents, 0, size)) {
-		ret = 1;
-		goto out;
+	if (reference_file && write_it &&
+	    !use_reference_image(flash, oldcontents)) {
+		msg_cinfo("Using the reference image as old flash chip "
+			  "contents.\n");
+		used_reference = 1;
+		/* Unsampled blocks of a stale reference may have been
+		 * skipped by the write, only a full verify finds them.
+		 * Do it even with -n. Only for this operation, later ones in
+		 * a batch keep their own setting.
+		 */
+		verify_written_only = 0;
+		if (!verify_it && !dry_run) {
+			msg_cinfo("Verifying anyway because of the reference "
+				  "image.\n");
+			verify_it = 1;
+		}
+	} else {
+		if (reference_file && write_it)
+			msg_cinfo("Reference image rejected, reading the "
+				  "chip.\n");
+		start = timer_usecs();
+		if (find_next_included_range(0, size, &first, &last)) {
+			msg_cdbg("Reading old flash chip contents of included "
+				 "regions...\n");
+			/* Verification alone needs no old contents, unless
+			 * it uses the session image.
+			 */
+			ret = read_included_regions(flash,
+					(write_it || erase_it ||
+					 session_image) ? oldcontents : NULL,
+					write_it || erase_it);
+		} else {
+			msg_cdbg("Reading old flash chip contents...\n");
+			ret = read_chip(flash, oldcontents, 0, size);
+		}
+		event_phase("read", timer_usecs() - start, known_size(size),
+			    ret);
+		if (ret) {
+			ret = 1;
+			goto out;
+		}
 	}
 
 	// This should be moved into each flash part's code to do it 
@@ -1898,12 +2924,18 @@ int doit(struct flashchip *flash, int force, char *filename, int read_it, int wr
 
 	// ////////////////////////////////////////////////////////////
 
-	if (write_it) {
-		if (erase_and_write_flash(flash, oldcontents, newcontents)) {
+	if (write_it || erase_it) {
+		ret = erase_and_write_flash(flash, oldcontents, newcontents);
+		/* A dry run only printed the plan. */
+		if (dry_run)
+			goto out;
+		session_forget_dirty();
+		if (ret) {
 			msg_cerr("Uh oh. Erase/write failed. Checking if "
 				 "anything changed.\n");
 			if (!flash->read(flash, newcontents, 0, size)) {
-				if (!memcmp(oldcontents, newcontents, size)) {
+				if (!compare_known_ranges(oldcontents,
+							  newcontents, size)) {
 					msg_cinfo("Good. It seems nothing was "
 						  "changed.\n");
 					nonfatal_help_message();
@@ -1921,18 +2953,150 @@ int doit(struct flashchip *flash, int force, char *filename, int read_it, int wr
 		/* Work around chips which need some time to calm down. */
 		if (write_it)
 			programmer_delay(1000*1000);
-		ret = verify_flash(flash, newcontents);
+		start = timer_usecs();
+		if (!write_it && session_image)
+			ret = verify_session(flash, newcontents);
+		else
+			ret = verify_flash(flash, newcontents);
+		event_phase("verify", timer_usecs() - start, verified_bytes,
+			    ret);
+		/* The reference image was stale in a block the spot check
+		 * missed. Write again based on the real chip contents.
+		 */
+		if (ret && write_it && used_reference) {
+			msg_cinfo("The reference image was stale. Reading the "
+				  "whole chip and writing again.\n");
+			if (!flash->read(flash, oldcontents, 0, size) &&
+			    !read_buf_from_file(newcontents, size, filename)) {
+				handle_romentries(flash, oldcontents,
+						  newcontents);
+				ret = erase_and_write_flash(flash, oldcontents,
+							    newcontents);
+				session_forget_dirty();
+				if (!ret)
+					ret = verify_flash(flash, newcontents);
+			}
+		}
 		/* If we tried to write, and verification now fails, we
 		 * might have an emergency situation.
 		 */
 		if (ret && write_it)
 			emergency_help_message();
+		if (!ret && write_it)
+			session_store_known(newcontents, size);
 	}
 
+	/* Without a full read, newcontents is not a complete image. */
+	if (!ret && write_it && cache_dir && !dry_run && !known_count)
+		store_cached_image(newcontents, size);
+
 out:
+	verify_written_only = saved_verify_written_only;
+	forget_known_ranges();
 	free(oldcontents);
 	free(newcontents);
 out_nofree:
+	return ret;
+}
+
+static void doit_shutdown(int ret)
+{
+	spi_print_wip_stats();
+	jedec_print_wait_stats();
+	event("done", "\"status\":%i", ret);
 	programmer_shutdown();
+}
+
+int doit(struct flashchip *flash, int force, char *filename, int read_it, int write_it, int erase_it, int verify_it)
+{
+	int ret;
+
+	ret = doit_operation(flash, force, filename, read_it, write_it,
+			     erase_it, verify_it);
+	doit_shutdown(ret);
+	return ret;
+}
+
+/* Run the operations listed in @batchfile, one per line:
+ *   read <file> [<image>...]
+ *   write <file> [<image>...]
+ *   verify <file> [<image>...]
+ *   erase [<image>...]
+ * The images are names from the layout file, without them all of its
+ * entries are used, or the whole chip if there is no layout file.
+ * Chip contents are read only once per session and shared between the
+ * operations. Execution stops at the first failing operation.
+ */
+int doit_batch(struct flashchip *flash, int force, char *batchfile,
+	       int verify_writes)
+{
+	static const char delim[] = " \t\r\n";
+	FILE *batch;
+	char line[256], *op, *filename, *image;
+	int lineno = 0, ret = 0;
+	int read_it, write_it, erase_it, verify_it;
+
+	batch = fopen(batchfile, "r");
+	if (!batch) {
+		perror(batchfile);
+		ret = 1;
+		goto out;
+	}
+	if (start_session(flash->total_size * 1024)) {
+		ret = 1;
+		goto out_close;
+	}
+	while (!ret && fgets(line, sizeof(line), batch)) {
+		lineno++;
+		op = strtok(line, delim);
+		if (!op || *op == '#')
+			continue;
+		read_it = !strcmp(op, "read");
+		write_it = !strcmp(op, "write");
+		verify_it = !strcmp(op, "verify");
+		erase_it = !strcmp(op, "erase");
+		if (!(read_it || write_it || verify_it || erase_it)) {
+			msg_gerr("%s:%i: Unknown operation \"%s\".\n",
+				 batchfile, lineno, op);
+			ret = 1;
+			break;
+		}
+		filename = NULL;
+		if (!erase_it) {
+			filename = strtok(NULL, delim);
+			if (!filename) {
+				msg_gerr("%s:%i: %s needs a file name.\n",
+					 batchfile, lineno, op);
+				ret = 1;
+				break;
+			}
+		}
+		image = strtok(NULL, delim);
+		set_romentries_included(!image);
+		for (; image; image = strtok(NULL, delim)) {
+			if (find_romentry(image) < 0) {
+				msg_gerr("%s:%i: Unknown image \"%s\", is "
+					 "the layout file missing?\n",
+					 batchfile, lineno, image);
+				ret = 1;
+				break;
+			}
+		}
+		if (ret)
+			break;
+		if (write_it && verify_writes && !dry_run)
+			verify_it = 1;
+		msg_ginfo("Batch line %i: %s%s%s\n", lineno, op,
+			  filename ? " " : "", filename ? filename : "");
+		event("batch", "\"line\":%i,\"op\":\"%s\"", lineno,
+		      event_str(op));
+		ret = doit_operation(flash, force, filename, read_it, write_it,
+				     erase_it, verify_it);
+	}
+	end_session();
+out_close:
+	fclose(batch);
+out:
+	doit_shutdown(ret);
 	return ret;
 }
@@ -146,15 +146,31 @@ static uint16_t REGREAD16(int X)
 	return mmio_readw((unsigned char *)ich_spibar + X);
 }
 
-#define REGWRITE32(X,Y) mmio_writel(Y, (unsigned char *)ich_spibar+X)
-#define REGWRITE16(X,Y) mmio_writew(Y, (unsigned char *)ich_spibar+X)
-#define REGWRITE8(X,Y)  mmio_writeb(Y, (unsigned char *)ich_spibar+X)
+/* Register writes of an emulated controller, see ich_init_emulated(). */
+static void (*ich_emu_write)(int reg, uint32_t val, int width) = NULL;
+
+static void REGWRITE32(int X, uint32_t Y)
+{
+	if (ich_emu_write)
+		ich_emu_write(X, Y, 4);
+	else
+		mmio_writel(Y, (unsigned char *)ich_spibar + X);
+}
+
+static void REGWRITE16(int X, uint16_t Y)
+{
+	if (ich_emu_write)
+		ich_emu_write(X, Y, 2);
+	else
+		mmio_writew(Y, (unsigned char *)ich_spibar + X);
+}
 
 /* Common SPI functions */
 static int find_opcode(OPCODES *op, uint8_t opcode);
 static int find_preop(OPCODES *op, uint8_t preop);
 static int generate_opcodes(OPCODES * op);
 static int program_opcodes(OPCODES * op);
+static int program_opcode_slot(OPCODES *op, int slot, int type_changed);
 static int run_opcode(OPCODE op, uint32_t offset,
 		      uint8_t datalength, uint8_t * data);
 
@@ -218,6 +234,66 @@ static OPCODE POSSIBLE_OPCODES[] = {
 
 static OPCODES O_EXISTING = {0};
 
+/* The opcode menu only has room for 8 opcodes, so other opcodes have to
+ * replace one of them on the fly. Every slot remembers when it was used last.
+ * The least recently used slot which doesn't hold one of the hot opcodes
+ * below is replaced, so opcodes in use stay in the menu for the session.
+ * Write enable is a prefix opcode and always stays.
+ */
+static const uint8_t hot_opcodes[] = {
+	JEDEC_READ,
+	JEDEC_BYTE_PROGRAM,
+	JEDEC_RDSR,
+};
+static unsigned long opcode_last_use[8];
+static unsigned long opcode_clock = 0;
+static unsigned long opcode_hits = 0;
+static unsigned long opcode_misses = 0;
+static unsigned long opcode_reprograms = 0;
+
+static int is_hot_opcode(uint8_t opcode)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hot_opcodes); i++)
+		if (hot_opcodes[i] == opcode)
+			return 1;
+	return 0;
+}
+
+static int find_victim_slot(OPCODES *op)
+{
+	int a, victim = -1;
+
+	for (a = 0; a < 8; a++) {
+		if (is_hot_opcode(op->opcode[a].opcode))
+			continue;
+		if (victim == -1 ||
+		    opcode_last_use[a] < opcode_last_use[victim])
+			victim = a;
+	}
+	return victim;
+}
+
+static void use_opcode_slot(int slot)
+{
+	opcode_last_use[slot] = ++opcode_clock;
+}
+
+void ich_print_opcode_stats(void)
+{
+	if (!opcode_hits && !opcode_misses)
+		return;
+	msg_pdbg("ICH opcode menu: %lu hits, %lu misses, %lu slots "
+		 "reprogrammed.\n", opcode_hits, opcode_misses,
+		 opcode_reprograms);
+}
+
+static void ich_opcode_stats_shutdown(void *data)
+{
+	ich_print_opcode_stats();
+}
+
 static uint8_t lookup_spi_type(uint8_t opcode)
 {
 	int a;
@@ -257,12 +333,21 @@ static int reprogram_opcode_on_the_fly(uint8_t opcode, unsigned int writecnt, un
 		// else we have an invalid case, will be handled below
 	}
 	if (spi_type <= 3) {
-		int oppos=2;	// use original JEDEC_BE_D8 offset
+		int oppos = find_victim_slot(curopcodes);
+		int type_changed;
+
+		if (oppos == -1)
+			return -1;
+		msg_pdbg("on-the-fly OPCODE (0x%02X) replaces 0x%02X, "
+			 "op-pos=%d\n", opcode,
+			 curopcodes->opcode[oppos].opcode, oppos);
+		type_changed = curopcodes->opcode[oppos].spi_type != spi_type;
 		curopcodes->opcode[oppos].opcode = opcode;
 		curopcodes->opcode[oppos].spi_type = spi_type;
-		program_opcodes(curopcodes);
-		oppos = find_opcode(curopcodes, opcode);
-		msg_pdbg ("on-the-fly OPCODE (0x%02X) re-programmed, op-pos=%d\n", opcode, oppos);
+		if (program_opcode_slot(curopcodes, oppos, type_changed))
+			return -1;
+		opcode_reprograms++;
+		use_opcode_slot(oppos);
 		return oppos;
 	}
 	return -1;
@@ -401,6 +486,42 @@ int program_opcodes(OPCODES * op)
 	return 0;
 }
 
+/* Write only the opcode menu half which holds @slot, and the opcode types if
+ * they changed.
+ */
+static int program_opcode_slot(OPCODES *op, int slot, int type_changed)
+{
+	uint8_t a, base = slot & ~3;
+	uint16_t optype = 0;
+	uint32_t opmenu = 0;
+
+	for (a = 0; a < 8; a++)
+		optype |= ((uint16_t) op->opcode[a].spi_type) << (a * 2);
+	for (a = 0; a < 4; a++)
+		opmenu |= ((uint32_t) op->opcode[base + a].opcode) << (a * 8);
+
+	msg_pspew("%s: optype=%04x opmenu[%i]=%08x\n", __func__, optype,
+		  base / 4, opmenu);
+	switch (spi_controller) {
+	case SPI_CONTROLLER_ICH7:
+	case SPI_CONTROLLER_VIA:
+		if (type_changed)
+			REGWRITE16(ICH7_REG_OPTYPE, optype);
+		REGWRITE32(ICH7_REG_OPMENU + base, opmenu);
+		break;
+	case SPI_CONTROLLER_ICH9:
+		if (type_changed)
+			REGWRITE16(ICH9_REG_OPTYPE, optype);
+		REGWRITE32(ICH9_REG_OPMENU + base, opmenu);
+		break;
+	default:
+		msg_perr("%s: unsupported chipset\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * Try to set BBAR (BIOS Base Address Register), but read back the value in case
  * it didn't stick.
@@ -412,25 +533,25 @@ void ich_set_bbar(uint32_t minaddr)
 	switch (spi_controller) {
 	case SPI_CONTROLLER_ICH7:
 	case SPI_CONTROLLER_VIA:
-		ichspi_bbar = mmio_readl((unsigned char *)ich_spibar + 0x50) & ~BBAR_MASK;
+		ichspi_bbar = REGREAD32(0x50) & ~BBAR_MASK;
 		if (ichspi_bbar)
 			msg_pdbg("Reserved bits in BBAR not zero: 0x%04x",
 				 ichspi_bbar);
 		ichspi_bbar |= minaddr;
-		mmio_writel(ichspi_bbar, (unsigned char *)ich_spibar + 0x50);
-		ichspi_bbar = mmio_readl((unsigned char *)ich_spibar + 0x50);
+		REGWRITE32(0x50, ichspi_bbar);
+		ichspi_bbar = REGREAD32(0x50);
 		/* We don't have any option except complaining. */
 		if (ichspi_bbar != minaddr)
 			msg_perr("Setting BBAR failed!\n");
 		break;
 	case SPI_CONTROLLER_ICH9:
-		ichspi_bbar = mmio_readl((unsigned char *)ich_spibar + 0xA0) & ~BBAR_MASK;
+		ichspi_bbar = REGREAD32(0xA0) & ~BBAR_MASK;
 		if (ichspi_bbar)
 			msg_pdbg("Reserved bits in BBAR not zero: 0x%04x",
 				 ichspi_bbar);
 		ichspi_bbar |= minaddr;
-		mmio_writel(ichspi_bbar, (unsigned char *)ich_spibar + 0xA0);
-		ichspi_bbar = mmio_readl((unsigned char *)ich_spibar + 0xA0);
+		REGWRITE32(0xA0, ichspi_bbar);
+		ichspi_bbar = REGREAD32(0xA0);
 		/* We don't have any option except complaining. */
 		if (ichspi_bbar != minaddr)
 			msg_perr("Setting BBAR failed!\n");
@@ -791,12 +912,16 @@ int ich_spi_send_command(unsigned int writecnt, unsigned int readcnt,
 	/* find cmd in opcodes-table */
 	opcode_index = find_opcode(curopcodes, cmd);
 	if (opcode_index == -1) {
+		opcode_misses++;
 		if (!ichspi_lock)
 			opcode_index = reprogram_opcode_on_the_fly(cmd, writecnt, readcnt);
 		if (opcode_index == -1) {
 			msg_pdbg("Invalid OPCODE 0x%02x\n", cmd);
 			return SPI_INVALID_OPCODE;
 		}
+	} else {
+		opcode_hits++;
+		use_opcode_slot(opcode_index);
 	}
 
 	opcode = &(curopcodes->opcode[opcode_index]);
@@ -934,6 +1059,8 @@ int ich_spi_send_multicommand(struct spi_command *cmds)
 		/* Reset the type of all opcodes to non-atomic. */
 		for (i = 0; i < 8; i++)
 			curopcodes->opcode[i].atomic = 0;
+		if (!ret && (cmds->flags & SPI_CMD_WAIT_WIP))
+			spi_poll_wip();
 	}
 	return ret;
 }
@@ -1123,9 +1250,28 @@ int ich_init_spi(struct pci_dev *dev, uint32_t base, void *rcrb,
 		msg_pdbg("invalid prefetching/caching settings, ");
 		break;
 	}
+	register_shutdown(ich_opcode_stats_shutdown, NULL);
 	return 0;
 }
 
+/*
+ * Drive a software model of the ICH7 or ICH9 SPI controller instead of real
+ * hardware. regs holds the register file, reads go straight to it and every
+ * write is handed to the write callback, which runs the SPI cycle when the
+ * cycle go bit is set. Used by the dummy programmer.
+ */
+int ich_init_emulated(void *regs, int ich_generation,
+		      void (*write)(int reg, uint32_t val, int width))
+{
+	ich_spibar = regs;
+	ich_emu_write = write;
+	ichspi_lock = 0;
+	curopcodes = NULL;
+	spi_controller = (ich_generation == 7) ? SPI_CONTROLLER_ICH7 :
+						 SPI_CONTROLLER_ICH9;
+	return ich_init_opcodes();
+}
+
 int via_init_spi(struct pci_dev *dev)
 {
 	uint32_t mmio_base;
@@ -1170,6 +1316,7 @@ int via_init_spi(struct pci_dev *dev)
 	}
 
 	ich_init_opcodes();
+	register_shutdown(ich_opcode_stats_shutdown, NULL);
 
 	return 0;
 }
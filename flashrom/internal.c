@@ -114,6 +114,9 @@ void probe_superio(void)
 
 int is_laptop = 0;
 
+/* Access size for reading the flash chip, see wide_chip_readn(). */
+static int internal_read_width = 4;
+
 int internal_init(void)
 {
 #if __FLASHROM_LITTLE_ENDIAN__
@@ -164,6 +167,19 @@ int internal_init(void)
 	}
 	free(arg);
 
+	arg = extract_programmer_param("readwidth");
+	if (arg) {
+		internal_read_width = atoi(arg);
+		if (internal_read_width != 1 && internal_read_width != 2 &&
+		    internal_read_width != 4 && internal_read_width != 8) {
+			msg_perr("Invalid readwidth %s, use 1, 2, 4 or 8.\n",
+				 arg);
+			free(arg);
+			return 1;
+		}
+	}
+	free(arg);
+
 	get_io_perms();
 
 	/* Initialize PCI access for flash enables */
@@ -304,6 +320,6 @@ uint32_t internal_chip_readl(const chipaddr addr)
 
 void internal_chip_readn(uint8_t *buf, const chipaddr addr, size_t len)
 {
-	memcpy(buf, (void *)addr, len);
+	wide_chip_readn(buf, addr, len, internal_read_width);
 	return;
 }
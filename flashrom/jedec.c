@@ -22,8 +22,10 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <string.h>
 #include "flash.h"
 #include "chipdrivers.h"
+#include "programmer.h"
 
 #define MAX_REFLASH_TRIES 0x10
 #define MASK_FULL 0xffff
@@ -38,58 +40,241 @@ uint8_t oddparity(uint8_t val)
 	return (val ^ (val >> 1)) & 0x1;
 }
 
-static void toggle_ready_jedec_common(chipaddr dst, int delay)
+/* Waiting for the end of an embedded program or erase operation.
+ * Every operation type remembers a log2 histogram of the latencies observed
+ * on the current chip. The first ready check is delayed by half the median
+ * of that histogram, after that the poll interval starts at 1/16 of the
+ * median and doubles until it reaches the per-operation maximum step.
+ * Operations which are still busy after the timeout are reported as failed
+ * instead of spinning forever.
+ *
+ * Some chips require a minimum delay between toggle bit reads during erase.
+ * The Winbond W39V040C wants 50 ms between reads on sector erase toggle,
+ * but experiments show that 2 ms are already enough. Pick a safety factor
+ * of 4 and use an 8 ms delay.
+ */
+#define JEDEC_WAIT_BUCKETS 28
+
+struct jedec_wait_stat {
+	const char *name;
+	/* Expected duration before anything was measured. */
+	unsigned long typical;
+	/* Lower and upper limit for the delay between two reads. */
+	unsigned long min_step;
+	unsigned long max_step;
+	/* Give up after this long. */
+	unsigned long timeout;
+	struct flashchip *flash;
+	/* Bytes handled by the last operation of this type. */
+	unsigned int size;
+	unsigned long count;
+	unsigned long polls;
+	unsigned long timeouts;
+	unsigned long min;
+	unsigned long max;
+	/* Bucket i counts latencies from 2^i to 2^(i+1)-1 us, the first one
+	 * also counts 0 us and the last one everything above.
+	 */
+	unsigned long hist[JEDEC_WAIT_BUCKETS];
+};
+
+/* Indexed by enum jedec_wait_op. */
+static struct jedec_wait_stat jedec_wait_stats[] = {
+	{"program",	20,		1,		1000,
+			100 * 1000},
+	{"sector erase",	25 * 1000,	8 * 1000,	100 * 1000,
+			10 * 1000 * 1000},
+	{"block erase",	25 * 1000,	8 * 1000,	100 * 1000,
+			10 * 1000 * 1000},
+	{"chip erase",	100 * 1000,	8 * 1000,	1000 * 1000,
+			300 * 1000 * 1000},
+};
+
+static int jedec_wait_bucket(unsigned long usecs)
 {
-	unsigned int i = 0;
-	uint8_t tmp1, tmp2;
+	int i = 0;
 
-	tmp1 = chip_readb(dst) & 0x40;
+	while ((usecs >>= 1) && i < JEDEC_WAIT_BUCKETS - 1)
+		i++;
+	return i;
+}
 
-	while (i++ < 0xFFFFFFF) {
-		if (delay)
-			programmer_delay(delay);
-		tmp2 = chip_readb(dst) & 0x40;
-		if (tmp1 == tmp2) {
+/* Middle of the histogram bucket which holds the median, within the range
+ * which was actually observed.
+ */
+static unsigned long jedec_wait_median(struct jedec_wait_stat *stat)
+{
+	unsigned long seen = 0, median;
+	int i;
+
+	for (i = 0; i < JEDEC_WAIT_BUCKETS - 1; i++) {
+		seen += stat->hist[i];
+		if (seen * 2 > stat->count)
 			break;
+	}
+	median = i ? 3UL << (i - 1) : 1;
+	if (median < stat->min)
+		median = stat->min;
+	if (median > stat->max)
+		median = stat->max;
+	return median;
+}
+
+static struct jedec_wait_stat *jedec_wait_stat(struct flashchip *flash,
+					       enum jedec_wait_op op)
+{
+	struct jedec_wait_stat *stat = &jedec_wait_stats[op];
+
+	/* Timings learned on one chip say nothing about another one. */
+	if (stat->flash != flash) {
+		stat->flash = flash;
+		stat->size = 0;
+		stat->count = 0;
+		stat->polls = 0;
+		stat->timeouts = 0;
+		stat->min = 0;
+		stat->max = 0;
+		memset(stat->hist, 0, sizeof(stat->hist));
+	}
+	return stat;
+}
+
+/* Check once whether the chip is ready. Toggle bit checks compare bit 6 with
+ * the previous read in @last, data polling waits until bit 7 matches @data.
+ */
+static int jedec_ready(chipaddr dst, int polling, uint8_t data, uint8_t *last)
+{
+	uint8_t tmp;
+
+	if (polling)
+		return (chip_readb(dst) & 0x80) == (data & 0x80);
+	tmp = chip_readb(dst) & 0x40;
+	if (tmp == *last)
+		return 1;
+	*last = tmp;
+	return 0;
+}
+
+static int wait_ready_jedec(struct flashchip *flash, chipaddr dst,
+			    enum jedec_wait_op op, unsigned int size,
+			    int polling, uint8_t data)
+{
+	struct jedec_wait_stat *stat = jedec_wait_stat(flash, op);
+	unsigned long start, elapsed, expected, interval, first;
+	uint8_t last = 0;
+	int i;
+
+	expected = stat->count ? jedec_wait_median(stat) : stat->typical;
+	interval = expected / 16;
+	if (interval < stat->min_step)
+		interval = stat->min_step;
+	if (interval > stat->max_step)
+		interval = stat->max_step;
+
+	start = timer_usecs();
+	if (!polling)
+		last = chip_readb(dst) & 0x40;
+	/* Keep the minimum gap between the first two toggle bit reads, too.
+	 * With history, skip the first half of the expected time.
+	 */
+	first = stat->count ? max(expected / 2, stat->min_step) : stat->min_step;
+	if (first)
+		programmer_delay(first);
+	while (1) {
+		stat->polls++;
+		if (jedec_ready(dst, polling, data, &last))
+			break;
+		elapsed = timer_usecs() - start;
+		if (elapsed > stat->timeout) {
+			/* Maybe we were descheduled for too long. */
+			stat->polls++;
+			if (jedec_ready(dst, polling, data, &last))
+				break;
+			stat->timeouts++;
+			msg_cerr("%s: %s timed out after %lu ms!\n", __func__,
+				 stat->name, elapsed / 1000);
+			return 1;
 		}
-		tmp1 = tmp2;
+		programmer_delay(interval);
+		interval = min(interval * 2, stat->max_step);
+		if (interval < stat->min_step)
+			interval = stat->min_step;
 	}
-	if (i > 0x100000)
-		msg_cdbg("%s: excessive loops, i=0x%x\n", __func__, i);
+	elapsed = timer_usecs() - start;
+	if (!stat->count || elapsed < stat->min)
+		stat->min = elapsed;
+	if (elapsed > stat->max)
+		stat->max = elapsed;
+	i = jedec_wait_bucket(elapsed);
+	stat->hist[i]++;
+	stat->count++;
+	stat->size = size;
+	return 0;
 }
 
-void toggle_ready_jedec(chipaddr dst)
+/* Wait until the toggle bit stops toggling. Returns 1 on timeout. */
+int toggle_ready_jedec(struct flashchip *flash, chipaddr dst,
+		       enum jedec_wait_op op, unsigned int size)
 {
-	toggle_ready_jedec_common(dst, 0);
+	return wait_ready_jedec(flash, dst, op, size, 0, 0);
 }
 
-/* Some chips require a minimum delay between toggle bit reads.
- * The Winbond W39V040C wants 50 ms between reads on sector erase toggle,
- * but experiments show that 2 ms are already enough. Pick a safety factor
- * of 4 and use an 8 ms delay.
- * Given that erase is slow on all chips, it is recommended to use 
- * toggle_ready_jedec_slow in erase functions.
+/* Wait until bit 7 at @dst matches @data. Returns 1 on timeout. */
+int data_polling_jedec(struct flashchip *flash, chipaddr dst, uint8_t data,
+		       enum jedec_wait_op op, unsigned int size)
+{
+	return wait_ready_jedec(flash, dst, op, size, 1, data);
+}
+
+/* Expected duration of erasing one @len byte block of @flash, or 0 if no
+ * erase of that size was measured yet.
  */
-static void toggle_ready_jedec_slow(chipaddr dst)
+unsigned long jedec_erase_estimate(struct flashchip *flash, unsigned int len)
 {
-	toggle_ready_jedec_common(dst, 8 * 1000);
+	struct jedec_wait_stat *stat;
+	int i;
+
+	for (i = JEDEC_WAIT_SECTOR_ERASE; i <= JEDEC_WAIT_CHIP_ERASE; i++) {
+		stat = &jedec_wait_stats[i];
+		if (stat->flash == flash && stat->count && stat->size == len)
+			return jedec_wait_median(stat);
+	}
+	return 0;
 }
 
-void data_polling_jedec(chipaddr dst, uint8_t data)
+/* Expected duration of programming @len bytes into @flash, or 0 if nothing
+ * was programmed yet.
+ */
+unsigned long jedec_write_estimate(struct flashchip *flash, unsigned int len)
 {
-	unsigned int i = 0;
-	uint8_t tmp;
+	struct jedec_wait_stat *stat = &jedec_wait_stats[JEDEC_WAIT_PROGRAM];
 
-	data &= 0x80;
+	if (stat->flash != flash || !stat->count || !stat->size)
+		return 0;
+	return jedec_wait_median(stat) * ((len + stat->size - 1) / stat->size);
+}
 
-	while (i++ < 0xFFFFFFF) {
-		tmp = chip_readb(dst) & 0x80;
-		if (tmp == data) {
-			break;
-		}
+void jedec_print_wait_stats(void)
+{
+	struct jedec_wait_stat *stat;
+	int i, j, header = 0;
+
+	for (i = 0; i < ARRAY_SIZE(jedec_wait_stats); i++) {
+		stat = &jedec_wait_stats[i];
+		if (!stat->count && !stat->timeouts)
+			continue;
+		if (!header++)
+			msg_cdbg("JEDEC operation timing for %s:\n",
+				 stat->flash->name);
+		msg_cdbg("  %s: %lu ops, min %lu us, median ~%lu us, "
+			 "max %lu us, %lu reads, %lu timeouts\n", stat->name,
+			 stat->count, stat->min, jedec_wait_median(stat),
+			 stat->max, stat->polls, stat->timeouts);
+		for (j = 0; j < JEDEC_WAIT_BUCKETS; j++)
+			if (stat->hist[j])
+				msg_cspew("    %8lu us: %lu\n",
+					  j ? 1UL << j : 0, stat->hist[j]);
 	}
-	if (i > 0x100000)
-		msg_cdbg("%s: excessive loops, i=0x%x\n", __func__, i);
 }
 
 static int getaddrmask(struct flashchip *flash)
@@ -119,28 +304,17 @@ static void start_program_jedec_common(struct flashchip *flash, unsigned int mas
 	chip_writeb(0xA0, bios + (0x5555 & mask));
 }
 
-static int probe_jedec_common(struct flashchip *flash, unsigned int mask)
+/* Read the product ID and the normal flash contents at the same location.
+ * @ids gets the manufacturer ID, model ID and the two matching content words.
+ */
+static void read_ids_jedec_common(struct flashchip *flash, unsigned int mask,
+				  int probe_timing_enter, int probe_timing_exit,
+				  uint32_t *ids)
 {
 	chipaddr bios = flash->virtual_memory;
 	uint8_t id1, id2;
 	uint32_t largeid1, largeid2;
 	uint32_t flashcontent1, flashcontent2;
-	int probe_timing_enter, probe_timing_exit;
-
-	if (flash->probe_timing > 0) 
-		probe_timing_enter = probe_timing_exit = flash->probe_timing;
-	else if (flash->probe_timing == TIMING_ZERO) { /* No delay. */
-		probe_timing_enter = probe_timing_exit = 0;
-	} else if (flash->probe_timing == TIMING_FIXME) { /* == _IGNORED */
-		msg_cdbg("Chip lacks correct probe timing information, "
-			     "using default 10mS/40uS. ");
-		probe_timing_enter = 10000;
-		probe_timing_exit = 40;
-	} else {
-		msg_cerr("Chip has negative value in probe_timing, failing "
-		       "without chip access\n");
-		return 0;
-	}
 
 	/* Earlier probes might have been too fast for the chip to enter ID
 	 * mode completely. Allow the chip to finish this before seeing a
@@ -205,10 +379,6 @@ static int probe_jedec_common(struct flashchip *flash, unsigned int mask)
 	if (probe_timing_exit)
 		programmer_delay(probe_timing_exit);
 
-	msg_cdbg("%s: id1 0x%02x, id2 0x%02x", __func__, largeid1, largeid2);
-	if (!oddparity(id1))
-		msg_cdbg(", id1 parity violation");
-
 	/* Read the product ID location again. We should now see normal flash contents. */
 	flashcontent1 = chip_readb(bios);
 	flashcontent2 = chip_readb(bios + 0x01);
@@ -223,13 +393,57 @@ static int probe_jedec_common(struct flashchip *flash, unsigned int mask)
 		flashcontent2 |= chip_readb(bios + 0x101);
 	}
 
-	if (largeid1 == flashcontent1)
+	ids[0] = largeid1;
+	ids[1] = largeid2;
+	ids[2] = flashcontent1;
+	ids[3] = flashcontent2;
+}
+
+static int probe_jedec_common(struct flashchip *flash, unsigned int mask)
+{
+	uint32_t ids[4];
+	uint32_t cache_key;
+	int probe_timing_enter, probe_timing_exit;
+
+	if (flash->probe_timing > 0) 
+		probe_timing_enter = probe_timing_exit = flash->probe_timing;
+	else if (flash->probe_timing == TIMING_ZERO) { /* No delay. */
+		probe_timing_enter = probe_timing_exit = 0;
+	} else if (flash->probe_timing == TIMING_FIXME) { /* == _IGNORED */
+		msg_cdbg("Chip lacks correct probe timing information, "
+			     "using default 10mS/40uS. ");
+		probe_timing_enter = 10000;
+		probe_timing_exit = 40;
+	} else {
+		msg_cerr("Chip has negative value in probe_timing, failing "
+		       "without chip access\n");
+		return 0;
+	}
+
+	/* The answer depends on the mapped size, the command addresses, the
+	 * reset sequence and the timing.
+	 */
+	cache_key = (flash->total_size << 8) |
+		    (flash->feature_bits & (FEATURE_ADDR_MASK | FEATURE_RESET_MASK));
+	if (!probe_cache_get(PROBE_JEDEC, cache_key, flash->probe_timing, ids,
+			     sizeof(ids))) {
+		read_ids_jedec_common(flash, mask, probe_timing_enter,
+				      probe_timing_exit, ids);
+		probe_cache_put(PROBE_JEDEC, cache_key, flash->probe_timing,
+				ids, sizeof(ids));
+	}
+
+	msg_cdbg("%s: id1 0x%02x, id2 0x%02x", __func__, ids[0], ids[1]);
+	if (!oddparity(ids[0] & 0xff))
+		msg_cdbg(", id1 parity violation");
+
+	if (ids[0] == ids[2])
 		msg_cdbg(", id1 is normal flash content");
-	if (largeid2 == flashcontent2)
+	if (ids[1] == ids[3])
 		msg_cdbg(", id2 is normal flash content");
 
 	msg_cdbg("\n");
-	if (largeid1 != flash->manufacture_id || largeid2 != flash->model_id)
+	if (ids[0] != flash->manufacture_id || ids[1] != flash->model_id)
 		return 0;
 
 	if (flash->feature_bits & FEATURE_REGISTERMAP)
@@ -259,7 +473,8 @@ static int erase_sector_jedec_common(struct flashchip *flash, unsigned int page,
 	programmer_delay(10);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec_slow(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_SECTOR_ERASE, pagesize))
+		return -1;
 
 	if (check_erased_range(flash, page, pagesize)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -289,7 +504,8 @@ static int erase_block_jedec_common(struct flashchip *flash, unsigned int block,
 	programmer_delay(10);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec_slow(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_BLOCK_ERASE, blocksize))
+		return -1;
 
 	if (check_erased_range(flash, block, blocksize)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -318,7 +534,8 @@ static int erase_chip_jedec_common(struct flashchip *flash, unsigned int mask)
 	chip_writeb(0x10, bios + (0x5555 & mask));
 	programmer_delay(10);
 
-	toggle_ready_jedec_slow(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_CHIP_ERASE, total_size))
+		return -1;
 
 	if (check_erased_range(flash, 0, total_size)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -344,7 +561,9 @@ retry:
 
 	/* transfer data from source to destination */
 	chip_writeb(*src, dst);
-	toggle_ready_jedec(bios);
+	/* A chip which is still busy won't take a retry either. */
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_PROGRAM, 1))
+		return -1;
 
 	if (chip_readb(dst) != *src && tried++ < MAX_REFLASH_TRIES) {
 		goto retry;
@@ -359,7 +578,7 @@ retry:
 /* chunksize is 1 */
 int write_jedec_1(struct flashchip *flash, uint8_t *src, int start, int len)
 {
-	int i, failed = 0;
+	int i, ret, failed = 0;
 	chipaddr dst = flash->virtual_memory + start;
 	chipaddr olddst;
 	int mask;
@@ -368,8 +587,12 @@ int write_jedec_1(struct flashchip *flash, uint8_t *src, int start, int len)
 
 	olddst = dst;
 	for (i = 0; i < len; i++) {
-		if (write_byte_program_jedec_common(flash, src, dst, mask))
+		ret = write_byte_program_jedec_common(flash, src, dst, mask);
+		if (ret)
 			failed = 1;
+		/* Don't wait for a timeout on every remaining byte. */
+		if (ret < 0)
+			break;
 		dst++, src++;
 	}
 	if (failed)
@@ -402,7 +625,10 @@ retry:
 		src++;
 	}
 
-	toggle_ready_jedec(dst - 1);
+	if (toggle_ready_jedec(flash, dst - 1, JEDEC_WAIT_PROGRAM, page_size)) {
+		msg_cerr(" page 0x%lx failed!\n", (d - bios) / page_size);
+		return 1;
+	}
 
 	dst = d;
 	src = s;
@@ -214,6 +214,14 @@ int find_romentry(char *name)
 	return -1;
 }
 
+void set_romentries_included(int included)
+{
+	int i;
+
+	for (i = 0; i < romimages; i++)
+		rom_entries[i].included = included;
+}
+
 int find_next_included_romentry(unsigned int start)
 {
 	int i;
@@ -239,6 +247,36 @@ int find_next_included_romentry(unsigned int start)
 	return best_entry;
 }
 
+/* Find the first area at or after @start which is covered by included
+ * romentries. Overlapping and adjacent romentries are merged into one area,
+ * which is clipped to the chip size @size.
+ * Returns 1 and fills in @first and @last if such an area exists, 0 otherwise.
+ */
+int find_next_included_range(unsigned int start, unsigned int size,
+			     unsigned int *first, unsigned int *last)
+{
+	int entry;
+	unsigned int end;
+
+	if (start >= size)
+		return 0;
+	entry = find_next_included_romentry(start);
+	if (entry < 0 || rom_entries[entry].start >= size)
+		return 0;
+	*first = (rom_entries[entry].start > start) ?
+		 rom_entries[entry].start : start;
+	end = rom_entries[entry].end;
+	while (end < size - 1) {
+		entry = find_next_included_romentry(end + 1);
+		/* Only merge entries which contain the byte after the area. */
+		if (entry < 0 || rom_entries[entry].start > end + 1)
+			break;
+		end = rom_entries[entry].end;
+	}
+	*last = (end < size - 1) ? end : size - 1;
+	return 1;
+}
+
 int handle_romentries(struct flashchip *flash, uint8_t *oldcontents, uint8_t *newcontents)
 {
 	unsigned int start = 0;
@@ -41,7 +41,8 @@ int write_m29f400bt(struct flashchip *flash, uint8_t *src, int start, int len)
 
 		/* transfer data from source to destination */
 		chip_writeb(*src, dst);
-		toggle_ready_jedec(dst);
+		if (toggle_ready_jedec(flash, dst, JEDEC_WAIT_PROGRAM, 1))
+			return 1;
 #if 0
 		/* We only want to print something in the error case. */
 		msg_cerr("Value in the flash at address 0x%lx = %#x, want %#x\n",
@@ -51,7 +52,7 @@ int write_m29f400bt(struct flashchip *flash, uint8_t *src, int start, int len)
 		src++;
 	}
 
-	/* FIXME: Ignore errors for now. */
+	/* FIXME: Ignore verification errors for now. */
 	return 0;
 }
 
@@ -99,7 +100,9 @@ int erase_m29f400bt(struct flashchip *flash)
 	chip_writeb(0x10, bios + 0xAAA);
 
 	programmer_delay(10);
-	toggle_ready_jedec(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_CHIP_ERASE,
+			       flash->total_size * 1024))
+		return -1;
 
 	if (check_erased_range(flash, 0, flash->total_size * 1024)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -122,7 +125,8 @@ int block_erase_m29f400bt(struct flashchip *flash, unsigned int start, unsigned
 	chip_writeb(0x30, dst);
 
 	programmer_delay(10);
-	toggle_ready_jedec(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_BLOCK_ERASE, len))
+		return -1;
 
 	if (check_erased_range(flash, start, len)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -0,0 +1,291 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * Copyright (C) 2009,2010 Carl-Daniel Hailfinger
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Comparison of old and new flash contents. The scans below look at 16 bytes
+ * at a time with SSE2 where the compiler offers it, at a machine word at a
+ * time otherwise, and only fall back to single bytes at the edges.
+ */
+
+#include <string.h>
+#include "flash.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define VEC_SIZE 16
+#endif
+
+typedef unsigned long word_t;
+#define WORD_SIZE	sizeof(word_t)
+#define WORD_ONES	(~(word_t)0)
+/* 0x0101...01 and 0x8080...80 for any word size. */
+#define WORD_LOW	(WORD_ONES / 0xff)
+#define WORD_HIGH	(WORD_LOW * 0x80)
+
+static word_t load_word(const uint8_t *p)
+{
+	word_t w;
+
+	memcpy(&w, p, WORD_SIZE);
+	return w;
+}
+
+/* Sets the high bit of every nonzero byte in @x and clears all other bits. */
+static word_t nonzero_bytes(word_t x)
+{
+	return (((x & ~WORD_HIGH) + ~WORD_HIGH) | x) & WORD_HIGH;
+}
+
+/* Offset of the first byte where @a and @b differ, @len if there is none. */
+static int first_diff(const uint8_t *a, const uint8_t *b, int len)
+{
+	int i = 0;
+
+#ifdef VEC_SIZE
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (eq != 0xffff)
+			return i + __builtin_ctz(~eq);
+	}
+#endif
+	for (; i + WORD_SIZE <= len; i += WORD_SIZE)
+		if (load_word(a + i) != load_word(b + i))
+			break;
+	for (; i < len; i++)
+		if (a[i] != b[i])
+			break;
+	return i;
+}
+
+/* Offset of the first byte where @a and @b are equal, @len if there is none. */
+static int first_same(const uint8_t *a, const uint8_t *b, int len)
+{
+	int i = 0;
+
+#ifdef VEC_SIZE
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (eq)
+			return i + __builtin_ctz(eq);
+	}
+#endif
+	for (; i + WORD_SIZE <= len; i += WORD_SIZE)
+		if (nonzero_bytes(load_word(a + i) ^ load_word(b + i)) !=
+		    WORD_HIGH)
+			break;
+	for (; i < len; i++)
+		if (a[i] == b[i])
+			break;
+	return i;
+}
+
+/* Is any bit set in @want which is cleared in @have? */
+static int need_erase_1bit(const uint8_t *have, const uint8_t *want, int len)
+{
+	int i = 0;
+
+#ifdef VEC_SIZE
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+		__m128i h = _mm_loadu_si128((const __m128i *)(have + i));
+		__m128i w = _mm_loadu_si128((const __m128i *)(want + i));
+		__m128i set = _mm_andnot_si128(h, w);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(set,
+				      _mm_setzero_si128())) != 0xffff)
+			return 1;
+	}
+#endif
+	for (; i + WORD_SIZE <= len; i += WORD_SIZE)
+		if (~load_word(have + i) & load_word(want + i))
+			return 1;
+	for (; i < len; i++)
+		if ((have[i] & want[i]) != want[i])
+			return 1;
+	return 0;
+}
+
+/* Is any byte different in @have and @want without being erased in @have? */
+static int need_erase_1byte(const uint8_t *have, const uint8_t *want, int len)
+{
+	int i = 0;
+
+#ifdef VEC_SIZE
+	__m128i ones = _mm_set1_epi8((char)0xff);
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+		__m128i h = _mm_loadu_si128((const __m128i *)(have + i));
+		__m128i w = _mm_loadu_si128((const __m128i *)(want + i));
+		int ok = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(h, w),
+						_mm_cmpeq_epi8(h, ones)));
+		if (ok != 0xffff)
+			return 1;
+	}
+#endif
+	for (; i + WORD_SIZE <= len; i += WORD_SIZE) {
+		word_t h = load_word(have + i);
+		word_t w = load_word(want + i);
+		if (nonzero_bytes(h ^ w) & nonzero_bytes(~h))
+			return 1;
+	}
+	for (; i < len; i++)
+		if ((have[i] != want[i]) && (have[i] != 0xff))
+			return 1;
+	return 0;
+}
+
+/* Are all bytes in @have erased? */
+static int all_erased(const uint8_t *have, int len)
+{
+	int i = 0;
+
+#ifdef VEC_SIZE
+	__m128i ones = _mm_set1_epi8((char)0xff);
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+		__m128i h = _mm_loadu_si128((const __m128i *)(have + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(h, ones)) != 0xffff)
+			return 0;
+	}
+#endif
+	for (; i + WORD_SIZE <= len; i += WORD_SIZE)
+		if (load_word(have + i) != WORD_ONES)
+			return 0;
+	for (; i < len; i++)
+		if (have[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+/*
+ * Check if the buffer @have can be programmed to the content of @want without
+ * erasing. This is only possible if all chunks of size @gran are either kept
+ * as-is or changed from an all-ones state to any other state.
+ *
+ * The following write granularities (enum @gran) are known:
+ * - 1 bit. Each bit can be cleared individually.
+ * - 1 byte. A byte can be written once. Further writes to an already written
+ *   byte cause the contents to be either undefined or to stay unchanged.
+ * - 128 bytes. If less than 128 bytes are written, the rest will be
+ *   erased. Each write to a 128-byte region will trigger an automatic erase
+ *   before anything is written. Very uncommon behaviour and unsupported by
+ *   this function.
+ * - 256 bytes. If less than 256 bytes are written, the contents of the
+ *   unwritten bytes are undefined.
+ * Warning: This function assumes that @have and @want point to naturally
+ * aligned regions.
+ *
+ * @have        buffer with current content
+ * @want        buffer with desired content
+ * @len		length of the checked area
+ * @gran	write granularity (enum, not count)
+ * @return      0 if no erase is needed, 1 otherwise
+ */
+int need_erase(uint8_t *have, uint8_t *want, int len, enum write_granularity gran)
+{
+	int j;
+
+	switch (gran) {
+	case write_gran_1bit:
+		return need_erase_1bit(have, want, len);
+	case write_gran_1byte:
+		return need_erase_1byte(have, want, len);
+	case write_gran_256bytes:
+		for (j = 0; j < len / 256; j++) {
+			/* Are 'have' and 'want' identical? */
+			if (!memcmp(have + j * 256, want + j * 256, 256))
+				continue;
+			/* have needs to be in erased state. */
+			if (!all_erased(have + j * 256, 256))
+				return 1;
+		}
+		break;
+	default:
+		msg_cerr("%s: Unsupported granularity! Please report a bug at "
+			 "flashrom@flashrom.org\n", __func__);
+	}
+	return 0;
+}
+
+/**
+ * Check if the buffer @have needs to be programmed to get the content of @want.
+ * If yes, return 1 and fill in first_start with the start address of the
+ * write operation and first_len with the length of the first to-be-written
+ * chunk. If not, return 0 and leave first_start and first_len undefined.
+ *
+ * Warning: This function assumes that @have and @want point to naturally
+ * aligned regions.
+ *
+ * @have	buffer with current content
+ * @want	buffer with desired content
+ * @len		length of the checked area
+ * @gran	write granularity (enum, not count)
+ * @first_start	offset of the first byte which needs to be written (passed in
+ *		value is increased by the offset of the first needed write
+ *		relative to have/want or unchanged if no write is needed)
+ * @return	length of the first contiguous area which needs to be written
+ *		0 if no write is needed
+ *
+ * FIXME: This function needs a parameter which tells it about coalescing
+ * in relation to the max write length of the programmer and the max write
+ * length of the chip.
+ */
+int get_next_write(uint8_t *have, uint8_t *want, int len,
+		   int *first_start, enum write_granularity gran)
+{
+	int rel_start, rel_end, stride;
+
+	switch (gran) {
+	case write_gran_1bit:
+	case write_gran_1byte:
+		stride = 1;
+		break;
+	case write_gran_256bytes:
+		stride = 256;
+		break;
+	default:
+		msg_cerr("%s: Unsupported granularity! Please report a bug at "
+			 "flashrom@flashrom.org\n", __func__);
+		/* Claim that no write was needed. A write with unknown
+		 * granularity is too dangerous to try.
+		 */
+		return 0;
+	}
+	/* Only whole strides are considered. */
+	len -= len % stride;
+
+	rel_start = first_diff(have, want, len);
+	if (rel_start == len)
+		return 0;
+	rel_start -= rel_start % stride;
+	if (stride == 1) {
+		rel_end = rel_start + first_same(have + rel_start,
+						 want + rel_start,
+						 len - rel_start);
+	} else {
+		/* The write ends at the first stride which is identical. */
+		for (rel_end = rel_start + stride; rel_end < len;
+		     rel_end += stride)
+			if (!memcmp(have + rel_end, want + rel_end, stride))
+				break;
+	}
+	*first_start += rel_start;
+	return rel_end - rel_start;
+}
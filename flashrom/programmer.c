@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <string.h>
 #include "flash.h"
 
 /* No-op shutdown() for programmers which don't need special handling */
@@ -96,3 +97,42 @@ void fallback_chip_readn(uint8_t *buf, chipaddr addr, size_t len)
 		buf[i] = chip_readb(addr + i);
 	return;
 }
+
+/* Read directly mapped flash with aligned loads of @width bytes (1, 2, 4 or
+ * 8), only the unaligned head and tail are read bytewise. LPC and FWH bridges
+ * turn a wide load into a multi-byte firmware read cycle, and unlike memcpy()
+ * this guarantees the access size on uncached mappings.
+ */
+void wide_chip_readn(uint8_t *buf, chipaddr addr, size_t len, int width)
+{
+	uint16_t val16;
+	uint32_t val32;
+	uint64_t val64;
+
+	while (len && (addr & (width - 1))) {
+		*buf++ = *(volatile uint8_t *)addr++;
+		len--;
+	}
+	switch (width) {
+	case 8:
+		for (; len >= 8; len -= 8, addr += 8, buf += 8) {
+			val64 = *(volatile uint64_t *)addr;
+			memcpy(buf, &val64, 8);
+		}
+		break;
+	case 4:
+		for (; len >= 4; len -= 4, addr += 4, buf += 4) {
+			val32 = *(volatile uint32_t *)addr;
+			memcpy(buf, &val32, 4);
+		}
+		break;
+	case 2:
+		for (; len >= 2; len -= 2, addr += 2, buf += 2) {
+			val16 = *(volatile uint16_t *)addr;
+			memcpy(buf, &val16, 2);
+		}
+		break;
+	}
+	while (len--)
+		*buf++ = *(volatile uint8_t *)addr++;
+}
@@ -202,6 +202,7 @@ extern const struct board_info laptops_known[];
 /* udelay.c */
 void myusec_delay(int usecs);
 void myusec_calibrate_delay(void);
+unsigned long timer_usecs(void);
 void internal_delay(int usecs);
 
 #if NEED_PCI == 1
@@ -330,6 +331,7 @@ void fallback_chip_writen(uint8_t *buf, chipaddr addr, size_t len);
 uint16_t fallback_chip_readw(const chipaddr addr);
 uint32_t fallback_chip_readl(const chipaddr addr);
 void fallback_chip_readn(uint8_t *buf, const chipaddr addr, size_t len);
+void wide_chip_readn(uint8_t *buf, chipaddr addr, size_t len, int width);
 
 /* dummyflasher.c */
 #if CONFIG_DUMMY == 1
@@ -550,6 +552,12 @@ struct spi_programmer {
 	/* Optimized functions for this programmer */
 	int (*read)(struct flashchip *flash, uint8_t *buf, int start, int len);
 	int (*write_256)(struct flashchip *flash, uint8_t *buf, int start, int len);
+
+	/* Number of page program sequences (WREN, PP, status wait) the
+	 * multicommand function accepts in one call. 0 means the programmer
+	 * does not handle SPI_CMD_WAIT_WIP itself.
+	 */
+	int max_batch;
 };
 
 extern enum spi_controller spi_controller;
@@ -557,18 +565,22 @@ extern const struct spi_programmer spi_programmer[];
 int default_spi_send_command(unsigned int writecnt, unsigned int readcnt,
 			     const unsigned char *writearr, unsigned char *readarr);
 int default_spi_send_multicommand(struct spi_command *cmds);
+void spi_poll_wip(void);
 
 /* ichspi.c */
 #if CONFIG_INTERNAL == 1
 extern uint32_t ichspi_bbar;
 int ich_init_spi(struct pci_dev *dev, uint32_t base, void *rcrb,
 		    int ich_generation);
+int ich_init_emulated(void *regs, int ich_generation,
+		      void (*write)(int reg, uint32_t val, int width));
 int via_init_spi(struct pci_dev *dev);
 int ich_spi_send_command(unsigned int writecnt, unsigned int readcnt,
 		    const unsigned char *writearr, unsigned char *readarr);
 int ich_spi_read(struct flashchip *flash, uint8_t *buf, int start, int len);
 int ich_spi_write_256(struct flashchip *flash, uint8_t * buf, int start, int len);
 int ich_spi_send_multicommand(struct spi_command *cmds);
+void ich_print_opcode_stats(void);
 #endif
 
 /* it87spi.c */
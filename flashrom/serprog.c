@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <termios.h>
+#include <sys/wait.h>
 #include "flash.h"
 #include "programmer.h"
 
@@ -86,6 +87,26 @@ static uint32_t sp_write_n_bytes = 0;
 static int sp_streamed_transmit_ops = 0;
 static int sp_streamed_transmit_bytes = 0;
 
+/* Streamed commands whose reply has not been read yet, oldest first
+	starting at sp_stream_tail. Replies come back in command order. */
+#define SP_STREAM_MAX_OPS 256
+struct sp_stream_op {
+	/* Bytes the command occupies in the device serial buffer */
+	uint32_t cmdlen;
+	/* Bytes returned after the ACK and where to put them */
+	uint32_t retlen;
+	uint8_t *retbuf;
+};
+static struct sp_stream_op sp_stream_ops[SP_STREAM_MAX_OPS];
+static int sp_stream_tail = 0;
+/* Maximum number of streamed commands in flight */
+static int sp_window = 8;
+
+/* pid of the loopback emulator, 0 if none is running */
+static pid_t sp_loopback_pid = 0;
+/* buses of the dummy programmer behind the loopback emulator */
+static enum chipbustype sp_loopback_buses = CHIP_BUSTYPE_NONSPI;
+
 /* sp_opbuf_usage used for counting the amount of
 	on-device operation buffer used */
 static int sp_opbuf_usage = 0;
@@ -255,28 +276,72 @@ static int sp_docommand(uint8_t command, uint32_t parmlen,
 	return 0;
 }
 
+/* Read the reply of the oldest streamed command. Once it is ACKed the
+	command no longer occupies the device serial buffer.		*/
+static void sp_stream_read_reply(void)
+{
+	struct sp_stream_op *op = &sp_stream_ops[sp_stream_tail];
+	uint32_t rd_bytes = 0;
+	unsigned char c;
+
+	if (read(sp_fd, &c, 1) != 1)
+		sp_die("Error: cannot read from device (flushing stream)");
+	if (c == S_NAK) {
+		msg_perr("Error: NAK to a stream buffer operation\n");
+		exit(1);
+	}
+	if (c != S_ACK) {
+		msg_perr("Error: Invalid reply 0x%02X from device\n", c);
+		exit(1);
+	}
+	while (rd_bytes < op->retlen) {
+		int r = read(sp_fd, op->retbuf + rd_bytes,
+			     op->retlen - rd_bytes);
+		if (r <= 0)
+			sp_die("Error: cannot read stream return data");
+		rd_bytes += r;
+	}
+	sp_stream_tail = (sp_stream_tail + 1) % SP_STREAM_MAX_OPS;
+	sp_streamed_transmit_ops--;
+	sp_streamed_transmit_bytes -= op->cmdlen;
+}
+
 static void sp_flush_stream(void)
 {
-	if (sp_streamed_transmit_ops)
-		do {
-			unsigned char c;
-			if (read(sp_fd, &c, 1) != 1) {
-				sp_die("Error: cannot read from device (flushing stream)");
-			}
-			if (c == S_NAK) {
-				msg_perr("Error: NAK to a stream buffer operation\n");
-				exit(1);
-			}
-			if (c != S_ACK) {
-				msg_perr("Error: Invalid reply 0x%02X from device\n", c);
-				exit(1);
-			}
-		} while (--sp_streamed_transmit_ops);
-	sp_streamed_transmit_ops = 0;
+	while (sp_streamed_transmit_ops)
+		sp_stream_read_reply();
 	sp_streamed_transmit_bytes = 0;
 }
 
-static int sp_stream_buffer_op(uint8_t cmd, uint32_t parmlen, uint8_t * parms)
+/* Collect replies until a command of cmdlen bytes fits into the window	*
+ * and into the serial buffer of the device. A command larger than the	*
+ * serial buffer is only sent after everything before it was ACKed.	*/
+static void sp_stream_reserve(uint32_t cmdlen)
+{
+	while (sp_streamed_transmit_ops &&
+	       ((sp_streamed_transmit_ops >= sp_window) ||
+		(sp_streamed_transmit_bytes + cmdlen > sp_device_serbuf_size)))
+		sp_stream_read_reply();
+}
+
+static void sp_stream_push(uint32_t cmdlen, uint32_t retlen, uint8_t *retbuf)
+{
+	struct sp_stream_op *op;
+
+	op = &sp_stream_ops[(sp_stream_tail + sp_streamed_transmit_ops) %
+			    SP_STREAM_MAX_OPS];
+	op->cmdlen = cmdlen;
+	op->retlen = retlen;
+	op->retbuf = retbuf;
+	sp_streamed_transmit_ops += 1;
+	sp_streamed_transmit_bytes += cmdlen;
+}
+
+/* Send a command without waiting for its reply. The retlen bytes	*
+ * returned by the device land in retbuf once the reply is read, which	*
+ * happens at the latest in sp_flush_stream().				*/
+static int sp_stream_buffer_op(uint8_t cmd, uint32_t parmlen, uint8_t * parms,
+			       uint32_t retlen, uint8_t *retbuf)
 {
 	uint8_t *sp;
 	if (sp_automatic_cmdcheck(cmd))
@@ -285,16 +350,212 @@ static int sp_stream_buffer_op(uint8_t cmd, uint32_t parmlen, uint8_t * parms)
 	if (!sp) sp_die("Error: cannot malloc command buffer");
 	sp[0] = cmd;
 	memcpy(&(sp[1]), parms, parmlen);
-	if (sp_streamed_transmit_bytes >= (1 + parmlen + sp_device_serbuf_size))
-		sp_flush_stream();
+	sp_stream_reserve(1 + parmlen);
 	if (write(sp_fd, sp, 1 + parmlen) != (1 + parmlen))
 		sp_die("Error: cannot write command");
 	free(sp);
-	sp_streamed_transmit_ops += 1;
-	sp_streamed_transmit_bytes += 1 + parmlen;
+	sp_stream_push(1 + parmlen, retlen, retbuf);
 	return 0;
 }
 
+#if CONFIG_DUMMY == 1
+/* Loopback emulator: serprog:loopback=dummy forks a child process which	*
+ * speaks the device side of the protocol on one end of a socket pair and	*
+ * hands all flash accesses to the dummy programmer. Its parameters, e.g.	*
+ * emulate=<chip> and image=<file>, select the chip behind the emulator.	*
+ * Operation buffer commands are executed right away instead of at O_EXEC	*
+ * time.								*/
+#define SP_LOOPBACK_SERBUF	256
+#define SP_LOOPBACK_OPBUF	4096
+#define SP_LOOPBACK_WRNMAXLEN	256
+#define SP_LOOPBACK_RDNMAXLEN	4096
+
+static void sp_loopback_read(int fd, uint8_t *buf, uint32_t len)
+{
+	ssize_t r;
+	while (len) {
+		r = read(fd, buf, len);
+		/* The other end closed the connection, we're done. */
+		if (r <= 0) {
+			dummy_shutdown();
+			fflush(NULL);
+			_exit(0);
+		}
+		buf += r;
+		len -= r;
+	}
+}
+
+static void sp_loopback_write(int fd, const uint8_t *buf, uint32_t len)
+{
+	ssize_t r;
+	while (len) {
+		r = write(fd, buf, len);
+		if (r <= 0)
+			_exit(1);
+		buf += r;
+		len -= r;
+	}
+}
+
+static void sp_loopback_ack(int fd, const uint8_t *ret, uint32_t retlen)
+{
+	uint8_t c = S_ACK;
+	sp_loopback_write(fd, &c, 1);
+	if (retlen)
+		sp_loopback_write(fd, ret, retlen);
+}
+
+static void __attribute__((noreturn)) sp_loopback_serve(int fd)
+{
+	uint8_t buf[SP_LOOPBACK_RDNMAXLEN];
+	uint8_t parm[6];
+	uint8_t cmd;
+	uint32_t addr, len, n;
+	int i;
+
+	for (;;) {
+		sp_loopback_read(fd, &cmd, 1);
+		switch (cmd) {
+		case S_CMD_NOP:
+		case S_CMD_O_INIT:
+		case S_CMD_O_EXEC:
+			sp_loopback_ack(fd, NULL, 0);
+			break;
+		case S_CMD_Q_IFACE:
+			buf[0] = 1;
+			buf[1] = 0;
+			sp_loopback_ack(fd, buf, 2);
+			break;
+		case S_CMD_Q_CMDMAP:
+			memset(buf, 0, 32);
+			for (i = S_CMD_NOP; i <= S_CMD_S_BUSTYPE; i++)
+				buf[i / 8] |= 1 << (i % 8);
+			sp_loopback_ack(fd, buf, 32);
+			break;
+		case S_CMD_Q_PGMNAME:
+			memset(buf, 0, 16);
+			strcpy((char *)buf, "loopback");
+			sp_loopback_ack(fd, buf, 16);
+			break;
+		case S_CMD_Q_SERBUF:
+			buf[0] = SP_LOOPBACK_SERBUF & 0xff;
+			buf[1] = (SP_LOOPBACK_SERBUF >> 8) & 0xff;
+			sp_loopback_ack(fd, buf, 2);
+			break;
+		case S_CMD_Q_BUSTYPE:
+			buf[0] = sp_loopback_buses;
+			sp_loopback_ack(fd, buf, 1);
+			break;
+		case S_CMD_Q_CHIPSIZE:
+			buf[0] = 24;
+			sp_loopback_ack(fd, buf, 1);
+			break;
+		case S_CMD_Q_OPBUF:
+			buf[0] = SP_LOOPBACK_OPBUF & 0xff;
+			buf[1] = (SP_LOOPBACK_OPBUF >> 8) & 0xff;
+			sp_loopback_ack(fd, buf, 2);
+			break;
+		case S_CMD_Q_WRNMAXLEN:
+		case S_CMD_Q_RDNMAXLEN:
+			len = (cmd == S_CMD_Q_WRNMAXLEN) ?
+			      SP_LOOPBACK_WRNMAXLEN : SP_LOOPBACK_RDNMAXLEN;
+			buf[0] = len & 0xff;
+			buf[1] = (len >> 8) & 0xff;
+			buf[2] = (len >> 16) & 0xff;
+			sp_loopback_ack(fd, buf, 3);
+			break;
+		case S_CMD_R_BYTE:
+			sp_loopback_read(fd, parm, 3);
+			addr = parm[0] | parm[1] << 8 | parm[2] << 16;
+			buf[0] = dummy_chip_readb(addr);
+			sp_loopback_ack(fd, buf, 1);
+			break;
+		case S_CMD_R_NBYTES:
+			sp_loopback_read(fd, parm, 6);
+			addr = parm[0] | parm[1] << 8 | parm[2] << 16;
+			len = parm[3] | parm[4] << 8 | parm[5] << 16;
+			sp_loopback_ack(fd, NULL, 0);
+			for (; len; len -= n, addr += n) {
+				n = min(len, sizeof(buf));
+				dummy_chip_readn(buf, addr, n);
+				sp_loopback_write(fd, buf, n);
+			}
+			break;
+		case S_CMD_O_WRITEB:
+			sp_loopback_read(fd, parm, 4);
+			addr = parm[0] | parm[1] << 8 | parm[2] << 16;
+			dummy_chip_writeb(parm[3], addr);
+			sp_loopback_ack(fd, NULL, 0);
+			break;
+		case S_CMD_O_WRITEN:
+			sp_loopback_read(fd, parm, 6);
+			len = parm[0] | parm[1] << 8 | parm[2] << 16;
+			addr = parm[3] | parm[4] << 8 | parm[5] << 16;
+			if (len > SP_LOOPBACK_WRNMAXLEN)
+				_exit(1);
+			sp_loopback_read(fd, buf, len);
+			dummy_chip_writen(buf, addr, len);
+			sp_loopback_ack(fd, NULL, 0);
+			break;
+		case S_CMD_O_DELAY:
+			sp_loopback_read(fd, parm, 4);
+			/* programmer_delay() would end up in serprog_delay(). */
+			internal_delay(parm[0] | parm[1] << 8 | parm[2] << 16 |
+				       parm[3] << 24);
+			sp_loopback_ack(fd, NULL, 0);
+			break;
+		case S_CMD_SYNCNOP:
+			buf[0] = S_NAK;
+			buf[1] = S_ACK;
+			sp_loopback_write(fd, buf, 2);
+			break;
+		case S_CMD_S_BUSTYPE:
+			sp_loopback_read(fd, parm, 1);
+			sp_loopback_ack(fd, NULL, 0);
+			break;
+		default:
+			buf[0] = S_NAK;
+			sp_loopback_write(fd, buf, 1);
+			break;
+		}
+	}
+}
+
+static int sp_open_loopback(void)
+{
+	enum chipbustype buses = buses_supported;
+	enum spi_controller controller = spi_controller;
+	int fds[2];
+	pid_t pid;
+
+	/* The emulator process inherits the emulated chip. Only the parallel
+	 * buses of the dummy programmer can be reached through serprog.
+	 */
+	if (dummy_init())
+		sp_die("Error: cannot set up the dummy programmer");
+	sp_loopback_buses = buses_supported & CHIP_BUSTYPE_NONSPI;
+	buses_supported = buses;
+	spi_controller = controller;
+
+	msg_pdbg(MSGHEADER "starting loopback emulator\n");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		sp_die("Error: cannot create socket pair");
+	/* Don't let the child print buffered output a second time. */
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		sp_die("Error: cannot start loopback emulator");
+	if (!pid) {
+		close(fds[0]);
+		sp_loopback_serve(fds[1]);
+	}
+	close(fds[1]);
+	sp_loopback_pid = pid;
+	return fds[0];
+}
+#endif
+
 int serprog_init(void)
 {
 	uint16_t iface;
@@ -304,6 +565,7 @@ int serprog_init(void)
 	char *device;
 	char *baudport;
 	int have_device = 0;
+	char *tmp;
 
 	/* the parameter is either of format "dev=/dev/device:baud" or "ip=ip:port" */
 	device = extract_programmer_param("dev");
@@ -366,6 +628,33 @@ int serprog_init(void)
 	}
 	free(device);
 
+	device = extract_programmer_param("loopback");
+	if (have_device && device) {
+		msg_perr("Error: Loopback emulation can't be combined with a "
+			 "host or device.\n");
+		free(device);
+		return 1;
+	}
+	if (device) {
+		if (strcmp(device, "dummy")) {
+			msg_perr("Error: Unknown loopback backend \"%s\".\n"
+				 "Use flashrom -p serprog:loopback=dummy\n",
+				 device);
+			free(device);
+			return 1;
+		}
+#if CONFIG_DUMMY == 1
+		sp_fd = sp_open_loopback();
+		have_device++;
+#else
+		msg_perr("Error: Loopback emulation needs the dummy "
+			 "programmer, which is not compiled in.\n");
+		free(device);
+		return 1;
+#endif
+	}
+	free(device);
+
 	if (!have_device) {
 		msg_perr("Error: Neither host nor device specified.\n"
 			 "Use flashrom -p serprog:dev=/dev/device:baud or "
@@ -373,6 +662,18 @@ int serprog_init(void)
 		return 1;
 	}
 
+	tmp = extract_programmer_param("window");
+	if (tmp) {
+		sp_window = atoi(tmp);
+		free(tmp);
+		if ((sp_window < 1) || (sp_window > SP_STREAM_MAX_OPS)) {
+			msg_perr("Error: window must be between 1 and %d.\n",
+				 SP_STREAM_MAX_OPS);
+			return 1;
+		}
+	}
+	msg_pdbg(MSGHEADER "up to %d commands in flight\n", sp_window);
+
 	msg_pdbg(MSGHEADER "connected - attempting to synchronize\n");
 
 	sp_check_avail_automatic = 0;
@@ -493,6 +794,7 @@ int serprog_init(void)
 	sp_prev_was_write = 0;
 	sp_streamed_transmit_ops = 0;
 	sp_streamed_transmit_bytes = 0;
+	sp_stream_tail = 0;
 	sp_opbuf_usage = 0;
 	return 0;
 }
@@ -504,9 +806,6 @@ static void sp_pass_writen(void)
 	unsigned char header[7];
 	msg_pspew(MSGHEADER "Passing write-n bytes=%d addr=0x%x\n",
 		     sp_write_n_bytes, sp_write_n_addr);
-	if (sp_streamed_transmit_bytes >=
-	    (7 + sp_write_n_bytes + sp_device_serbuf_size))
-		sp_flush_stream();
 	/* In case it's just a single byte send it as a single write. */
 	if (sp_write_n_bytes == 1) {
 		sp_write_n_bytes = 0;
@@ -514,10 +813,11 @@ static void sp_pass_writen(void)
 		header[1] = (sp_write_n_addr >> 8) & 0xFF;
 		header[2] = (sp_write_n_addr >> 16) & 0xFF;
 		header[3] = sp_write_n_buf[0];
-		sp_stream_buffer_op(S_CMD_O_WRITEB, 4, header);
+		sp_stream_buffer_op(S_CMD_O_WRITEB, 4, header, 0, NULL);
 		sp_opbuf_usage += 5;
 		return;
 	}
+	sp_stream_reserve(7 + sp_write_n_bytes);
 	header[0] = S_CMD_O_WRITEN;
 	header[1] = (sp_write_n_bytes >> 0) & 0xFF;
 	header[2] = (sp_write_n_bytes >> 8) & 0xFF;
@@ -530,8 +830,7 @@ static void sp_pass_writen(void)
 	if (write(sp_fd, sp_write_n_buf, sp_write_n_bytes) !=
 	    sp_write_n_bytes)
 		sp_die("Error: cannot write write-n data");
-	sp_streamed_transmit_bytes += 7 + sp_write_n_bytes;
-	sp_streamed_transmit_ops += 1;
+	sp_stream_push(7 + sp_write_n_bytes, 0, NULL);
 	sp_opbuf_usage += 7 + sp_write_n_bytes;
 	sp_write_n_bytes = 0;
 	sp_prev_was_write = 0;
@@ -541,7 +840,7 @@ static void sp_execute_opbuf_noflush(void)
 {
 	if ((sp_max_write_n) && (sp_write_n_bytes))
 		sp_pass_writen();
-	sp_stream_buffer_op(S_CMD_O_EXEC, 0, 0);
+	sp_stream_buffer_op(S_CMD_O_EXEC, 0, 0, 0, NULL);
 	msg_pspew(MSGHEADER "Executed operation buffer of %d bytes\n",
 		     sp_opbuf_usage);
 	sp_opbuf_usage = 0;
@@ -561,6 +860,11 @@ int serprog_shutdown(void)
 	if ((sp_opbuf_usage) || (sp_max_write_n && sp_write_n_bytes))
 		sp_execute_opbuf();
 	close(sp_fd);
+	if (sp_loopback_pid) {
+		/* The emulator exits when it sees the closed connection. */
+		waitpid(sp_loopback_pid, NULL, 0);
+		sp_loopback_pid = 0;
+	}
 	if (sp_max_write_n)
 		free(sp_write_n_buf);
 	return 0;
@@ -602,7 +906,7 @@ void serprog_chip_writeb(uint8_t val, chipaddr addr)
 		writeb_parm[1] = (addr >> 8) & 0xFF;
 		writeb_parm[2] = (addr >> 16) & 0xFF;
 		writeb_parm[3] = val;
-		sp_stream_buffer_op(S_CMD_O_WRITEB, 4, writeb_parm);
+		sp_stream_buffer_op(S_CMD_O_WRITEB, 4, writeb_parm, 0, NULL);
 		sp_opbuf_usage += 5;
 	}
 }
@@ -618,18 +922,16 @@ uint8_t serprog_chip_readb(const chipaddr addr)
 	buf[0] = ((addr >> 0) & 0xFF);
 	buf[1] = ((addr >> 8) & 0xFF);
 	buf[2] = ((addr >> 16) & 0xFF);
-	sp_stream_buffer_op(S_CMD_R_BYTE, 3, buf);
+	sp_stream_buffer_op(S_CMD_R_BYTE, 3, buf, 1, &c);
 	sp_flush_stream();
-	if (read(sp_fd, &c, 1) != 1)
-		sp_die("readb byteread");
 	msg_pspew("%s addr=0x%lx returning 0x%02X\n", __func__, addr, c);
 	return c;
 }
 
-/* Local version that really does the job, doesn't care of max_read_n. */
+/* Local version that really does the job, doesn't care of max_read_n.	*
+ * Only queues the read-n, the data is there after sp_flush_stream().	*/
 static void sp_do_read_n(uint8_t * buf, const chipaddr addr, size_t len)
 {
-	int rd_bytes = 0;
 	unsigned char sbuf[6];
 	msg_pspew("%s: addr=0x%lx len=%lu\n", __func__, addr, (unsigned long)len);
 	/* Stream the read-n -- as above. */
@@ -641,18 +943,13 @@ static void sp_do_read_n(uint8_t * buf, const chipaddr addr, size_t len)
 	sbuf[3] = ((len >> 0) & 0xFF);
 	sbuf[4] = ((len >> 8) & 0xFF);
 	sbuf[5] = ((len >> 16) & 0xFF);
-	sp_stream_buffer_op(S_CMD_R_NBYTES, 6, sbuf);
-	sp_flush_stream();
-	do {
-		int r = read(sp_fd, buf + rd_bytes, len - rd_bytes);
-		if (r <= 0)
-			sp_die("Error: cannot read read-n data");
-		rd_bytes += r;
-	} while (rd_bytes != len);
+	sp_stream_buffer_op(S_CMD_R_NBYTES, 6, sbuf, len, buf);
 	return;
 }
 
-/* The externally called version that makes sure that max_read_n is obeyed. */
+/* The externally called version that makes sure that max_read_n is obeyed.	*
+ * Up to sp_window read-n commands are in flight, so the reply of one	*
+ * chunk is read while the device already works on the next ones.	*/
 void serprog_chip_readn(uint8_t * buf, const chipaddr addr, size_t len)
 {
 	size_t lenm = len;
@@ -663,6 +960,7 @@ void serprog_chip_readn(uint8_t * buf, const chipaddr addr, size_t len)
 		lenm -= sp_max_read_n;
 	}
 	if (lenm) sp_do_read_n(&(buf[addrm-addr]),addrm,lenm);
+	sp_flush_stream();
 }
 
 void serprog_delay(int delay)
@@ -676,7 +974,7 @@ void serprog_delay(int delay)
 	buf[1] = ((delay >> 8) & 0xFF);
 	buf[2] = ((delay >> 16) & 0xFF);
 	buf[3] = ((delay >> 24) & 0xFF);
-	sp_stream_buffer_op(S_CMD_O_DELAY, 4, buf);
+	sp_stream_buffer_op(S_CMD_O_DELAY, 4, buf, 0, NULL);
 	sp_opbuf_usage += 5;
 	sp_prev_was_write = 0;
 }
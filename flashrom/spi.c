@@ -31,6 +31,9 @@
 
 enum spi_controller spi_controller = SPI_CONTROLLER_NONE;
 
+/* Maximum number of page program sequences in one batch. */
+#define SPI_BATCH_MAX 16
+
 const struct spi_programmer spi_programmer[] = {
 	{ /* SPI_CONTROLLER_NONE */
 		.command = NULL,
@@ -46,6 +49,8 @@ const struct spi_programmer spi_programmer[] = {
 		.multicommand = ich_spi_send_multicommand,
 		.read = ich_spi_read,
 		.write_256 = ich_spi_write_256,
+
+		.max_batch = SPI_BATCH_MAX,
 	},
 
 	{ /* SPI_CONTROLLER_ICH9 */
@@ -53,6 +58,8 @@ const struct spi_programmer spi_programmer[] = {
 		.multicommand = ich_spi_send_multicommand,
 		.read = ich_spi_read,
 		.write_256 = ich_spi_write_256,
+
+		.max_batch = SPI_BATCH_MAX,
 	},
 
 	{ /* SPI_CONTROLLER_IT87XX */
@@ -74,6 +81,8 @@ const struct spi_programmer spi_programmer[] = {
 		.multicommand = ich_spi_send_multicommand,
 		.read = ich_spi_read,
 		.write_256 = ich_spi_write_256,
+
+		.max_batch = SPI_BATCH_MAX,
 	},
 
 	{ /* SPI_CONTROLLER_WBSIO */
@@ -204,6 +213,101 @@ int default_spi_send_multicommand(struct spi_command *cmds)
 	for (; (cmds->writecnt || cmds->readcnt) && !result; cmds++) {
 		result = spi_send_command(cmds->writecnt, cmds->readcnt,
 					  cmds->writearr, cmds->readarr);
+		if (!result && (cmds->flags & SPI_CMD_WAIT_WIP))
+			spi_poll_wip();
+	}
+	return result;
+}
+
+static struct flashchip *spi_batch_flash = NULL;
+
+/* Status wait for SPI_CMD_WAIT_WIP inside a multicommand function. */
+void spi_poll_wip(void)
+{
+	spi_wait_page_program(spi_batch_flash);
+}
+
+/* Page program batching.
+ * Programmers with a nonzero max_batch get a whole series of WREN, PP and
+ * status wait sequences in a single multicommand call, which saves one
+ * round trip per command and per status read on programmers where each
+ * transaction is expensive. Every sequence uses two entries in
+ * spi_batch_cmds, the last entry is the terminator.
+ */
+static struct spi_command spi_batch_cmds[2 * SPI_BATCH_MAX + 1];
+static unsigned char spi_batch_buf[SPI_BATCH_MAX][JEDEC_BYTE_PROGRAM_OUTSIZE - 1 + 256];
+static const unsigned char spi_batch_wren = JEDEC_WREN;
+static int spi_batch_count = 0;
+
+/* Returns 0 if the programmer can't handle batched page programs. */
+int spi_batch_size(void)
+{
+	return min(spi_programmer[spi_controller].max_batch, SPI_BATCH_MAX);
+}
+
+/* Queue a page program. The queue is sent once it is full. */
+int spi_batch_program(struct flashchip *flash, int addr, uint8_t *bytes,
+		      int len)
+{
+	struct spi_command *cmd;
+	unsigned char *buf;
+
+	if (!len) {
+		msg_cerr("%s called for zero-length write\n", __func__);
+		spi_batch_count = 0;
+		return 1;
+	}
+	if (len > 256) {
+		msg_cerr("%s called for too long a write\n", __func__);
+		spi_batch_count = 0;
+		return 1;
+	}
+
+	spi_batch_flash = flash;
+	buf = spi_batch_buf[spi_batch_count];
+	buf[0] = JEDEC_BYTE_PROGRAM;
+	buf[1] = (addr >> 16) & 0xff;
+	buf[2] = (addr >> 8) & 0xff;
+	buf[3] = (addr >> 0) & 0xff;
+	memcpy(&buf[4], bytes, len);
+
+	cmd = &spi_batch_cmds[2 * spi_batch_count];
+	cmd[0].writecnt = JEDEC_WREN_OUTSIZE;
+	cmd[0].readcnt = 0;
+	cmd[0].writearr = &spi_batch_wren;
+	cmd[0].readarr = NULL;
+	cmd[0].flags = 0;
+	cmd[1].writecnt = JEDEC_BYTE_PROGRAM_OUTSIZE - 1 + len;
+	cmd[1].readcnt = 0;
+	cmd[1].writearr = buf;
+	cmd[1].readarr = NULL;
+	cmd[1].flags = SPI_CMD_WAIT_WIP;
+	memset(&cmd[2], 0, sizeof(cmd[2]));
+	spi_batch_count++;
+
+	if (spi_batch_count >= max(spi_batch_size(), 1))
+		return spi_batch_flush();
+	return 0;
+}
+
+/* Send all queued page programs. */
+int spi_batch_flush(void)
+{
+	int result;
+	int addr;
+
+	if (!spi_batch_count)
+		return 0;
+	addr = spi_batch_buf[0][1] << 16 | spi_batch_buf[0][2] << 8 |
+	       spi_batch_buf[0][3];
+	msg_pspew("%s: %i page programs from 0x%06x\n", __func__,
+		  spi_batch_count, addr);
+	spi_batch_count = 0;
+
+	result = spi_send_multicommand(spi_batch_cmds);
+	if (result) {
+		msg_cerr("%s failed during command execution in the batch "
+			 "starting at address 0x%x\n", __func__, addr);
 	}
 	return result;
 }
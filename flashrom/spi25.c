@@ -23,6 +23,7 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include "flash.h"
 #include "flashchips.h"
 #include "chipdrivers.h"
@@ -37,9 +38,12 @@ static int spi_rdid(unsigned char *readarr, int bytes)
 	int ret;
 	int i;
 
+	if (probe_cache_get(PROBE_SPI_RDID, bytes, 0, readarr, bytes))
+		return 0;
 	ret = spi_send_command(sizeof(cmd), bytes, cmd, readarr);
 	if (ret)
 		return ret;
+	probe_cache_put(PROBE_SPI_RDID, bytes, 0, readarr, bytes);
 	msg_cspew("RDID returned");
 	for (i = 0; i < bytes; i++)
 		msg_cspew(" 0x%02x", readarr[i]);
@@ -53,6 +57,8 @@ static int spi_rems(unsigned char *readarr)
 	uint32_t readaddr;
 	int ret;
 
+	if (probe_cache_get(PROBE_SPI_REMS, 0, 0, readarr, JEDEC_REMS_INSIZE))
+		return 0;
 	ret = spi_send_command(sizeof(cmd), JEDEC_REMS_INSIZE, cmd, readarr);
 	if (ret == SPI_INVALID_ADDRESS) {
 		/* Find the lowest even address allowed for reads. */
@@ -64,6 +70,7 @@ static int spi_rems(unsigned char *readarr)
 	}
 	if (ret)
 		return ret;
+	probe_cache_put(PROBE_SPI_REMS, 0, 0, readarr, JEDEC_REMS_INSIZE);
 	msg_cspew("REMS returned %02x %02x. ", readarr[0], readarr[1]);
 	return 0;
 }
@@ -75,6 +82,8 @@ static int spi_res(unsigned char *readarr, int bytes)
 	int ret;
 	int i;
 
+	if (probe_cache_get(PROBE_SPI_RES, bytes, 0, readarr, bytes))
+		return 0;
 	ret = spi_send_command(sizeof(cmd), bytes, cmd, readarr);
 	if (ret == SPI_INVALID_ADDRESS) {
 		/* Find the lowest even address allowed for reads. */
@@ -86,6 +95,7 @@ static int spi_res(unsigned char *readarr, int bytes)
 	}
 	if (ret)
 		return ret;
+	probe_cache_put(PROBE_SPI_RES, bytes, 0, readarr, bytes);
 	msg_cspew("RES returned");
 	for (i = 0; i < bytes; i++)
 		msg_cspew(" 0x%02x", readarr[i]);
@@ -311,6 +321,141 @@ uint8_t spi_read_status_register(void)
 	return readarr[0];
 }
 
+/* Adaptive polling of the Write-In-Progress bit.
+ * Every operation remembers how long it took on the current chip. The first
+ * status read is delayed by half the observed median, after that the poll
+ * interval starts at 1/16 of the median and doubles until it reaches the
+ * per-operation maximum step.
+ */
+#define SPI_WIP_SAMPLES 64
+
+enum spi_wip_op {
+	SPI_WIP_SE_20,
+	SPI_WIP_BE_52,
+	SPI_WIP_BE_D7,
+	SPI_WIP_BE_D8,
+	SPI_WIP_CE_60,
+	SPI_WIP_CE_C7,
+	SPI_WIP_BYTE_PROGRAM,
+	SPI_WIP_PAGE_PROGRAM,
+	SPI_WIP_AAI_PROGRAM,
+};
+
+struct spi_wip_stat {
+	const char *name;
+	/* Expected duration before anything was measured. */
+	unsigned long typical;
+	/* Upper limit for the delay between two status reads. */
+	unsigned long max_step;
+	struct flashchip *flash;
+	unsigned long count;
+	unsigned long polls;
+	unsigned long min;
+	unsigned long max;
+	unsigned long median;
+	unsigned long samples[SPI_WIP_SAMPLES];
+};
+
+/* Indexed by enum spi_wip_op. */
+static struct spi_wip_stat spi_wip_stats[] = {
+	{"sector erase 0x20",	45 * 1000,		10 * 1000},
+	{"block erase 0x52",	300 * 1000,		100 * 1000},
+	{"block erase 0xd7",	100 * 1000,		100 * 1000},
+	{"block erase 0xd8",	500 * 1000,		100 * 1000},
+	{"chip erase 0x60",	10 * 1000 * 1000,	1000 * 1000},
+	{"chip erase 0xc7",	10 * 1000 * 1000,	1000 * 1000},
+	{"byte program",	20,			100},
+	{"page program",	1000,			1000},
+	{"AAI word program",	20,			100},
+};
+
+static int spi_wip_compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void spi_wip_record(struct spi_wip_stat *stat, unsigned long usecs)
+{
+	unsigned long sorted[SPI_WIP_SAMPLES];
+	int n;
+
+	if (!stat->count || usecs < stat->min)
+		stat->min = usecs;
+	if (usecs > stat->max)
+		stat->max = usecs;
+	stat->samples[stat->count % SPI_WIP_SAMPLES] = usecs;
+	stat->count++;
+
+	/* The median of the most recent samples tracks the chip behaviour
+	 * without being thrown off by single outliers.
+	 */
+	n = min(stat->count, SPI_WIP_SAMPLES);
+	memcpy(sorted, stat->samples, n * sizeof(sorted[0]));
+	qsort(sorted, n, sizeof(sorted[0]), spi_wip_compare);
+	stat->median = sorted[n / 2];
+}
+
+/* Wait until the Write-In-Progress bit is cleared. */
+static void spi_wait_wip(struct flashchip *flash, enum spi_wip_op op)
+{
+	struct spi_wip_stat *stat = &spi_wip_stats[op];
+	unsigned long start, expected, interval;
+
+	/* Timings learned on one chip say nothing about another one. */
+	if (stat->flash != flash) {
+		stat->flash = flash;
+		stat->count = 0;
+		stat->polls = 0;
+		stat->min = 0;
+		stat->max = 0;
+		stat->median = 0;
+	}
+	expected = stat->count ? stat->median : stat->typical;
+	interval = max(expected / 16, 1);
+	interval = min(interval, stat->max_step);
+
+	start = timer_usecs();
+	/* Without history, poll right away as the fixed-step code did. */
+	if (stat->count && expected / 2)
+		programmer_delay(expected / 2);
+	/* FIXME: We assume spi_read_status_register will never fail. */
+	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP) {
+		stat->polls++;
+		programmer_delay(interval);
+		interval = min(interval * 2, stat->max_step);
+	}
+	stat->polls++;
+	spi_wip_record(stat, timer_usecs() - start);
+}
+
+/* Wait for a page program sent by a multicommand function. */
+void spi_wait_page_program(struct flashchip *flash)
+{
+	spi_wait_wip(flash, SPI_WIP_PAGE_PROGRAM);
+}
+
+void spi_print_wip_stats(void)
+{
+	struct spi_wip_stat *stat;
+	int i, header = 0;
+
+	for (i = 0; i < ARRAY_SIZE(spi_wip_stats); i++) {
+		stat = &spi_wip_stats[i];
+		if (!stat->count)
+			continue;
+		if (!header++)
+			msg_cdbg("SPI operation timing for %s:\n",
+				 stat->flash->name);
+		msg_cdbg("  %s: %lu ops, min %lu us, median %lu us, "
+			 "max %lu us, %lu status reads\n", stat->name,
+			 stat->count, stat->min, stat->median, stat->max,
+			 stat->polls);
+	}
+}
+
 /* Prettyprint the status register. Common definitions. */
 static void spi_prettyprint_status_register_welwip(uint8_t status)
 {
@@ -585,11 +730,9 @@ int spi_chip_erase_60(struct flashchip *flash)
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 1-85 s, so wait in 1 s steps.
+	 * This usually takes 1-85 s, so wait in up to 1 s steps.
 	 */
-	/* FIXME: We assume spi_read_status_register will never fail. */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(1000 * 1000);
+	spi_wait_wip(flash, SPI_WIP_CE_60);
 	if (check_erased_range(flash, 0, flash->total_size * 1024)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -630,11 +773,9 @@ int spi_chip_erase_c7(struct flashchip *flash)
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 1-85 s, so wait in 1 s steps.
+	 * This usually takes 1-85 s, so wait in up to 1 s steps.
 	 */
-	/* FIXME: We assume spi_read_status_register will never fail. */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(1000 * 1000);
+	spi_wait_wip(flash, SPI_WIP_CE_C7);
 	if (check_erased_range(flash, 0, flash->total_size * 1024)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -679,10 +820,9 @@ int spi_block_erase_52(struct flashchip *flash, unsigned int addr, unsigned int
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 100-4000 ms, so wait in 100 ms steps.
+	 * This usually takes 100-4000 ms, so wait in up to 100 ms steps.
 	 */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(100 * 1000);
+	spi_wait_wip(flash, SPI_WIP_BE_52);
 	if (check_erased_range(flash, addr, blocklen)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -732,10 +872,9 @@ int spi_block_erase_d8(struct flashchip *flash, unsigned int addr, unsigned int
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 100-4000 ms, so wait in 100 ms steps.
+	 * This usually takes 100-4000 ms, so wait in up to 100 ms steps.
 	 */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(100 * 1000);
+	spi_wait_wip(flash, SPI_WIP_BE_D8);
 	if (check_erased_range(flash, addr, blocklen)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -783,10 +922,9 @@ int spi_block_erase_d7(struct flashchip *flash, unsigned int addr, unsigned int
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 100-4000 ms, so wait in 100 ms steps.
+	 * This usually takes 100-4000 ms, so wait in up to 100 ms steps.
 	 */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(100 * 1000);
+	spi_wait_wip(flash, SPI_WIP_BE_D7);
 	if (check_erased_range(flash, addr, blocklen)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -832,10 +970,9 @@ int spi_block_erase_20(struct flashchip *flash, unsigned int addr, unsigned int
 		return result;
 	}
 	/* Wait until the Write-In-Progress bit is cleared.
-	 * This usually takes 15-800 ms, so wait in 10 ms steps.
+	 * This usually takes 15-800 ms, so wait in up to 10 ms steps.
 	 */
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(10 * 1000);
+	spi_wait_wip(flash, SPI_WIP_SE_20);
 	if (check_erased_range(flash, addr, blocklen)) {
 		msg_cerr("ERASE FAILED!\n");
 		return -1;
@@ -1259,37 +1396,18 @@ int spi_nbyte_read(int address, uint8_t *bytes, int len)
 
 /*
  * Read a part of the flash chip.
- * FIXME: Use the chunk code from Michael Karcher instead.
- * Each page is read separately in chunks with a maximum size of chunksize.
+ * READ is not limited to page boundaries, the address counter wraps only at
+ * the end of the chip. Read the whole range in chunks with a maximum size of
+ * chunksize to keep the number of commands low.
  */
 int spi_read_chunked(struct flashchip *flash, uint8_t *buf, int start, int len, int chunksize)
 {
 	int rc = 0;
-	int i, j, starthere, lenhere;
-	int page_size = flash->page_size;
-	int toread;
+	int i, toread;
 
-	/* Warning: This loop has a very unusual condition and body.
-	 * The loop needs to go through each page with at least one affected
-	 * byte. The lowest page number is (start / page_size) since that
-	 * division rounds down. The highest page number we want is the page
-	 * where the last byte of the range lives. That last byte has the
-	 * address (start + len - 1), thus the highest page number is
-	 * (start + len - 1) / page_size. Since we want to include that last
-	 * page as well, the loop condition uses <=.
-	 */
-	for (i = start / page_size; i <= (start + len - 1) / page_size; i++) {
-		/* Byte position of the first byte in the range in this page. */
-		/* starthere is an offset to the base address of the chip. */
-		starthere = max(start, i * page_size);
-		/* Length of bytes in the range in this page. */
-		lenhere = min(start + len, (i + 1) * page_size) - starthere;
-		for (j = 0; j < lenhere; j += chunksize) {
-			toread = min(chunksize, lenhere - j);
-			rc = spi_nbyte_read(starthere + j, buf + starthere - start + j, toread);
-			if (rc)
-				break;
-		}
+	for (i = 0; i < len; i += chunksize) {
+		toread = min(chunksize, len - i);
+		rc = spi_nbyte_read(start + i, buf + i, toread);
 		if (rc)
 			break;
 	}
@@ -1313,6 +1431,7 @@ int spi_write_chunked(struct flashchip *flash, uint8_t *buf, int start, int len,
 	 */
 	int page_size = flash->page_size;
 	int towrite;
+	int batch = spi_batch_size();
 
 	/* Warning: This loop has a very unusual condition and body.
 	 * The loop needs to go through each page with at least one affected
@@ -1331,15 +1450,23 @@ int spi_write_chunked(struct flashchip *flash, uint8_t *buf, int start, int len,
 		lenhere = min(start + len, (i + 1) * page_size) - starthere;
 		for (j = 0; j < lenhere; j += chunksize) {
 			towrite = min(chunksize, lenhere - j);
+			if (batch) {
+				/* The programmer waits for WIP itself. */
+				rc = spi_batch_program(flash, starthere + j, buf + starthere - start + j, towrite);
+				if (rc)
+					break;
+				continue;
+			}
 			rc = spi_nbyte_program(starthere + j, buf + starthere - start + j, towrite);
 			if (rc)
 				break;
-			while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-				programmer_delay(10);
+			spi_wait_wip(flash, SPI_WIP_PAGE_PROGRAM);
 		}
 		if (rc)
 			break;
 	}
+	if (!rc && batch)
+		rc = spi_batch_flush();
 
 	return rc;
 }
@@ -1359,8 +1486,7 @@ int spi_chip_write_1(struct flashchip *flash, uint8_t *buf, int start, int len)
 		result = spi_byte_program(i, buf[i - start]);
 		if (result)
 			return 1;
-		while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-			programmer_delay(10);
+		spi_wait_wip(flash, SPI_WIP_BYTE_PROGRAM);
 	}
 
 	return 0;
@@ -1455,8 +1581,7 @@ int spi_aai_write(struct flashchip *flash, uint8_t *buf, int start, int len)
 		 */
 		return result;
 	}
-	while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-		programmer_delay(10);
+	spi_wait_wip(flash, SPI_WIP_AAI_PROGRAM);
 
 	/* We already wrote 2 bytes in the multicommand step. */
 	pos += 2;
@@ -1466,8 +1591,7 @@ int spi_aai_write(struct flashchip *flash, uint8_t *buf, int start, int len)
 		cmd[1] = buf[pos++ - start];
 		cmd[2] = buf[pos++ - start];
 		spi_send_command(JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE, 0, cmd, NULL);
-		while (spi_read_status_register() & JEDEC_RDSR_BIT_WIP)
-			programmer_delay(10);
+		spi_wait_wip(flash, SPI_WIP_AAI_PROGRAM);
 	}
 
 	/* Use WRDI to exit AAI mode. This needs to be done before issuing any
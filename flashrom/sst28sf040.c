@@ -69,7 +69,9 @@ int erase_sector_28sf040(struct flashchip *flash, unsigned int address, unsigned
 	chip_writeb(AUTO_PG_ERASE2, bios + address);
 
 	/* wait for Toggle bit ready */
-	toggle_ready_jedec(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_SECTOR_ERASE,
+			       sector_size))
+		return -1;
 
 	if (check_erased_range(flash, address, sector_size)) {
 		msg_cerr("ERASE FAILED!\n");
@@ -97,7 +99,8 @@ int write_28sf040(struct flashchip *flash, uint8_t *src, int start, int len)
 		chip_writeb(*src++, dst++);
 
 		/* wait for Toggle bit ready */
-		toggle_ready_jedec(bios);
+		if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_PROGRAM, 1))
+			return 1;
 	}
 
 	return 0;
@@ -111,7 +114,9 @@ static int erase_28sf040(struct flashchip *flash)
 	chip_writeb(CHIP_ERASE, bios);
 
 	programmer_delay(10);
-	toggle_ready_jedec(bios);
+	if (toggle_ready_jedec(flash, bios, JEDEC_WAIT_CHIP_ERASE,
+			       flash->total_size * 1024))
+		return -1;
 
 	if (check_erased_range(flash, 0, flash->total_size * 1024)) {
 		msg_cerr("ERASE FAILED!\n");
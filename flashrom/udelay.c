@@ -24,13 +24,21 @@
 #include <unistd.h>
 #ifndef __WATCOMC__
 #include <sys/time.h>
-#else
-#include <time.h>
 #endif
+#include <time.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include "flash.h"
 
+/* Linux has a monotonic clock with sub-microsecond resolution, which allows
+ * busy waiting on the clock itself without any calibration.
+ */
+#if defined(__linux__) && defined(CLOCK_MONOTONIC)
+#define HAVE_CLOCK_DELAY 1
+#endif
+
 #ifdef __WATCOMC__
 struct timeval {
  long tv_sec;
@@ -41,6 +49,37 @@ struct timeval {
 /* loops per microsecond */
 static unsigned long micro = 1;
 
+#if HAVE_CLOCK_DELAY == 1
+static int use_clock_delay = 0;
+
+static int clock_delay_usable(void)
+{
+	struct timespec res;
+
+	if (clock_getres(CLOCK_MONOTONIC, &res))
+		return 0;
+	/* Even the shortest delays must be measurable. */
+	return !res.tv_sec && res.tv_nsec <= 1000;
+}
+
+static void clock_delay(int usecs)
+{
+	struct timespec now, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += usecs / 1000000;
+	end.tv_nsec += (usecs % 1000000) * 1000L;
+	if (end.tv_nsec >= 1000000000) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000;
+	}
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (now.tv_sec < end.tv_sec ||
+		 (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+}
+#endif
+
 #ifndef __WATCOMC__
 __attribute__ ((noinline)) void myusec_delay(int usecs)
 {
@@ -115,6 +154,137 @@ static unsigned long measure_delay(int usecs)
 	return timeusec;
 }
 
+/* Measure a short delay and return its length in percent of the expected
+ * length.
+ */
+static unsigned long check_delay(unsigned long resolution)
+{
+	if (resolution && (resolution < 10))
+		return measure_delay(100);
+	if (resolution && (resolution < ULONG_MAX / 200))
+		return measure_delay(resolution * 10) * 100 / (resolution * 10);
+	/* This workaround should be active for broken
+	 * OS and maybe libpayload. The criterion
+	 * here is horrible or non-measurable OS timer
+	 * resolution which will result in
+	 * measure_delay(100)=0 whereas a longer delay
+	 * (1000 ms) may be sufficient
+	 * to get a nonzero time measurement.
+	 */
+	return measure_delay(1000000) / 10000;
+}
+
+#ifndef __WATCOMC__
+/* The calibration result is stored in cache_dir with an identification of the
+ * CPU. A cached result is only used if a few short delays still have about
+ * the right length, which also catches a changed CPU frequency.
+ */
+#define DELAY_CACHE_FILE "delay.cal"
+
+static char *delay_cache_path(void)
+{
+	char *path;
+
+	path = malloc(strlen(cache_dir) + sizeof("/" DELAY_CACHE_FILE));
+	if (!path) {
+		msg_gerr("Out of memory!\n");
+		return NULL;
+	}
+	sprintf(path, "%s/" DELAY_CACHE_FILE, cache_dir);
+	return path;
+}
+
+static void cpu_fingerprint(char *buf, int len)
+{
+	char line[256];
+	FILE *cpuinfo;
+	char *tmp;
+
+	snprintf(buf, len, "unknown");
+	cpuinfo = fopen("/proc/cpuinfo", "r");
+	if (!cpuinfo)
+		return;
+	while (fgets(line, sizeof(line), cpuinfo)) {
+		if (strncmp(line, "model name", 10))
+			continue;
+		tmp = strchr(line, ':');
+		if (!tmp)
+			break;
+		tmp += strspn(tmp + 1, " \t") + 1;
+		tmp[strcspn(tmp, "\n")] = '\0';
+		snprintf(buf, len, "%s", tmp);
+		break;
+	}
+	fclose(cpuinfo);
+}
+
+static int load_delay_cache(unsigned long *resolution)
+{
+	char fingerprint[256], line[300];
+	unsigned long cached_micro, cached_resolution;
+	char *path;
+	FILE *cache;
+	int pos, i;
+	unsigned long percent;
+
+	path = delay_cache_path();
+	if (!path)
+		return 1;
+	cache = fopen(path, "r");
+	free(path);
+	if (!cache)
+		return 1;
+	if (!fgets(line, sizeof(line), cache) ||
+	    sscanf(line, "%lu %lu %n", &cached_micro, &cached_resolution,
+		   &pos) != 2) {
+		fclose(cache);
+		return 1;
+	}
+	fclose(cache);
+	line[strcspn(line, "\n")] = '\0';
+	cpu_fingerprint(fingerprint, sizeof(fingerprint));
+	if (!cached_micro || strcmp(line + pos, fingerprint)) {
+		msg_pdbg("cached calibration is for another CPU, ");
+		return 1;
+	}
+
+	micro = cached_micro;
+	for (i = 0; i < 4; i++) {
+		percent = check_delay(cached_resolution);
+		if (percent < 90 || percent > 150) {
+			msg_pdbg("cached calibration is off (got %lu%% of "
+				 "expected delay), ", percent);
+			micro = 1;
+			return 1;
+		}
+	}
+	*resolution = cached_resolution;
+	return 0;
+}
+
+static void store_delay_cache(unsigned long resolution)
+{
+	char fingerprint[256];
+	char *path;
+	FILE *cache;
+
+	path = delay_cache_path();
+	if (!path)
+		return;
+	cache = fopen(path, "w");
+	if (!cache) {
+		msg_pdbg("Could not store the delay calibration in %s.\n",
+			 path);
+		free(path);
+		return;
+	}
+	cpu_fingerprint(fingerprint, sizeof(fingerprint));
+	fprintf(cache, "%lu %lu %s\n", micro, resolution, fingerprint);
+	fclose(cache);
+	free(path);
+}
+#endif
+
 void myusec_calibrate_delay(void)
 {
 	unsigned long count = 1000;
@@ -122,6 +292,20 @@ void myusec_calibrate_delay(void)
 	int i, tries = 0;
 
 	msg_pinfo("Calibrating delay loop... ");
+#if HAVE_CLOCK_DELAY == 1
+	if (clock_delay_usable()) {
+		use_clock_delay = 1;
+		msg_pinfo("not needed with a monotonic clock, OK.\n");
+		return;
+	}
+#endif
+#ifndef __WATCOMC__
+	if (cache_dir && !load_delay_cache(&resolution)) {
+		msg_pdbg("using cached %luM loops per second, ", micro);
+		msg_pinfo("OK.\n");
+		return;
+	}
+#endif
 	resolution = measure_os_delay_resolution();
 	if (resolution) {
 		msg_pdbg("OS timer resolution is %lu usecs, ", resolution);
@@ -161,23 +345,7 @@ recalibrate:
 		 * a scheduler delay or something similar.
 		 */
 		for (i = 0; i < 4; i++) {
-			if (resolution && (resolution < 10)) {
-				timeusec = measure_delay(100);
-			} else if (resolution && 
-				   (resolution < ULONG_MAX / 200)) {
-				timeusec = measure_delay(resolution * 10) *
-					   100 / (resolution * 10);
-			} else {
-				/* This workaround should be active for broken
-				 * OS and maybe libpayload. The criterion
-				 * here is horrible or non-measurable OS timer
-				 * resolution which will result in
-				 * measure_delay(100)=0 whereas a longer delay
-				 * (1000 ms) may be sufficient
-				 * to get a nonzero time measurement.
-				 */
-				timeusec = measure_delay(1000000) / 10000;
-			}
+			timeusec = check_delay(resolution);
 			if (timeusec < 90) {
 				msg_pdbg("delay more than 10%% too short (got "
 					 "%lu%% of expected delay), "
@@ -202,6 +370,25 @@ recalibrate:
 	msg_pdbg("%ld myus = %ld us, ", resolution * 4, timeusec);
 
 	msg_pinfo("OK.\n");
+#ifndef __WATCOMC__
+	if (cache_dir && tries < 5)
+		store_delay_cache(resolution);
+#endif
+}
+
+/* Microsecond timestamp for measuring elapsed time. The value wraps around,
+ * so only differences between two timestamps are meaningful.
+ */
+unsigned long timer_usecs(void)
+{
+#ifndef __WATCOMC__
+	struct timeval now;
+
+	gettimeofday(&now, 0);
+	return (unsigned long)now.tv_sec * 1000000 + now.tv_usec;
+#else
+	return (unsigned long)clock() * (1000000 / CLOCKS_PER_SEC);
+#endif
 }
 
 void internal_delay(int usecs)
@@ -218,6 +405,12 @@ void internal_delay(int usecs)
 #endif
 	} else {
 //		msg_pinfo("MY_SLEEP: %d\n", usecs);
+#if HAVE_CLOCK_DELAY == 1
+		if (use_clock_delay) {
+			clock_delay(usecs);
+			return;
+		}
+#endif
 		myusec_delay(usecs);
 	}
 }
@@ -229,6 +422,11 @@ void myusec_calibrate_delay(void)
 	get_cpu_speed();
 }
 
+unsigned long timer_usecs(void)
+{
+	return timer_us(0);
+}
+
 void internal_delay(int usecs)
 {
 	udelay(usecs);
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Build time check of the flash chip table. It runs the eraseblock checks
+ * which flashrom used to do on every start, and compares find_eraseblock()
+ * with a walk over every block of every erase function.
+ *
+ * Run with "make check".
+ */
+
+#include <stdio.h>
+#include "../flash.h"
+#include "../flashchips.h"
+
+static int check_lookup(struct flashchip *flash, int k)
+{
+	struct block_eraser *eraser = &flash->block_erasers[k];
+	unsigned int start = 0, len, found_start, found_len;
+	int i, j, block = 0, ret = 0;
+
+	for (i = 0; i < NUM_ERASEREGIONS; i++) {
+		len = eraser->eraseblocks[i].size;
+		for (j = 0; j < eraser->eraseblocks[i].count; j++, block++) {
+			/* Check both ends of the block. */
+			if (find_eraseblock(eraser, start, &found_start,
+					    &found_len) != block ||
+			    found_start != start || found_len != len ||
+			    find_eraseblock(eraser, start + len - 1,
+					    &found_start, &found_len) != block) {
+				printf("%s erase function %i: lookup of block "
+				       "%i at 0x%06x failed\n", flash->name, k,
+				       block, start);
+				ret = 1;
+			}
+			start += len;
+		}
+	}
+	if (find_eraseblock(eraser, start, &found_start, &found_len) != -1) {
+		printf("%s erase function %i: lookup past the end at 0x%06x "
+		       "succeeded\n", flash->name, k, start);
+		ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct flashchip *flash;
+	int chips = 0, ret = 0, k;
+
+	for (flash = flashchips; flash && flash->name; flash++, chips++) {
+		if (selfcheck_eraseblocks(flash))
+			ret = 1;
+		for (k = 0; k < NUM_ERASEFUNCTIONS; k++)
+			if (check_lookup(flash, k))
+				ret = 1;
+	}
+	printf("Checked %i flash chips: %s\n", chips, ret ? "FAILED" : "OK");
+	return ret;
+}
@@ -0,0 +1,221 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Micro-benchmark for need_erase() and get_next_write() from memdiff.c.
+ * Compares them against the original byte-at-a-time code on a random image
+ * and on an image with sparse differences, and checks that both agree.
+ *
+ * Build with "make diffbench", run as "util/diffbench [size in MiB]".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include "../flash.h"
+
+#define BLOCK_SIZE (4 * 1024)
+
+int print(int type, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+static int min_int(int a, int b)
+{
+	return (a < b) ? a : b;
+}
+
+/* The byte-at-a-time code memdiff.c replaced. */
+static int need_erase_scalar(uint8_t *have, uint8_t *want, int len,
+			     enum write_granularity gran)
+{
+	int result = 0;
+	int i, j, limit;
+
+	switch (gran) {
+	case write_gran_1bit:
+		for (i = 0; i < len; i++)
+			if ((have[i] & want[i]) != want[i]) {
+				result = 1;
+				break;
+			}
+		break;
+	case write_gran_1byte:
+		for (i = 0; i < len; i++)
+			if ((have[i] != want[i]) && (have[i] != 0xff)) {
+				result = 1;
+				break;
+			}
+		break;
+	case write_gran_256bytes:
+		for (j = 0; j < len / 256; j++) {
+			limit = min_int(256, len - j * 256);
+			if (!memcmp(have + j * 256, want + j * 256, limit))
+				continue;
+			for (i = 0; i < limit; i++)
+				if (have[j * 256 + i] != 0xff) {
+					result = 1;
+					break;
+				}
+			if (result)
+				break;
+		}
+		break;
+	}
+	return result;
+}
+
+static int get_next_write_scalar(uint8_t *have, uint8_t *want, int len,
+				 int *first_start, enum write_granularity gran)
+{
+	int need_write = 0, rel_start = 0, first_len = 0;
+	int i, limit, stride;
+
+	stride = (gran == write_gran_256bytes) ? 256 : 1;
+	for (i = 0; i < len / stride; i++) {
+		limit = min_int(stride, len - i * stride);
+		if (memcmp(have + i * stride, want + i * stride, limit)) {
+			if (!need_write) {
+				need_write = 1;
+				rel_start = i * stride;
+			}
+		} else {
+			if (need_write)
+				break;
+		}
+	}
+	if (need_write)
+		first_len = min_int(i * stride - rel_start, len);
+	*first_start += rel_start;
+	return first_len;
+}
+
+typedef int (*need_erase_func)(uint8_t *have, uint8_t *want, int len,
+			       enum write_granularity gran);
+typedef int (*next_write_func)(uint8_t *have, uint8_t *want, int len,
+			       int *first_start, enum write_granularity gran);
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Same walk as erase_and_write_block_helper(): check every block for an
+ * erase, then collect all write ranges. The checksum lets the caller compare
+ * the results of two implementations.
+ */
+static unsigned long run(need_erase_func ne, next_write_func nw,
+			 uint8_t *have, uint8_t *want, int size,
+			 enum write_granularity gran)
+{
+	unsigned long sum = 0;
+	int block, start, len;
+
+	for (block = 0; block < size; block += BLOCK_SIZE) {
+		sum = sum * 3 + ne(have + block, want + block, BLOCK_SIZE, gran);
+		start = 0;
+		while ((len = nw(have + block + start, want + block + start,
+				 BLOCK_SIZE - start, &start, gran))) {
+			sum = sum * 31 + start * 7 + len;
+			start += len;
+		}
+	}
+	return sum;
+}
+
+static int bench(const char *name, uint8_t *have, uint8_t *want, int size)
+{
+	static const char *const gran_names[] = { "1bit", "1byte", "256bytes" };
+	enum write_granularity gran;
+	unsigned long s1, s2;
+	double t0, t1, t2;
+	int ret = 0;
+
+	for (gran = write_gran_1bit; gran <= write_gran_256bytes; gran++) {
+		t0 = now();
+		s1 = run(need_erase_scalar, get_next_write_scalar, have, want,
+			 size, gran);
+		t1 = now();
+		s2 = run(need_erase, get_next_write, have, want, size, gran);
+		t2 = now();
+		printf("%-8s %-9s scalar %8.2f ms  memdiff %8.2f ms  %5.1fx%s\n",
+		       name, gran_names[gran], (t1 - t0) * 1e3,
+		       (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1),
+		       (s1 == s2) ? "" : "  MISMATCH");
+		if (s1 != s2)
+			ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t *have, *want;
+	int size, i, ret = 0;
+
+	size = ((argc > 1) ? atoi(argv[1]) : 32) * 1024 * 1024;
+	if (size <= 0) {
+		fprintf(stderr, "Usage: %s [size in MiB]\n", argv[0]);
+		return 1;
+	}
+	have = malloc(size);
+	want = malloc(size);
+	if (!have || !want) {
+		fprintf(stderr, "Out of memory!\n");
+		return 1;
+	}
+
+	srand(1);
+	for (i = 0; i < size; i++) {
+		have[i] = rand();
+		want[i] = rand();
+	}
+	ret |= bench("random", have, want, size);
+
+	/* An erased chip getting an image with a few changed bytes, like
+	 * an update of a single setting.
+	 */
+	memset(have, 0xff, size);
+	memcpy(want, have, size);
+	for (i = 0; i < size / 4096; i++)
+		want[rand() % size] = rand();
+	ret |= bench("sparse", have, want, size);
+
+	/* The same update on top of an old image, so erases are needed. */
+	for (i = 0; i < size; i++)
+		have[i] = want[i] = rand();
+	for (i = 0; i < size / 4096; i++)
+		want[rand() % size] ^= 1 << (rand() % 8);
+	ret |= bench("update", have, want, size);
+
+	free(have);
+	free(want);
+	return ret;
+}
@@ -0,0 +1,203 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Check of the ICH SPI code against the ICH controller model of the dummy
+ * programmer. Every command goes through the emulated opcode menu, address
+ * and data registers to an emulated W25Q32. The chip starts with a pattern
+ * which depends on the address, and its image is compared with the expected
+ * contents afterwards, so wrong opcode slots, addresses or data offsets show
+ * up. More distinct opcodes than the menu holds are used to exercise slot
+ * replacement.
+ *
+ * Run with "make check".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../flash.h"
+#include "../flashchips.h"
+#include "../chipdrivers.h"
+#include "../programmer.h"
+#include "../spi.h"
+
+#if CONFIG_DUMMY == 1 && CONFIG_INTERNAL == 1 && \
+    (defined(__i386__) || defined(__x86_64__))
+
+#define CHECK_SIZE	(4 * 1024 * 1024)
+#define CHECK_SECTOR	0x123000
+#define CHECK_PAGE	0x123400
+#define CHECK_BLOCK	0x200000
+
+static const char *generation = "";
+static uint8_t expected[CHECK_SIZE];
+static uint8_t image[CHECK_SIZE];
+
+static int fail(const char *what)
+{
+	printf("ICH%s: %s failed\n", generation, what);
+	return 1;
+}
+
+static int check_rdid(void)
+{
+	const unsigned char cmd[] = { JEDEC_RDID };
+	unsigned char id[JEDEC_RDID_INSIZE];
+
+	if (spi_send_command(sizeof(cmd), sizeof(id), cmd, id))
+		return fail("RDID");
+	if (id[0] != 0xef || id[1] != 0x40 || id[2] != 0x16)
+		return fail("RDID answer");
+	return 0;
+}
+
+/* Read @len bytes at @addr with a single READ command. */
+static int check_read(unsigned int addr, int len)
+{
+	const unsigned char cmd[] = { JEDEC_READ, (addr >> 16) & 0xff,
+				      (addr >> 8) & 0xff, addr & 0xff };
+	unsigned char buf[64];
+
+	if (spi_send_command(sizeof(cmd), len, cmd, buf))
+		return fail("READ");
+	if (memcmp(buf, expected + addr, len))
+		return fail("READ answer");
+	return 0;
+}
+
+/* Commands the emulated chip doesn't answer, they only occupy menu slots. */
+static int check_filler(unsigned char opcode)
+{
+	const unsigned char cmd[] = { opcode, 0, 0, 0 };
+	unsigned char buf[2];
+
+	if (spi_send_command(sizeof(cmd), sizeof(buf), cmd, buf))
+		return fail("filler command");
+	return 0;
+}
+
+static int check_generation(struct flashchip *flash, int gen,
+			    const char *path)
+{
+	static const unsigned char fillers[] = { JEDEC_REMS, JEDEC_RES, 0x0b,
+						 0x4b, 0x5a, 0x35, 0x48 };
+	static uint8_t page[256], buf[0x300];
+	char param[128];
+	int i, round, ret = 0;
+
+	generation = (gen == 7) ? "7" : "9";
+	for (i = 0; i < CHECK_SIZE; i++)
+		expected[i] = i ^ (i >> 8) ^ (i >> 16);
+	if (write_buf_to_file(expected, CHECK_SIZE, (char *)path))
+		return fail("writing the image");
+	for (i = 0; i < sizeof(page); i++)
+		page[i] = i ^ 0x5a;
+
+	programmer = PROGRAMMER_DUMMY;
+	snprintf(param, sizeof(param), "bus=spi,emulate=W25Q32,ich=%i,"
+		 "image=%s", gen, path);
+	if (programmer_init(param))
+		return fail("programmer_init");
+
+	ret |= check_rdid();
+	ret |= check_read(0x000000, 64);
+	ret |= check_read(0x3fffc0, 64);
+	ret |= check_read(CHECK_PAGE + 0x35, 17);
+
+	if (spi_block_erase_20(flash, CHECK_SECTOR, 4096))
+		ret |= fail("sector erase");
+	memset(expected + CHECK_SECTOR, 0xff, 4096);
+	if (spi_chip_write_256(flash, page, CHECK_PAGE, sizeof(page)))
+		ret |= fail("page program");
+	memcpy(expected + CHECK_PAGE, page, sizeof(page));
+	/* The ICH transfers at most 64 bytes, so this reads in chunks. */
+	if (spi_chip_read(flash, buf, CHECK_PAGE - 0x100, sizeof(buf)))
+		ret |= fail("chunked read");
+	if (memcmp(buf, expected + CHECK_PAGE - 0x100, sizeof(buf)))
+		ret |= fail("chunked read answer");
+
+	/* Evict and reload the RDID and READ slots a few times. */
+	for (round = 0; round < 3 && !ret; round++) {
+		for (i = 0; i < sizeof(fillers); i++) {
+			ret |= check_filler(fillers[i]);
+			ret |= check_rdid();
+			ret |= check_read(CHECK_PAGE + i * 16, 16);
+		}
+	}
+
+	if (spi_block_erase_d8(flash, CHECK_BLOCK, 64 * 1024))
+		ret |= fail("block erase");
+	memset(expected + CHECK_BLOCK, 0xff, 64 * 1024);
+	ret |= check_read(CHECK_BLOCK - 32, 64);
+
+	programmer_shutdown();
+
+	/* Everything must have ended up at the right address. */
+	if (read_buf_from_file(image, CHECK_SIZE, (char *)path))
+		return fail("reading the image");
+	for (i = 0; i < CHECK_SIZE; i++)
+		if (image[i] != expected[i])
+			break;
+	if (i < CHECK_SIZE) {
+		printf("ICH%s: chip contents differ at 0x%06x\n", generation,
+		       i);
+		ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct flashchip *chip, flash;
+	char path[] = "/tmp/ichcheck.XXXXXX";
+	int fd, ret = 0;
+
+	for (chip = flashchips; chip->name; chip++)
+		if (!strcmp(chip->name, "W25Q32"))
+			break;
+	if (!chip->name) {
+		printf("W25Q32 is missing from the chip table\n");
+		return 1;
+	}
+	flash = *chip;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	ret |= check_generation(&flash, 7, path);
+	ret |= check_generation(&flash, 9, path);
+	unlink(path);
+	printf("Checked the emulated ICH7 and ICH9 SPI controllers: %s\n",
+	       ret ? "FAILED" : "OK");
+	return ret;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+	printf("ICH SPI emulation is not built, skipping the check\n");
+	return 0;
+}
+
+#endif
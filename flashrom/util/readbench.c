@@ -0,0 +1,123 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Micro-benchmark for reading memory mapped flash with wide_chip_readn() from
+ * programmer.c. A buffer in RAM stands in for the mapped chip, like the dummy
+ * programmer does, so the numbers show the CPU side cost per access width.
+ * On a real LPC/FWH bus every load is a bus cycle, so fewer and wider loads
+ * gain a lot more there.
+ *
+ * Build with "make readbench", run as "util/readbench [size in MiB]".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../flash.h"
+#include "../programmer.h"
+
+/* Direct memory accesses, like the internal programmer. */
+uint8_t chip_readb(const chipaddr addr)
+{
+	return *(volatile uint8_t *)addr;
+}
+
+uint16_t chip_readw(const chipaddr addr)
+{
+	return *(volatile uint16_t *)addr;
+}
+
+void chip_writeb(uint8_t val, chipaddr addr)
+{
+	*(volatile uint8_t *)addr = val;
+}
+
+void chip_writew(uint16_t val, chipaddr addr)
+{
+	*(volatile uint16_t *)addr = val;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, double secs, int size, int passes,
+		   uint8_t *buf, uint8_t *chip)
+{
+	printf("%-22s %9.1f MB/s%s\n", name, size / 1e6 * passes / secs,
+	       memcmp(buf, chip, size) ? "  MISMATCH" : "");
+}
+
+int main(int argc, char *argv[])
+{
+	static const int widths[] = { 1, 2, 4, 8 };
+	uint8_t *chip, *buf;
+	int size, passes = 8, i, j;
+	char name[32];
+	double t;
+
+	size = ((argc > 1) ? atoi(argv[1]) : 16) * 1024 * 1024;
+	if (size <= 0) {
+		fprintf(stderr, "Usage: %s [size in MiB]\n", argv[0]);
+		return 1;
+	}
+	chip = malloc(size);
+	buf = malloc(size);
+	if (!chip || !buf) {
+		fprintf(stderr, "Out of memory!\n");
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < size; i++)
+		chip[i] = rand();
+
+	memset(buf, 0, size);
+	t = now();
+	for (j = 0; j < passes; j++)
+		fallback_chip_readn(buf, (chipaddr)chip, size);
+	report("fallback_chip_readn", now() - t, size, passes, buf, chip);
+
+	memset(buf, 0, size);
+	t = now();
+	for (j = 0; j < passes; j++)
+		memcpy(buf, chip, size);
+	report("memcpy", now() - t, size, passes, buf, chip);
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		memset(buf, 0, size);
+		t = now();
+		/* Start one byte in to include the unaligned head. */
+		for (j = 0; j < passes; j++) {
+			wide_chip_readn(buf, (chipaddr)chip, 1, widths[i]);
+			wide_chip_readn(buf + 1, (chipaddr)chip + 1, size - 1,
+					widths[i]);
+		}
+		snprintf(name, sizeof(name), "wide_chip_readn(%i)", widths[i]);
+		report(name, now() - t, size, passes, buf, chip);
+	}
+
+	free(buf);
+	free(chip);
+	return 0;
+}
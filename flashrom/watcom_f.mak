@@ -8,7 +8,7 @@ CHIP_OBJS = jedec.o stm50flw0x0x.o w39.o w29ee011.o &
             sst49lfxxxc.o sst_fwhub.o flashchips.o &
             spi.o spi25.o sharplhf00l04.o
 
-LIB_OBJS = layout.o util.o
+LIB_OBJS = layout.o memdiff.o util.o
 
 CLI_OBJS = flashrom.o cli_classic.o cli_output.o print.o
 
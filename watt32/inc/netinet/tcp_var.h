@@ -358,6 +358,10 @@ struct  tcpstat {
         u_long  tcps_badsyn;            /* bogus SYN, e.g. premature ACK */
         u_long  tcps_mturesent;         /* resends due to MTU discovery */
         u_long  tcps_listendrop;        /* listen queue overflows */
+        u_long  tcps_rttcachemiss;      /* RTT cache lookups that missed */
+        u_long  tcps_rttcachedrop;      /* RTT cache entries replaced */
+        u_long  tcps_rcvzcqueue;        /* read straight from receive queue */
+        u_long  tcps_rcvzcrecv;         /* read by sock_recv_zc() */
 
 #ifdef TCP_FACK
        /* NOTE: This may break some programs that rely on this structure
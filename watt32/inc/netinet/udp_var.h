@@ -76,6 +76,8 @@ struct  udpstat {
         u_long  udps_fullsock;          /* not delivered, input socket full */
         u_long  udpps_pcbcachemiss;     /* input packets missing pcb cache */
         u_long  udpps_pcbhashmiss;      /* input packets not for hashed pcb */
+        u_long  udps_zcqueue;           /* read straight from receive queue */
+        u_long  udps_zcrecv;            /* read by sock_recv_zc() */
                                 /* output statistics: */
         u_long  udps_opackets;          /* total output packets */
 };
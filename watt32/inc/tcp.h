@@ -118,11 +118,11 @@ typedef int (*UserHandler)  (void *sock);
 
 
 typedef struct {
-        BYTE   undoc [4470];
+        BYTE   undoc [4560];
       } tcp_Socket;
 
 typedef struct {
-        BYTE   undoc [1740];
+        BYTE   undoc [1750];
       } udp_Socket;
 
 
@@ -242,6 +242,8 @@ W32_FUNC int    sock_recv       (void *s, char *buf, unsigned len);
 W32_FUNC int    sock_recv_init  (void *s, char *buf, unsigned len);
 W32_FUNC int    sock_recv_from  (void *s, DWORD *ip, WORD *port, char *buf, unsigned len, int peek);
 W32_FUNC int    sock_recv_used  (void *s);
+W32_FUNC int    sock_recv_zc    (void *s, const void **data, DWORD *ip, WORD *port);
+W32_FUNC int    sock_release_zc (void *s, const void *data);
 W32_FUNC int    sock_keepalive  (void *s);
 
 W32_FUNC size_t sock_rbsize     (const void *s);
@@ -749,6 +751,8 @@ W32_FUNC void reset_stats      (void);
 #if !defined(WATT32_BUILD)
 W32_FUNC int sock_stats (void *s, DWORD *days, WORD *inactive,
                          WORD *cwindow, DWORD *avg,  DWORD *sd);
+W32_FUNC int sock_cc_stats (void *s, DWORD *cwnd, DWORD *ssthresh,
+                            DWORD *fast_rexmit);
 #endif
 
 
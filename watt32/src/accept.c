@@ -474,6 +474,9 @@ int _sock_append (_tcp_Socket **tcp)
    * be set to parent's Tx buffer.
    */
   memcpy (clone, orig, sizeof(*clone));
+  clone->hash_next   = NULL;
+  clone->hash_slot   = 0;
+  memset (&clone->timer, 0, sizeof(clone->timer));
   clone->tx_data     = &clone->tx_buf[0];
   clone->tx_datalen  = 0;
   clone->max_tx_data = sizeof (clone->tx_buf) - 1;
@@ -504,9 +507,11 @@ int _sock_append (_tcp_Socket **tcp)
   orig->send_next = INIT_SEQ();   /* set new ISS */
   orig->unhappy   = FALSE;
   CLR_PEER_MAC_ADDR (orig);
+  _tcp_rehash (orig);           /* back to the listening buckets */
 
   clone->next  = _tcp_allsocs;
   _tcp_allsocs = clone;         /* prepend clone to TCB-list */
+  _tcp_hash_insert (clone);
   *tcp = clone;                 /* the new TCB is now the clone */
   return (1);
 }
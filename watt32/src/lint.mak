@@ -35,9 +35,9 @@ SOURCES = accept.c   adr2asc.c  asc2adr.c  bind.c     bsddbug.c  bsdname.c  \
           res_send.c select.c   settod.c   shutdown.c signal.c   sock_dbu.c \
           sock_in.c  sock_ini.c sock_io.c  sock_prn.c sock_scn.c sock_sel.c \
           socket.c   sockopt.c  split.c    stream.c   strings.c  syslog.c   \
-          syslog2.c  tcp_fsm.c  tftp.c     timer.c    transmit.c udp_dom.c  \
-          udp_nds.c  udp_rev.c  version.c  w32pcap.c  wdpmi.c    x32vm.c    \
-          rs232.c
+          syslog2.c  tcp_cc.c   tcp_fsm.c  tftp.c     timer.c    transmit.c \
+          udp_dom.c  udp_nds.c  udp_rev.c  version.c  w32pcap.c  wdpmi.c    \
+          x32vm.c    rs232.c
 
 LFILES = $(SOURCES:.c=.lnt)
 
@@ -800,6 +800,7 @@ static const struct config_table normal_cfg[] = {
        { "TCP.MTU_DISCOVERY",   ARG_ATOI, (void*)&mtu_discover      },
        { "TCP.BLACKHOLE_DETECT",ARG_ATOI, (void*)&mtu_blackhole     },
        { "TCP.RECV_WIN",        ARG_FUNC, (void*)set_recv_win       },
+       { "TCP.RTT_CACHE",       ARG_ATOI, (void*)&tcp_rtt_size      },
 #endif
        { NULL, 0, NULL }
      };
@@ -1712,13 +1712,13 @@ static int tcp_dump (const _tcp_Socket *sock, const in_Header *ip)
 
     dbug_printf ("       %-8.8s (dSEQ %10ld, dACK %10ld), MS %ld/%ld%s%s\n"
                  "       RCV.NXT %lu, SND.NXT %lu, SND.UNA %ld\n"
-                 "       KC %d, vjSA %lu, vjSD %lu, CW %d, WW %d, RTO %d, ",
+                 "       KC %d, vjSA %lu, vjSD %lu, CW %u, SST %u, RTO %d, ",
                  tcpStateName(state), delta_seq, delta_ack, ms_left, ms_right,
                  in_seq_space  ? ", in-SEQ"  : "",
                  sock->unhappy ? ", Unhappy" : "",
                  sock->recv_next, sock->send_next, sock->send_una,
                  sock->karn_count, sock->vj_sa, sock->vj_sd,
-                 sock->cwindow, sock->wwindow, sock->rto);
+                 sock->cwindow, sock->ssthresh, sock->rto);
     dbug_printf ("RTT-diff %s\n", RTT_str(sock->rtt_time, now));
   }
 
@@ -1743,6 +1743,7 @@ int DHCP_read_config (void)
     TRACE (("DHCP: config too old.\n"));
     sock->udp.myaddr = 0;
     sock->udp.hisaddr = IP_BCAST_ADDR;
+    _udp_rehash (&sock->udp);
   }
 
   /* Reading config failed or timers expired; must do the whole
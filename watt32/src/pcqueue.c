@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stddef.h>
 
 #include "wattcp.h"
@@ -76,6 +77,11 @@ int pktq_init (struct pkt_ringbuf *q, int size, int num, char *buf)
 #if (DOSX & DOS4GW)
   q->dos_ofs = 0;   /* must be set manually */
 #endif
+#if defined(PKTQ_LEND)
+  q->rd_index = 0;
+  q->num_lent = 0;
+  memset (q->lent, 0, sizeof(q->lent));
+#endif
 
 #if defined(USE_DEBUG)
   WATT_ASSERT (size > 0);
@@ -105,15 +111,41 @@ int pktq_inc_in (struct pkt_ringbuf *q)
   return (q->in_index);
 }
 
+#if defined(PKTQ_LEND)
+/*
+ * Give the buffers before 'rd_index' back to the producer.
+ * Stop at the first one still lent.
+ */
+static void pktq_give_back (struct pkt_ringbuf *q)
+{
+  while (q->out_index != q->rd_index && !q->lent[q->out_index])
+  {
+    WORD index = q->out_index + 1;
+
+    if (index >= q->num_buf)
+        index = 0;
+    q->out_index = index;   /* producer may look at it any time */
+  }
+}
+#endif
+
 /*
  * Increment the queue 'out_index' (tail).
- * Check for wraps.
+ * Check for wraps. If buffers are lent, only the read index
+ * is incremented.
  */
 int pktq_inc_out (struct pkt_ringbuf *q)
 {
+#if defined(PKTQ_LEND)
+  q->rd_index++;
+  if (q->rd_index >= q->num_buf)
+      q->rd_index = 0;
+  pktq_give_back (q);
+#else
   q->out_index++;
   if (q->out_index >= q->num_buf)
       q->out_index = 0;
+#endif
   return (q->out_index);
 }
 
@@ -145,7 +177,11 @@ char *pktq_in_buf (struct pkt_ringbuf *q)
  */
 char *pktq_out_buf (struct pkt_ringbuf *q)
 {
+#if defined(PKTQ_LEND)
+  return ((char*)q->buf_start + (q->buf_size * q->rd_index));
+#else
   return ((char*)q->buf_start + (q->buf_size * q->out_index));
+#endif
 }
 
 
@@ -164,7 +200,11 @@ void pktq_clear (struct pkt_ringbuf *q)
   ARGSUSED (q);
 #else
   DISABLE();
+#if defined(PKTQ_LEND)
+  q->in_index = q->rd_index;   /* keep the lent buffers */
+#else
   q->in_index = q->out_index;
+#endif
   ENABLE();
 #endif
 }
@@ -175,7 +215,11 @@ void pktq_clear (struct pkt_ringbuf *q)
  */
 int pktq_queued (struct pkt_ringbuf *q)
 {
+#if defined(PKTQ_LEND)
+  register int index = q->rd_index;
+#else
   register int index = q->out_index;
+#endif
   register int num   = 0;
 
   DISABLE();
@@ -190,6 +234,52 @@ int pktq_queued (struct pkt_ringbuf *q)
   return (num);
 }
 
+#if defined(PKTQ_LEND)
+/*
+ * Lend the tail-buffer to the caller. pktq_inc_out() will not give
+ * it back to the producer before pktq_release() is called for it.
+ * Buffers after it can't be reused meanwhile; so don't keep it long.
+ */
+char *pktq_lend (struct pkt_ringbuf *q)
+{
+  WATT_ASSERT (q->rd_index < DIM(q->lent));
+
+  q->lent [q->rd_index]++;
+  q->num_lent++;
+  return pktq_out_buf (q);
+}
+
+/*
+ * Release a buffer lent by pktq_lend().
+ */
+void pktq_release (struct pkt_ringbuf *q, const char *buf)
+{
+  unsigned index = (unsigned) ((buf - (char*)q->buf_start) / q->buf_size);
+
+  WATT_ASSERT (index < q->num_buf && q->lent[index] > 0);
+
+  if (index >= q->num_buf || !q->lent[index])
+     return;
+
+  q->lent [index]--;
+  q->num_lent--;
+  pktq_give_back (q);
+}
+
+/*
+ * Return number of buffers the producer can still fill.
+ * Lent buffers and those after them are in use.
+ */
+int pktq_room (struct pkt_ringbuf *q)
+{
+  int used = q->in_index - q->out_index;
+
+  if (used < 0)
+     used += q->num_buf;
+  return (q->num_buf - 1 - used);
+}
+#endif  /* PKTQ_LEND */
+
 
 #if defined(USE_FAST_PKT) && !defined(WIN32)
 
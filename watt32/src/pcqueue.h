@@ -43,6 +43,14 @@
 
 #define PKTQ_MARKER  0xDEAFBABE
 
+/*
+ * Buffers can be lent out (see pktq_lend()) if the queue is in near
+ * memory and the struct isn't shared with asmpkt4.asm.
+ */
+#if !defined(USE_FAST_PKT) && !(DOSX & DOS4GW)
+  #define PKTQ_LEND
+#endif
+
 
 /*
  * asmpkt4.asm depends on these structs beeing packed
@@ -88,6 +96,11 @@ struct pkt_ringbuf {
 #if (DOSX & (DOS4GW|POWERPAK)) || defined(USE_FAST_PKT)
        WORD           dos_ofs;    /* offset of pool, used by rmode stub */
 #endif                            /* total size = 26 for DOS4GW/POWERPAK */
+#if defined(PKTQ_LEND)
+       WORD           rd_index;   /* next buffer to poll, out_index if none lent */
+       WORD           num_lent;   /* number of buffers lent */
+       BYTE           lent [RX_BUFS]; /* times each buffer is lent */
+#endif
      };
 
 #if (DOSX & DOS4GW) || defined(USE_FAST_PKT)
@@ -105,6 +118,12 @@ extern char *pktq_in_buf   (struct pkt_ringbuf *q);
 extern char *pktq_out_buf  (struct pkt_ringbuf *q);
 extern int   pktq_queued   (struct pkt_ringbuf *q);
 
+#if defined(PKTQ_LEND)
+  extern char *pktq_lend    (struct pkt_ringbuf *q);
+  extern void  pktq_release (struct pkt_ringbuf *q, const char *buf);
+  extern int   pktq_room    (struct pkt_ringbuf *q);
+#endif
+
 #if defined(USE_FAST_PKT) && !defined(WIN32)
   extern DWORD asmpkt_rm_base;
 
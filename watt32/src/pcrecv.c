@@ -2,6 +2,11 @@
  *
  * Alternative socket receive handlers (see Waterloo manual).
  *
+ * sock_recv_init() sets up a pool of buffers for UDP datagrams. TCP
+ * data is kept in the space given as a byte stream. After sock_recv_zc()
+ * is first called on a socket, TCP segments go in the pool too, and new
+ * data is left in the packet receive queue when possible (see
+ * _eth_lend()) and handed to the application without copying.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,17 +19,119 @@
 #include "misc.h"
 #include "pcsed.h"
 #include "pcbuf.h"
+#include "pcstat.h"
 #include "pctcp.h"
 #include "pcrecv.h"
 
 #define RECV_USED    0xF7E3D2B1L
 #define RECV_UNUSED  0xE6D2C1AFL
+#define RECV_LENT    0xD5C1B09EL   /* handed out by sock_recv_zc() */
 
 /* UDP "sequence number" for finding the oldest packet.
  * Newest received has higher 'p->buf_seqnum' number
  */
 static long seq_num = 0;
 
+/*
+ * Mark 'p' unused. Give a lent packet back to the receive queue.
+ */
+static void recv_free (recv_buf *p)
+{
+  if (p->buf_pkt)
+     _eth_lend_free (p->buf_pkt);
+  p->buf_pkt = NULL;
+  p->buf_sig = RECV_UNUSED;
+}
+
+/*
+ * Copy the data of 'p' from the receive queue to 'p->buf_data' and
+ * give the packet back.
+ */
+static void recv_copy_out (recv_buf *p)
+{
+  if (p->buf_len > 0)
+     memcpy (p->buf_data, p->buf_ptr, p->buf_len);
+  _eth_lend_free (p->buf_pkt);
+  p->buf_pkt = NULL;
+  p->buf_ptr = p->buf_data;
+}
+
+/*
+ * Copy data still in the receive queue to our own buffers and give
+ * the packets back. Not those handed out by sock_recv_zc().
+ */
+static void recv_unlend (recv_data *r)
+{
+  recv_buf *p = (recv_buf*) r->recv_bufs;
+  int       i;
+
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+      if (p->buf_sig == RECV_USED && p->buf_pkt)
+         recv_copy_out (p);
+}
+
+/*
+ * Store 'len' bytes of 'data' in 'p'. Leave it in the packet
+ * receive queue if sock_recv_zc() is used, else copy it.
+ */
+static void recv_store (recv_data *r, recv_buf *p,
+                        const void *data, unsigned len)
+{
+  p->buf_pkt = NULL;
+  p->buf_ptr = p->buf_data;
+  if (len == 0)
+     return;
+
+  if (r->recv_zc)
+  {
+    p->buf_pkt = _eth_lend (data);
+    if (p->buf_pkt)
+    {
+      p->buf_ptr = (const BYTE*) data;
+      return;
+    }
+    recv_unlend (r);   /* the queue may be filling up */
+  }
+  memcpy (p->buf_data, data, len);
+}
+
+#if !defined(USE_UDP_ONLY)
+/*
+ * With TCP segments in the pool, the receive window follows the free
+ * buffers rather than the bytes held. Each buffer in use counts as at
+ * least its share of 'max_rx_data', so the window is closed when all
+ * are in use, however small the segments were.
+ */
+static void tcp_pool_window (_tcp_Socket *t, const recv_data *r)
+{
+  const recv_buf *p = (const recv_buf*) r->recv_bufs;
+  unsigned share = t->max_rx_data / r->recv_bufnum;
+  unsigned used  = 0;
+  int      i, num = 0;
+
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+      if (p->buf_sig != RECV_UNUSED)
+      {
+        used += max (share, (unsigned)p->buf_len);
+        num++;
+      }
+  if (num == r->recv_bufnum || used > t->max_rx_data)
+     used = t->max_rx_data;
+  t->rx_datalen = (int) used;
+}
+
+/*
+ * Data was taken from 't'. Let the peer know the window opened,
+ * like tcp_read() does.
+ */
+static void tcp_recv_taken (_tcp_Socket *t, const recv_data *r)
+{
+  if (r->recv_zc)
+     tcp_pool_window (t, r);
+  TCP_SENDSOON (t);
+}
+#endif
+
 /*
  * Gets upcalled when data arrives.
  * We MUST set 'p->buf_len = -1' to signal a 0-byte UDP packet
@@ -53,6 +160,7 @@ static int sock_recvdaemon (sock_type *s, const void *data, unsigned len,
              switch (p->buf_sig)
              {
                case RECV_USED:
+               case RECV_LENT:
                     break;
                case RECV_UNUSED:  /* take this one */
                     p->buf_sig     = RECV_USED;
@@ -67,13 +175,10 @@ static int sock_recvdaemon (sock_type *s, const void *data, unsigned len,
 #endif
                        p->buf_hisip = ph->src;
                     len = min (len, sizeof(p->buf_data));
+                    recv_store (r, p, data, len);
                     if (len > 0)
-                    {
-                      memcpy (p->buf_data, data, len);
-                      p->buf_len = (short) len;
-                    }
-                    else
-                      p->buf_len = -1;  /* a 0-byte probe */
+                         p->buf_len = (short) len;
+                    else p->buf_len = -1;  /* a 0-byte probe */
 #if 0
                     SOCK_DEBUGF (("\nsock_recvdaemon(): buffer %d, "
                                   "seq-num %ld, len %d",
@@ -92,23 +197,52 @@ static int sock_recvdaemon (sock_type *s, const void *data, unsigned len,
            _tcp_Socket *t = &s->tcp;
 
            r = (recv_data*) t->rx_data;
+           p = (recv_buf*) r->recv_bufs;
 
            if (r->recv_sig != RECV_USED)
            {
              outsnl (_LANG("ERROR: tcp recv data conflict"));
              return (0);
            }
-           /* stick it on the end if you can
+           if (!r->recv_zc)
+           {
+             /* stick it on the end if you can
+              */
+             i = t->max_rx_data - t->rx_datalen;
+             if (i > 1)
+             {
+               /* we can accept some of this */
+               if (len > i)
+                   len = i;
+               if (len > 0)
+                  memcpy (r->recv_bufs + t->rx_datalen, data, len);
+               t->rx_datalen += len;
+               return (len);
+             }
+             return (0);   /* didn't take none */
+           }
+
+           /* take the whole segment if a buffer is free
             */
-           i = t->max_rx_data - t->rx_datalen;
-           if (i > 1)
+           if (len == 0 || len > sizeof(p->buf_data))
+              return (0);
+
+           for (i = 0; i < r->recv_bufnum; i++, p++)
            {
-             /* we can accept some of this */
-             if (len > i)
-                 len = i;
-             if (len > 0)
-                memcpy (r->recv_bufs + t->rx_datalen, data, len);
-             t->rx_datalen += len;
+             if (p->buf_sig != RECV_UNUSED)
+                continue;
+             p->buf_sig     = RECV_USED;
+             p->buf_hisport = intel16 (t->hisport);
+             p->buf_seqnum  = seq_num++;
+#if defined(USE_IPV6)
+             if (t->is_ip6)
+                memcpy (&p->buf_hisip6, &t->his6addr, sizeof(p->buf_hisip6));
+             else
+#endif
+                p->buf_hisip = intel (t->hisaddr);
+             recv_store (r, p, data, len);
+             p->buf_len = (short) len;
+             tcp_pool_window (t, r);
              return (len);
            }
            return (0);   /* didn't take none */
@@ -118,6 +252,241 @@ static int sock_recvdaemon (sock_type *s, const void *data, unsigned len,
   return (0);
 }
 
+/*
+ * Return the receive data of 's' if it may hold lent packets.
+ */
+static recv_data *recv_lending (const sock_type *s)
+{
+  recv_data *r = (recv_data*) s->udp.rx_data;
+
+  if (s->udp.protoHandler != (ProtoHandler)sock_recvdaemon ||
+      !r || r->recv_sig != RECV_USED || !r->recv_zc)
+     return (NULL);
+  return (r);
+}
+
+/*
+ * Called by _eth_arrived() when lent packets block the receive queue.
+ * Copy out those still queued in any socket.
+ */
+static void recv_unlend_all (void)
+{
+  const _udp_Socket *u;
+  recv_data         *r;
+
+  for (u = _udp_allsocs; u; u = u->next)
+      if ((r = recv_lending((const sock_type*)u)) != NULL)
+         recv_unlend (r);
+
+#if !defined(USE_UDP_ONLY)
+  {
+    const _tcp_Socket *t;
+
+    for (t = _tcp_allsocs; t; t = t->next)
+        if ((r = recv_lending((const sock_type*)t)) != NULL)
+           recv_unlend (r);
+  }
+#endif
+}
+
+/**
+ * Called when 's' is closed or set up again. Give packets lent by
+ * _eth_lend() back to the receive queue. Data handed out by
+ * sock_recv_zc() is no longer valid after this.
+ */
+void _sock_recv_exit (const sock_type *s)
+{
+  recv_data *r = recv_lending (s);
+  recv_buf  *p;
+  int        i;
+
+  if (!r)
+     return;
+
+  recv_unlend (r);
+
+  p = (recv_buf*) r->recv_bufs;
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+      if (p->buf_sig == RECV_LENT && p->buf_pkt)
+      {
+        _eth_lend_free (p->buf_pkt);
+        p->buf_pkt = NULL;
+      }
+}
+
+/*
+ * Return the oldest queued buffer received after 'after'
+ * (a 'buf_seqnum', -1 for any), or NULL if none.
+ */
+static recv_buf *recv_oldest (const sock_type *s, recv_data *r, long after)
+{
+  recv_buf *p = (recv_buf*) r->recv_bufs;
+  recv_buf *oldest = NULL;
+  long      seqnum = LONG_MAX;
+  int       i;
+
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+  {
+    switch (p->buf_sig)
+    {
+      case RECV_UNUSED:
+      case RECV_LENT:
+           break;
+
+      case RECV_USED:
+           /* Drop looped packets sent by us (running
+            * under Win32 DOS box using NDIS3PKT or SwsVpkt).
+            */
+           if ((_eth_ndis3pkt || _eth_SwsVpkt) &&
+               s->udp.ip_type == UDP_PROTO &&
+               !s->udp.is_ip6 && p->buf_hisip == intel(my_ip_addr))
+           {
+             recv_free (p);
+             continue;
+           }
+           if (p->buf_seqnum > after &&
+               p->buf_seqnum < seqnum)  /* ignore wraps */
+           {
+             seqnum = p->buf_seqnum;
+             oldest = p;
+           }
+           break;
+
+      default:
+           outsnl (_LANG("ERROR: sock_recv_init data err"));
+           return (NULL);
+    }
+  }
+  return (oldest);
+}
+
+/*
+ * Return the sender of 'p'.
+ */
+static void recv_peer (const sock_type *s, const recv_buf *p,
+                       void *hisip, WORD *hisport)
+{
+#if defined(USE_IPV6)
+  if (s->udp.is_ip6)
+  {
+    if (hisip)
+       memcpy (hisip, &p->buf_hisip6, sizeof(ip6_address));
+  }
+  else
+#endif
+  if (hisip)
+     *(DWORD*)hisip = p->buf_hisip;
+
+  if (hisport)
+     *hisport = p->buf_hisport;
+  ARGSUSED (s);
+}
+
+#if !defined(USE_UDP_ONLY)
+/*
+ * Copy up to 'len' bytes of received TCP data to 'buffer'.
+ * Skip flat data handed out by sock_recv_zc().
+ */
+static int tcp_recv (_tcp_Socket *t, recv_data *r, BYTE *buffer,
+                     unsigned len, int peek)
+{
+  recv_buf *p;
+  unsigned  total = 0;
+  long      after = -1;
+
+  if (!r->recv_zc)
+  {
+    BYTE    *start = r->recv_bufs + r->recv_flatlen;
+    unsigned avail = t->rx_datalen - r->recv_flatlen;
+
+    len = min (len, avail);
+    if (len > 0)
+       memcpy (buffer, start, len);
+    if (len > 0 && !peek)
+    {
+      t->rx_datalen -= len;
+      memmove (start, start + len, avail - len);
+      tcp_recv_taken (t, r);
+    }
+    return (len);
+  }
+
+  while (total < len &&
+         (p = recv_oldest((const sock_type*)t, r, after)) != NULL)
+  {
+    unsigned size = min (len - total, (unsigned)p->buf_len);
+
+    memcpy (buffer + total, p->buf_ptr, size);
+    total += size;
+
+    if (peek)
+    {
+      after = p->buf_seqnum;
+      continue;
+    }
+    if (size < (unsigned)p->buf_len)
+    {
+      p->buf_ptr += size;
+      p->buf_len -= (short) size;
+    }
+    else
+    {
+      if (p->buf_pkt)
+         STAT (tcpstats.tcps_rcvzcqueue++);
+      recv_free (p);
+    }
+  }
+  if (total > 0 && !peek)
+     tcp_recv_taken (t, r);
+  return (total);
+}
+
+/*
+ * Zero-copy receive on a TCP socket still using the flat buffer.
+ * Hand out all data in it, or set it up as a pool of buffers if
+ * it's empty.
+ */
+static int tcp_recv_flat_zc (_tcp_Socket *t, recv_data *r, const void **data,
+                             void *hisip, WORD *hisport)
+{
+  recv_buf *p = (recv_buf*) r->recv_bufs;
+  int       i;
+
+  if (t->rx_datalen > 0)
+  {
+    if (r->recv_flatlen)   /* not released yet */
+       return (0);
+
+    r->recv_flatlen = (WORD) t->rx_datalen;
+    *data = r->recv_bufs;
+#if defined(USE_IPV6)
+    if (t->is_ip6)
+    {
+      if (hisip)
+         memcpy (hisip, &t->his6addr, sizeof(ip6_address));
+    }
+    else
+#endif
+    if (hisip)
+       *(DWORD*)hisip = intel (t->hisaddr);
+
+    if (hisport)
+       *hisport = intel16 (t->hisport);
+    STAT (tcpstats.tcps_rcvzcrecv++);
+    return (r->recv_flatlen);
+  }
+
+  if (r->recv_flatlen || r->recv_bufnum == 0)
+     return (0);
+
+  memset (p, 0, r->recv_bufnum * sizeof(*p));
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+      p->buf_sig = RECV_UNUSED;
+  r->recv_zc = TRUE;
+  tcp_pool_window (t, r);
+  return (0);
+}
+#endif
 
 int sock_recv_used (const sock_type *s)
 {
@@ -142,9 +511,16 @@ int sock_recv_used (const sock_type *s)
 #if !defined(USE_UDP_ONLY)
     case VALID_TCP:
          r = (const recv_data*) s->tcp.rx_data;
+         p = (const recv_buf*) r->recv_bufs;
          if (r->recv_sig != RECV_USED)
             return (-1);
-         return (s->tcp.rx_datalen);
+         if (!r->recv_zc)
+            return (s->tcp.rx_datalen);
+
+         for (i = len = 0; i < r->recv_bufnum; i++, p++)
+             if (p->buf_sig != RECV_UNUSED)
+                len += p->buf_len;
+         return (len);
 #endif
   }
   return (0);
@@ -158,6 +534,7 @@ int sock_recv_init (sock_type *s, void *space, unsigned len)
   int i;
 
   WATT_ASSERT ((DWORD)len <= USHRT_MAX);
+  _sock_recv_exit (s);                /* if set up before */
   memset (r, 0, s->udp.max_rx_data);  /* clear Rx-buffer */
   memset (p, 0, len);                 /* clear data area */
 
@@ -175,13 +552,8 @@ int sock_recv_init (sock_type *s, void *space, unsigned len)
 int sock_recv_from (sock_type *s, void *hisip, WORD *hisport,
                     void *buffer, unsigned len, int peek)
 {
-#if !defined(USE_UDP_ONLY)
-  _tcp_Socket *t;
-#endif
-  recv_buf    *p, *oldest = NULL;
-  recv_data   *r = (recv_data*) s->udp.rx_data;
-  long seqnum = LONG_MAX;
-  int  i;
+  recv_buf  *p;
+  recv_data *r = (recv_data*) s->udp.rx_data;
 
   if (r->recv_sig != RECV_USED)
   {
@@ -194,86 +566,40 @@ int sock_recv_from (sock_type *s, void *hisip, WORD *hisport,
   switch (s->udp.ip_type)
   {
     case UDP_PROTO:
-         p = (recv_buf*) r->recv_bufs;
-
          /* find the oldest used UDP buffer.
           */
-         for (i = 0; i < r->recv_bufnum; i++, p++)
-         {
-           switch (p->buf_sig)
-           {
-             case RECV_UNUSED:
-                  break;
-
-             case RECV_USED:
-                  /* Drop looped packets sent by us (running
-                   * under Win32 DOS box using NDIS3PKT or SwsVpkt).
-                   */
-                  if ((_eth_ndis3pkt || _eth_SwsVpkt) &&
-                      !s->tcp.is_ip6 && p->buf_hisip == intel(my_ip_addr))
-                  {
-                    p->buf_sig = RECV_UNUSED;
-                    continue;
-                  }
-                  if (p->buf_seqnum < seqnum)  /* ignore wraps */
-                  {
-                    seqnum = p->buf_seqnum;
-                    oldest = p;
-#if 0
-                    SOCK_DEBUGF (("\nsock_recv_from(): buffer %d, "
-                                  "seq-num %ld, len %d",
-                                  i, seqnum, p->buf_len));
-#endif
-                  }
-                  break;
-
-             default:
-                  outsnl (_LANG("ERROR: sock_recv_init data err"));
-                  return (0);
-           }
-         }
+         p = recv_oldest (s, r, -1);
          break;
 
 #if !defined(USE_UDP_ONLY)
     case TCP_PROTO:
-         t = &s->tcp;
-         len = min (len, (unsigned)t->rx_datalen);
-         if (len)
-             memcpy (buffer, r->recv_bufs, len);
-         return (len);
+         return tcp_recv (&s->tcp, r, (BYTE*)buffer, len, peek);
 #endif
+
+    default:
+         return (0);
   }
 
-  if (!oldest)
+  if (!p)
      return (0);
 
   /* found the oldest UDP packet */
 
-  p = oldest;
   if (p->buf_len < 0)  /* a 0-byte probe packet */
      len = -1;
   else
   {
     len = min ((unsigned)p->buf_len, len);
-    memcpy (buffer, p->buf_data, len);
+    memcpy (buffer, p->buf_ptr, len);
   }
+  recv_peer (s, p, hisip, hisport);
 
-#if defined(USE_IPV6)
-  if (s->tcp.is_ip6)
+  if (!peek)
   {
-    if (hisip)
-       memcpy (hisip, &p->buf_hisip6, sizeof(ip6_address));
+    if (p->buf_pkt)
+       STAT (udpstats.udps_zcqueue++);
+    recv_free (p);
   }
-  else
-#endif
-  if (hisip)
-     *(DWORD*)hisip = p->buf_hisip;
-
-  if (hisport)
-     *hisport = p->buf_hisport;
-
-  if (!peek)
-     p->buf_sig = RECV_UNUSED;
   return (len);
 }
 
@@ -283,3 +609,138 @@ int sock_recv (sock_type *s, void *buffer, unsigned len)
   return sock_recv_from (s, NULL, NULL, buffer, len, 0);
 }
 
+/*
+ * Return TRUE if 'r' has a packet in the receive queue handed out
+ * by sock_recv_zc().
+ */
+static BOOL recv_pinned (const recv_data *r)
+{
+  const recv_buf *p = (const recv_buf*) r->recv_bufs;
+  int   i;
+
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+      if (p->buf_sig == RECV_LENT && p->buf_pkt)
+         return (TRUE);
+  return (FALSE);
+}
+
+/**
+ * Zero-copy receive on a socket set up by sock_recv_init().
+ * Set '*data' to the oldest UDP datagram or TCP segment queued and
+ * return its length (-1 with '*data' set for a 0-byte UDP probe).
+ * It stays valid until given to sock_release_zc() or 's' is closed.
+ *
+ * After the first call, new data is left in the packet receive queue
+ * when possible. Data not yet handed out is copied out of the queue
+ * when it runs short of free buffers. Data handed out stays there,
+ * and no buffers after it can be reused before it's released. So at
+ * most one packet per socket is handed out from the queue, and it
+ * should be released soon.
+ *
+ * TCP data received before the first call is handed out from the
+ * flat buffer at once. Segments are queued separately from the next
+ * call after it's released.
+ */
+int sock_recv_zc (sock_type *s, const void **data, void *hisip, WORD *hisport)
+{
+  recv_data *r = (recv_data*) s->udp.rx_data;
+  recv_buf  *p;
+
+  *data = NULL;
+  if (r->recv_sig != RECV_USED)
+  {
+    SOCK_ERRNO (EBADF);
+    return (-1);
+  }
+
+  if (s->udp.ip_type != UDP_PROTO && s->udp.ip_type != TCP_PROTO)
+     return (0);
+
+#if !defined(USE_UDP_ONLY)
+  if (s->udp.ip_type == TCP_PROTO && !r->recv_zc)
+  {
+    int len = tcp_recv_flat_zc (&s->tcp, r, data, hisip, hisport);
+
+    if (!r->recv_zc)
+       return (len);
+  }
+#endif
+  r->recv_zc = TRUE;
+  _eth_unlend_hook = recv_unlend_all;
+
+  p = recv_oldest (s, r, -1);
+  if (!p)
+     return (0);
+
+  if (p->buf_pkt && recv_pinned(r))
+     recv_copy_out (p);
+
+  p->buf_sig = RECV_LENT;
+  *data = p->buf_ptr;
+  recv_peer (s, p, hisip, hisport);
+
+#if !defined(USE_UDP_ONLY)
+  if (s->udp.ip_type == TCP_PROTO)
+  {
+    if (p->buf_pkt)
+       STAT (tcpstats.tcps_rcvzcqueue++);
+    STAT (tcpstats.tcps_rcvzcrecv++);
+  }
+  else
+#endif
+  {
+    if (p->buf_pkt)
+       STAT (udpstats.udps_zcqueue++);
+    STAT (udpstats.udps_zcrecv++);
+  }
+  return (p->buf_len);
+}
+
+/**
+ * Release data returned by sock_recv_zc().
+ */
+int sock_release_zc (sock_type *s, const void *data)
+{
+  recv_data *r = (recv_data*) s->udp.rx_data;
+  recv_buf  *p;
+  int        i;
+
+  if (r->recv_sig != RECV_USED)
+  {
+    SOCK_ERRNO (EBADF);
+    return (-1);
+  }
+
+#if !defined(USE_UDP_ONLY)
+  if (s->tcp.ip_type == TCP_PROTO && !r->recv_zc)
+  {
+    _tcp_Socket *t = &s->tcp;
+
+    if (!r->recv_flatlen || data != r->recv_bufs)
+    {
+      SOCK_ERRNO (EINVAL);
+      return (-1);
+    }
+    t->rx_datalen -= r->recv_flatlen;
+    memmove (r->recv_bufs, r->recv_bufs + r->recv_flatlen, t->rx_datalen);
+    r->recv_flatlen = 0;
+    tcp_recv_taken (t, r);
+    return (0);
+  }
+#endif
+
+  p = (recv_buf*) r->recv_bufs;
+  for (i = 0; i < r->recv_bufnum; i++, p++)
+  {
+    if (p->buf_sig != RECV_LENT || p->buf_ptr != (const BYTE*)data)
+       continue;
+    recv_free (p);
+#if !defined(USE_UDP_ONLY)
+    if (s->tcp.ip_type == TCP_PROTO)
+       tcp_recv_taken (&s->tcp, r);
+#endif
+    return (0);
+  }
+  SOCK_ERRNO (EINVAL);
+  return (-1);
+}
@@ -9,6 +9,8 @@ typedef struct recv_data {
         DWORD  recv_sig;
         BYTE  *recv_bufs;
         WORD   recv_bufnum;
+        WORD   recv_zc;        /* sock_recv_zc() used; lend packets */
+        WORD   recv_flatlen;   /* TCP: flat data handed out by sock_recv_zc() */
       } recv_data;
 
 /*!\struct recv_buf
@@ -22,6 +24,8 @@ typedef struct recv_buf {
 #endif
         WORD        buf_hisport;
         short       buf_len;
+        const BYTE *buf_ptr;            /* data; in buf_data[] or buf_pkt */
+        const void *buf_pkt;            /* lent packet (_eth_lend()) or NULL */
         BYTE        buf_data [ETH_MAX]; /* sock_packet_peek() needs 1514 */
       } recv_buf;
 
@@ -30,4 +34,9 @@ extern int sock_recv_used (const sock_type *s);
 extern int sock_recv      (sock_type *s, void *buffer, unsigned len);
 extern int sock_recv_from (sock_type *s, void *hisip, WORD *hisport,
                            void *buffer, unsigned len, int peek);
+extern int sock_recv_zc   (sock_type *s, const void **data, void *hisip,
+                           WORD *hisport);
+extern int sock_release_zc (sock_type *s, const void *data);
+
+extern void _sock_recv_exit (const sock_type *s);
 #endif
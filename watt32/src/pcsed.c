@@ -87,6 +87,13 @@ void *(*_eth_recv_hook) (WORD *type)                        = NULL;
 int   (*_eth_recv_peek) (void *mac_buf)                     = NULL;
 int   (*_eth_xmit_hook) (const void *mac_buf, unsigned len) = NULL;
 
+/**
+ * Set when packets are lent by _eth_lend(). Called by _eth_arrived()
+ * when lent packets block the receive queue; it should copy out and
+ * release those not yet handed to the application.
+ */
+void (*_eth_unlend_hook) (void) = NULL;
+
 /**
  * Pointer to functions that does the filling of correct MAC-header
  * and sends the link-layer packet. We store 'proto' between calls.
@@ -785,6 +792,62 @@ void _eth_free (const void *pkt)
   else pkt_free_pkt (pkt);
 }
 
+/**
+ * Lend out the packet being handled (the one _eth_arrived() returned
+ * last). It stays in the receive queue after _eth_free() so that
+ * 'data' (pointing into it) remains valid.
+ *
+ *  \retval handle for _eth_lend_free().
+ *  \retval NULL if 'data' isn't in the receive queue (e.g. a reassembled
+ *          fragment or USE_FAST_PKT copied it) or the queue is filling up.
+ */
+#if defined(PKTQ_LEND)
+/*
+ * Buffers after a lent one can't be reused until it's released.
+ * Keep at least half the queue for new packets.
+ */
+static BOOL lend_room_low (struct pkt_ringbuf *q)
+{
+  return (pktq_room(q) < q->num_buf / 2);
+}
+#endif
+
+const void *_eth_lend (const void *data)
+{
+#if defined(PKTQ_LEND)
+  struct pkt_ringbuf *q;
+  const char *buf;
+
+  if (!_eth_is_init || _eth_recv_hook || !_pkt_inf)
+     return (NULL);
+
+  q   = &_pkt_inf->pkt_queue;
+  buf = pktq_out_buf (q);
+  if ((const char*)data < buf || (const char*)data >= buf + q->buf_size)
+     return (NULL);
+
+  if (lend_room_low(q))
+     return (NULL);
+  return pktq_lend (q);
+#else
+  ARGSUSED (data);
+  return (NULL);
+#endif
+}
+
+/**
+ * Give a packet lent by _eth_lend() back to the receive queue.
+ */
+void _eth_lend_free (const void *pkt)
+{
+#if defined(PKTQ_LEND)
+  if (pkt && _pkt_inf)
+     pktq_release (&_pkt_inf->pkt_queue, (const char*)pkt);
+#else
+  ARGSUSED (pkt);
+#endif
+}
+
 
 /**
  * Check a Token-Ring raw packet for RIF/RCF. Remove RCF if
@@ -1019,6 +1082,15 @@ void *_eth_arrived (WORD *type_ptr, BOOL *broadcast)
   if (!_eth_is_init)  /* GvB 2002-09, Lets us run without a working driver */
      return (NULL);
 
+#if defined(PKTQ_LEND)
+  /* Get the buffers lent by sockets that didn't read them yet back
+   * before the queue fills up. Else new frames are dropped.
+   */
+  if (_eth_unlend_hook && _pkt_inf && _pkt_inf->pkt_queue.num_lent > 0 &&
+      lend_room_low(&_pkt_inf->pkt_queue))
+     (*_eth_unlend_hook)();
+#endif
+
   if (_eth_recv_hook)
        pkt = (union link_Packet*) (*_eth_recv_hook) (&type);
   else pkt = poll_recv_queue (&type);
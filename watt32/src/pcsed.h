@@ -235,12 +235,16 @@ W32_DATA void *(*_eth_recv_hook) (WORD *type);
 W32_DATA int   (*_eth_recv_peek) (void *mac_buf);
 W32_DATA int   (*_eth_xmit_hook) (const void *mac_buf, unsigned len);
 
+extern void (*_eth_unlend_hook) (void);
+
 W32_FUNC int   _eth_init         (void);
 W32_FUNC void  _eth_release      (void);
 W32_FUNC int   _eth_send         (WORD len, const void *sock, const char *file, unsigned line);
 W32_FUNC int   _eth_set_addr     (const void *addr);
 W32_FUNC void *_eth_formatpacket (const void *mac_dest, WORD mac_type);
 W32_FUNC void  _eth_free         (const void *pkt);
+W32_FUNC void  _eth_lend_free    (const void *pkt);
+W32_FUNC const void *_eth_lend   (const void *data);
 W32_FUNC void *_eth_arrived      (WORD *type, BOOL *brdcast);
 W32_FUNC BYTE  _eth_get_hwtype   (BYTE *hwtype, BYTE *hwlen);
 
@@ -70,13 +70,38 @@ int sock_stats (sock_type *sock, DWORD *days, WORD *inactive,
   if (avg)      *avg      = 0;
   if (sd)       *sd       = 0;
 #else
-  if (cwindow)  *cwindow  = s->cwindow;
+  if (cwindow)  *cwindow  = (WORD) s->cwindow;
   if (avg)      *avg      = s->vj_sa >> 3;
   if (sd)       *sd       = s->vj_sd >> 2;
 #endif
   return (1);
 }
 
+/*
+ * Return congestion state of a TCP socket; congestion window and
+ * slow-start threshold in bytes, and # of segments sent by fast
+ * retransmit.
+ */
+int sock_cc_stats (sock_type *sock, DWORD *cwnd, DWORD *ssthresh,
+                   DWORD *fast_rexmit)
+{
+  _tcp_Socket *s = &sock->tcp;
+
+  if (s->ip_type != TCP_PROTO)
+     return (0);
+
+#if defined(USE_UDP_ONLY)
+  if (cwnd)        *cwnd        = 0;
+  if (ssthresh)    *ssthresh    = 0;
+  if (fast_rexmit) *fast_rexmit = 0;
+#else
+  if (cwnd)        *cwnd        = (DWORD)s->cwindow  * s->max_seg;
+  if (ssthresh)    *ssthresh    = (DWORD)s->ssthresh * s->max_seg;
+  if (fast_rexmit) *fast_rexmit = s->fast_rexmit;
+#endif
+  return (1);
+}
+
 #if !defined(USE_STATISTICS)
   void print_mac_stats (void)  {}
   void print_vjc_stats (void)  {}
@@ -440,6 +465,8 @@ void print_udp_stats (void)
   show_stat ("no service:", udpstats.udps_noport);
   show_stat ("broadcast:",  udpstats.udps_noportbcast);
   show_stat ("queue full:", udpstats.udps_fullsock);
+  show_stat ("no-copy rx:", udpstats.udps_zcqueue);
+  show_stat ("no-copy app:",udpstats.udps_zcrecv);
 
   (*_printf) ("UDP   output stats:\n");
   show_stat ("total:",      udpstats.udps_opackets);
@@ -465,7 +492,10 @@ void print_tcp_stats (void)
   show_stat ("ACK nosent:",   tcpstats.tcps_rcvacktoomuch);
   show_stat ("dup ACK:",     tcpstats.tcps_rcvduppack);
   show_stat ("dup bytes:",   tcpstats.tcps_rcvdupbyte);
+  show_stat ("dup ACK only:",tcpstats.tcps_rcvdupack);
   show_stat ("pers-drop:",   tcpstats.tcps_persistdrop);
+  show_stat ("no-copy rx:",  tcpstats.tcps_rcvzcqueue);
+  show_stat ("no-copy app:", tcpstats.tcps_rcvzcrecv);
 
   (*_printf) ("TCP   output stats:\n");
   show_stat ("total:",       tcpstats.tcps_sndtotal);
@@ -479,10 +509,14 @@ void print_tcp_stats (void)
   show_stat ("ACK dly:",     tcpstats.tcps_delack);
   show_stat ("ACK win upd:", tcpstats.tcps_sndwinup);
   show_stat ("retrans to:",  tcpstats.tcps_rexmttimeo);
+  show_stat ("fast retrans:",tcpstats.tcps_sndrexmitpack);
+  show_stat ("f-retr bytes:",tcpstats.tcps_sndrexmitbyte);
   show_stat ("keepalive pr:",tcpstats.tcps_keepprobe);
   show_stat ("keepalive to:",tcpstats.tcps_keeptimeo);
   show_stat ("RTTcache add:",tcpstats.tcps_cachedrtt);
-  show_stat ("RTTcache get:",tcpstats.tcps_usedrtt);
+  show_stat ("RTTcache hit:",tcpstats.tcps_usedrtt);
+  show_stat ("RTTcache miss:",tcpstats.tcps_rttcachemiss);
+  show_stat ("RTTcache drop:",tcpstats.tcps_rttcachedrop);
 #endif
 }
 
@@ -126,6 +126,8 @@ struct pppoestat {
  * udps_fullsock        - not delivered, input socket full
  * udpps_pcbcachemiss   - input packets missing pcb cache
  * udpps_pcbhashmiss    - input packets not for hashed pcb
+ * udps_zcqueue         - read straight from receive queue
+ * udps_zcrecv          - read by sock_recv_zc()
  * udps_opackets        - total output packets
  *
  *
@@ -193,6 +195,10 @@ struct pppoestat {
  * tcps_badsyn          - bogus SYN, e.g. premature ACK
  * tcps_mturesent       - resends due to MTU discovery
  * tcps_listendrop      - listen queue overflows
+ * tcps_rttcachemiss    - RTT cache lookups that missed
+ * tcps_rttcachedrop    - RTT cache entries replaced
+ * tcps_rcvzcqueue      - read straight from receive queue
+ * tcps_rcvzcrecv       - read by sock_recv_zc()
  * #ifdef TCP_FACK
  * tcps_fack_recovery;     - recovery episodes
  * tcps_fack_sndpack;      - data packets sent
@@ -232,6 +238,9 @@ struct pppoestat {
 extern int sock_stats (sock_type *sock, DWORD *days, WORD *inactive,
                        WORD *cwindow, DWORD *avg, DWORD *sd);
 
+extern int sock_cc_stats (sock_type *sock, DWORD *cwnd, DWORD *ssthresh,
+                          DWORD *fast_rexmit);
+
 extern void print_mac_stats  (void);
 extern void print_arp_stats  (void);
 extern void print_pkt_stats  (void);
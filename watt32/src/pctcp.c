@@ -34,6 +34,7 @@
 #include "pcdhcp.h"
 #include "pcarp.h"
 #include "pcbuf.h"
+#include "pcrecv.h"
 #include "netaddr.h"
 #include "ip4_frag.h"
 #include "ip4_in.h"
@@ -44,6 +45,7 @@
 #include "split.h"
 #include "pppoe.h"
 #include "pctcp.h"
+#include "tcp_cc.h"
 
 #if defined(USE_BSD_API) || defined(USE_IPV6)
 #include "socket.h"
@@ -140,6 +142,7 @@ struct tcp6_pkt {
   unsigned tcp_keep_intvl = 30;           /**< time between keepalive probes */
   unsigned tcp_max_idle   = 60;           /**< max idle time before kill */
   DWORD    tcp_recv_win   = DEF_RECV_WIN; /**< RWIN for BSD sockets only */
+  unsigned tcp_rtt_size   = DEF_RTT_CACHE; /**< TCP metrics cache size */
 
   _tcp_Socket *_tcp_allsocs = NULL;       /**< list of tcp-sockets */
 
@@ -161,6 +164,202 @@ static void udp_close (const _udp_Socket *s);
 
 static void (*system_yield)(void) = NULL;
 
+/*
+ * Demultiplexing hashes for received segments and datagrams.
+ *
+ * Connected sockets are hashed on (remote address, remote port, local port)
+ * into the first SOCK_HASH_SIZE buckets. All other sockets (listening,
+ * unconnected, broadcast and multicast sockets) are hashed on the local
+ * port only into the PORT_HASH_SIZE buckets that follow. The local address
+ * is not part of the key since DHCP may change it under an open socket;
+ * the lookups still compare it. 'hash_slot' is the bucket + 1, so a socket
+ * can be unhashed after its addresses were changed.
+ */
+#if (DOSX)
+  #define SOCK_HASH_SIZE  512
+  #define PORT_HASH_SIZE  64
+#else
+  #define SOCK_HASH_SIZE  64
+  #define PORT_HASH_SIZE  16
+#endif
+
+#define PORT_SLOT(port)  (SOCK_HASH_SIZE + \
+                          (((port) ^ ((port) >> 6)) & (PORT_HASH_SIZE-1)))
+
+static _udp_Socket *udp_hash [SOCK_HASH_SIZE + PORT_HASH_SIZE];
+
+/**
+ * Multiplicative (Fibonacci) hash of the remote end and local port.
+ * Plain XOR-folding is no good here; peers and ports are often
+ * assigned sequentially and cancels each other out.
+ */
+static __inline unsigned sock_slot (DWORD addr, WORD rport, WORD lport)
+{
+  DWORD h = addr * 0x9E3779B1UL;
+
+  h = (h ^ (((DWORD)rport << 16) | lport)) * 0x9E3779B1UL;
+  return (unsigned) ((h >> 16) & (SOCK_HASH_SIZE-1));
+}
+
+/**
+ * IPv6 sockets and sockets without a unicast peer goes into
+ * the local-port buckets.
+ */
+static unsigned udp_hash_slot (const _udp_Socket *s)
+{
+  if (!s->is_ip6 && s->hisport && s->hisaddr &&
+      s->hisaddr != IP_BCAST_ADDR && !_ip4_is_multicast(s->hisaddr))
+     return sock_slot (s->hisaddr, s->hisport, s->myport);
+  return PORT_SLOT (s->myport);
+}
+
+static void udp_hash_insert (_udp_Socket *s)
+{
+  unsigned slot = udp_hash_slot (s);
+
+  s->hash_next    = udp_hash [slot];
+  s->hash_slot    = slot + 1;
+  udp_hash [slot] = s;
+}
+
+static void udp_hash_remove (_udp_Socket *s)
+{
+  _udp_Socket **sp;
+
+  if (!s->hash_slot)
+     return;
+
+  for (sp = &udp_hash[s->hash_slot-1]; *sp; sp = &(*sp)->hash_next)
+      if (*sp == s)
+      {
+        *sp = s->hash_next;
+        break;
+      }
+  s->hash_next = NULL;
+  s->hash_slot = 0;
+}
+
+/**
+ * Move an UDP socket to the right bucket after it's peer
+ * address or port was changed. Does nothing if socket isn't open.
+ */
+void _udp_rehash (_udp_Socket *s)
+{
+  if (s->hash_slot)
+  {
+    udp_hash_remove (s);
+    udp_hash_insert (s);
+  }
+}
+
+#if !defined(USE_UDP_ONLY)
+
+static _tcp_Socket *tcp_hash [SOCK_HASH_SIZE + PORT_HASH_SIZE];
+
+static struct timer_wheel tcp_timers;  /* see _tcp_timer_sched() */
+static BOOL               tcp_timers_init = FALSE;
+
+/**
+ * Sockets with a remote port are connected (or half-connected),
+ * all others are listening.
+ */
+static unsigned tcp_hash_slot (const _tcp_Socket *s)
+{
+  if (s->hisport)
+     return sock_slot (s->hisaddr, s->hisport, s->myport);
+  return PORT_SLOT (s->myport);
+}
+
+void _tcp_hash_insert (_tcp_Socket *s)
+{
+  unsigned slot = tcp_hash_slot (s);
+
+  s->hash_next    = tcp_hash [slot];
+  s->hash_slot    = slot + 1;
+  tcp_hash [slot] = s;
+}
+
+void _tcp_hash_remove (_tcp_Socket *s)
+{
+  _tcp_Socket **sp;
+
+  if (!s->hash_slot)
+     return;
+
+  for (sp = &tcp_hash[s->hash_slot-1]; *sp; sp = &(*sp)->hash_next)
+      if (*sp == s)
+      {
+        *sp = s->hash_next;
+        break;
+      }
+  s->hash_next = NULL;
+  s->hash_slot = 0;
+}
+
+/**
+ * Move a TCP socket to the right bucket after it's peer
+ * address or port was changed. Does nothing if socket isn't open.
+ */
+void _tcp_rehash (_tcp_Socket *s)
+{
+  if (s->hash_slot)
+  {
+    _tcp_hash_remove (s);
+    _tcp_hash_insert (s);
+  }
+}
+
+/**
+ * Find the connected socket for an IPv4 segment.
+ * Returns a corrupt socket found on the way (caller checks it).
+ */
+static _tcp_Socket *tcp_demux4 (DWORD destin, DWORD source,
+                                WORD dstPort, WORD srcPort)
+{
+  _tcp_Socket *s = tcp_hash [sock_slot(source,srcPort,dstPort)];
+
+  for ( ; s; s = s->hash_next)
+  {
+    if (s->safetysig != SAFETY_TCP || s->safetytcp != SAFETY_TCP)
+       break;
+
+    if (s->hisport            &&   /* IP4: not a listening socket */
+        destin  == s->myaddr  &&   /* addressed to my IP */
+        source  == s->hisaddr &&   /* and from my peer address */
+        dstPort == s->myport  &&   /* addressed to my local port */
+        srcPort == s->hisport)     /* and from correct remote port */
+      break;
+  }
+  return (s);
+}
+
+/**
+ * Find a listening socket on local port 'dstPort'.
+ */
+static _tcp_Socket *tcp_listener (WORD dstPort)
+{
+  _tcp_Socket *s;
+
+  for (s = tcp_hash[PORT_SLOT(dstPort)]; s; s = s->hash_next)
+      if (s->hisport == 0 &&     /* =0, listening socket */
+          s->myport  == dstPort) /* addressed to my local port */
+         break;
+  return (s);
+}
+#endif  /* !USE_UDP_ONLY */
+
+/**
+ * Forget all hashed sockets. Called when the socket lists
+ * are cleared.
+ */
+void _sock_hash_reset (void)
+{
+  memset (&udp_hash, 0, sizeof(udp_hash));
+#if !defined(USE_UDP_ONLY)
+  memset (&tcp_hash, 0, sizeof(tcp_hash));
+#endif
+}
+
 /**
  * UDP passive open. Listen for a connection on a particular port.
  */
@@ -193,6 +392,7 @@ int udp_listen (_udp_Socket *s, WORD lport, DWORD ip,
   s->safetysig    = SAFETY_UDP;
   s->next         = _udp_allsocs;            /* insert into chain */
   _udp_allsocs    = s;
+  udp_hash_insert (s);
   return (1);
 }
 
@@ -265,6 +465,7 @@ int udp_open (_udp_Socket *s, WORD lport, DWORD ip,
   s->safetysig    = SAFETY_UDP;
   s->next         = _udp_allsocs;
   _udp_allsocs    = s;
+  udp_hash_insert (s);
   return (1);
 }
 
@@ -288,6 +489,8 @@ static void udp_close (const _udp_Socket *udp)
     if (s == _udp_allsocs)
          _udp_allsocs = s->next;
     else prev->next   = s->next;
+    udp_hash_remove (s);
+    _sock_recv_exit ((const sock_type*)s);
     SET_ERR_MSG (s, _LANG("UDP Close called"));
     break;
   }
@@ -360,8 +563,6 @@ int tcp_open (_tcp_Socket *s, WORD lport, DWORD ip,
   s->max_seg      = _mss;        /**< \todo use \b mss from setsockopt() */
   s->state        = tcp_StateRESOLVE;
 
-  s->cwindow      = 1;
-  s->wwindow      = 0;                        /* slow start VJ algorithm */
   s->vj_sa        = INIT_VJSA;
   s->rto          = tcp_OPEN_TO;              /* added 14-Dec 1999, GV */
   s->myaddr       = my_ip_addr;
@@ -375,11 +576,14 @@ int tcp_open (_tcp_Socket *s, WORD lport, DWORD ip,
   s->unhappy      = TRUE;
   s->protoHandler = handler;
   s->usr_yield    = system_yield;
+  _tcp_cc_init (s);                         /* slow start */
 
   s->safetysig    = SAFETY_TCP;             /* marker signatures */
   s->safetytcp    = SAFETY_TCP;
   s->next         = _tcp_allsocs;           /* insert into chain */
   _tcp_allsocs    = s;
+  _tcp_hash_insert (s);
+  _tcp_timer_sched (s);             /* poll for ARP reply */
 
   /** \todo use \b TCP_NODELAY set in setsockopt()
    */
@@ -428,8 +632,6 @@ int tcp_listen (_tcp_Socket *s, WORD lport, DWORD ip,
   s->max_tx_data  = sizeof(s->tx_buf) - 1;
   s->ip_type      = TCP_PROTO;
   s->max_seg      = _mss;        /**< \todo use \b mss from setsockopt() */
-  s->cwindow      = 1;
-  s->wwindow      = 0;               /* slow start VJ algorithm */
   s->vj_sa        = INIT_VJSA;
   s->state        = tcp_StateLISTEN;
   s->locflags     = LF_LINGER | LF_IS_SERVER;
@@ -441,10 +643,12 @@ int tcp_listen (_tcp_Socket *s, WORD lport, DWORD ip,
   s->ttl          = _default_ttl;
   s->protoHandler = handler;
   s->usr_yield    = system_yield;
+  _tcp_cc_init (s);                 /* slow start */
   s->safetysig    = SAFETY_TCP;     /* marker signatures */
   s->safetytcp    = SAFETY_TCP;
   s->next         = _tcp_allsocs;   /* insert into chain */
   _tcp_allsocs    = s;
+  _tcp_hash_insert (s);
 
   if (tcp_nagle)
      s->sockmode = SOCK_MODE_NAGLE;
@@ -452,6 +656,7 @@ int tcp_listen (_tcp_Socket *s, WORD lport, DWORD ip,
 
   if (timeout != 0)
      s->timeout = set_timeout (1000 * timeout);
+  _tcp_timer_sched (s);
   return (1);
 }
 
@@ -512,6 +717,7 @@ void _tcp_close (_tcp_Socket *s)
     maybe_reuse_localport (s);
     _tcp_unthread (s, FALSE);
   }
+  _tcp_timer_sched (s);
   SIO_TRACE (("_tcp_close~"));
 }
 
@@ -593,6 +799,7 @@ int _tcp_sendsoon (_tcp_Socket *s, char *file, unsigned line)
   else s->rtt_time = set_timeout (s->rto / tcp_RTO_SCALE);
 
   s->karn_count = 1;
+  _tcp_timer_sched (s);
 
   return (0);
 }
@@ -620,6 +827,9 @@ _tcp_Socket *_tcp_unthread (_tcp_Socket *ds, BOOL free_tx)
          _tcp_allsocs = s->next;
     else prev->next   = s->next;
     next = s->next;
+    _tcp_hash_remove (s);
+    tw_del (&tcp_timers, &s->timer);
+    _sock_recv_exit ((const sock_type*)s);
     break;
   }
 
@@ -723,67 +933,64 @@ _tcp_Socket *_tcp_handler (const in_Header *ip, BOOL broadcast)
   dstPort = intel16 (tcp->dstPort);
   srcPort = intel16 (tcp->srcPort);
 
-  /* demux to active sockets
-   */
-  for (s = _tcp_allsocs; s; s = s->next)
+  if (is_ip4)
   {
-    if (s->safetysig != SAFETY_TCP || s->safetytcp != SAFETY_TCP)
+    /* demux to active sockets
+     */
+    s = tcp_demux4 (destin, source, dstPort, srcPort);
+    if (s && (s->safetysig != SAFETY_TCP || s->safetytcp != SAFETY_TCP))
     {
       outsnl (_LANG("Error in _tcp_handler()"));
       DEBUG_RX (s, ip);
       return (NULL);
     }
 
-    if (s->is_ip6 && !is_ip4)
+    /* demux to passive (listening) sockets, must be a new session
+     */
+    if (!s && (flags & tcp_FlagSYN) &&
+        (s = tcp_listener(dstPort)) != NULL && !s->is_ip6)
     {
+      s->hisaddr = source;     /* remember his IP-address */
+      s->hisport = srcPort;    /*   and src-port */
+      s->myaddr  = destin;     /* socket is now active (should be same) */
+      _tcp_rehash (s);
+    }
+  }
 #if defined(USE_IPV6)
-      if (s->hisport                                       &&
+  else
+  {
+    /* demux to active sockets
+     */
+    for (s = _tcp_allsocs; s; s = s->next)
+    {
+      if (s->safetysig != SAFETY_TCP || s->safetytcp != SAFETY_TCP)
+      {
+        outsnl (_LANG("Error in _tcp_handler()"));
+        DEBUG_RX (s, ip);
+        return (NULL);
+      }
+
+      if (s->is_ip6                                        &&
+          s->hisport                                       &&
           !memcmp(&ip6_dst, &s->my6addr, sizeof(ip6_dst))  &&
           !memcmp(&ip6_src, &s->his6addr, sizeof(ip6_src)) &&
           dstPort == s->myport                             &&
           srcPort == s->hisport)
          break;
-#endif
-    }
-    else if (is_ip4)
-    {
-      if (s->hisport            &&   /* IP4: not a listening socket */
-          destin  == s->myaddr  &&   /* addressed to my IP */
-          source  == s->hisaddr &&   /* and from my peer address */
-          dstPort == s->myport  &&   /* addressed to my local port */
-          srcPort == s->hisport)     /* and from correct remote port */
-        break;
     }
-  }
 
-  if (!s && (flags & tcp_FlagSYN))
-  {
     /* demux to passive (listening) sockets, must be a new session
      */
-    for (s = _tcp_allsocs; s; s = s->next)
-        if (s->hisport == 0 &&     /* =0, listening socket */
-            s->myport  == dstPort) /* addressed to my local port */
-        {
-          if (s->is_ip6)
-          {
-#if defined(USE_IPV6)
-            if (!is_ip4)
-            {
-              s->hisaddr = source;
-              s->hisport = srcPort;
-              memcpy (&s->my6addr, ip6_dst, sizeof(s->my6addr));
-            }
-#endif
-          }
-          else if (is_ip4)
-          {
-            s->hisaddr = source;     /* remember his IP-address */
-            s->hisport = srcPort;    /*   and src-port */
-            s->myaddr  = destin;     /* socket is now active (should be same) */
-          }
-          break;
-        }
+    if (!s && (flags & tcp_FlagSYN) &&
+        (s = tcp_listener(dstPort)) != NULL && s->is_ip6)
+    {
+      s->hisaddr = source;
+      s->hisport = srcPort;
+      memcpy (&s->my6addr, ip6_dst, sizeof(s->my6addr));
+      _tcp_rehash (s);
+    }
   }
+#endif
 
   DEBUG_RX (s, ip);
 
@@ -841,6 +1048,8 @@ _tcp_Socket *_tcp_handler (const in_Header *ip, BOOL broadcast)
       s->unhappy)         /* if "unhappy", retransmit soon */
      TCP_SENDSOON (s);
 
+  _tcp_timer_sched (s);   /* timers or state may have changed */
+
 #if defined(USE_DEBUG)
   _sock_check_tcp_buffers (s);
 #endif
@@ -874,6 +1083,90 @@ static BOOL udp_checksum (const in_Header *ip, const udp_Header *udp, int len)
 }
 
 
+#if defined(USE_IPV6)
+/**
+ * Demultiplexer for incoming UDP/IPv6 packets.
+ * Few IPv6 sockets are expected, so this simply walks the socket-list.
+ */
+static _udp_Socket *udp6_demux (const in6_Header *ip6, BOOL ip_bcast,
+                                WORD srcPort, WORD dstPort, BOOL *udp_err)
+{
+  _udp_Socket *s;
+  ip6_address  ip6_src, ip6_dst;
+
+  memcpy (&ip6_dst, &ip6->destination, sizeof(ip6_dst));
+  memcpy (&ip6_src, &ip6->source, sizeof(ip6_src));
+
+  /* demux to active sockets
+   */
+  for (s = _udp_allsocs; s; s = s->next)
+  {
+    if (s->safetysig != SAFETY_UDP)
+    {
+      outsnl (_LANG("Error in udp_demux()"));
+      s->safetysig = SAFETY_UDP;
+      DEBUG_RX (s, ip6);
+      *udp_err = TRUE;
+      return (NULL);
+    }
+
+    if (!ip_bcast              &&
+        s->is_ip6              &&
+        (s->hisport != 0)      &&
+        (dstPort == s->myport) &&
+        (srcPort == s->hisport) &&
+        IN6_ARE_ADDR_EQUAL(&ip6_src,&s->his6addr))  /* !!mask */
+    {
+      DEBUG_RX (s, ip6);
+      return (s);
+    }
+  }
+
+  /* demux to passive (and broadcast) sockets
+   */
+  for (s = _udp_allsocs; s; s = s->next)
+  {
+    if (s->is_ip6 && dstPort == s->myport &&
+        IN6_IS_ADDR_UNSPECIFIED(&s->his6addr))
+    {
+      DEBUG_RX (s, ip6);
+
+      memcpy (&s->his6addr, &ip6_src, sizeof(s->his6addr));
+      s->hisport = srcPort;
+      SET_PEER_MAC_ADDR (s, ip6);
+      if (!ip_bcast)
+         memcpy (&s->my6addr, &ip6_dst, sizeof(s->my6addr));
+      return (s);
+    }
+  }
+  return (NULL);
+}
+#endif  /* USE_IPV6 */
+
+/**
+ * Search one hash-chain for an active UDP/IPv4 socket.
+ * Returns a corrupt socket found on the way (caller checks it).
+ */
+static _udp_Socket *udp_demux_active (_udp_Socket *s, DWORD destin,
+                                      DWORD source, WORD srcPort,
+                                      WORD dstPort)
+{
+  for ( ; s; s = s->hash_next)
+  {
+    if (s->safetysig != SAFETY_UDP)
+       break;
+
+    if (!s->is_ip6             &&
+        (s->hisport != 0)      &&
+        (dstPort == s->myport) &&
+        (srcPort == s->hisport) &&
+        ((destin & sin_mask) == (s->myaddr & sin_mask)) &&
+        (source == s->hisaddr))
+      break;
+  }
+  return (s);
+}
+
 /**
  * Demultiplexer for incoming UDP packets.
  * Don't debug packet if no match was found (except if '*udp_err').
@@ -883,27 +1176,30 @@ static _udp_Socket *udp_demux (const in_Header *ip, BOOL ip_bcast,
                                BOOL *udp_err)
 {
   _udp_Socket *s;
-  BOOL is_ip4 = (ip->ver == 4);
+  DWORD        source;
+  unsigned     port_slot = PORT_SLOT (dstPort);
 
-#if defined(USE_IPV6)
-  const in6_Header *ip6 = (const in6_Header*)ip;
-  ip6_address       ip6_src, ip6_dst;
+  *udp_err = FALSE;   /* assume socket-list is OK */
 
-  if (!is_ip4)
-  {
-    memcpy (&ip6_dst, &ip6->destination, sizeof(ip6_dst));
-    memcpy (&ip6_src, &ip6->source, sizeof(ip6_src));
-  }
+#if defined(USE_IPV6)
+  if (ip->ver != 4)
+     return udp6_demux ((const in6_Header*)ip, ip_bcast,
+                        srcPort, dstPort, udp_err);
 #endif
 
-  *udp_err = FALSE;   /* assume socket-list is OK */
+  source = intel (ip->source);
 
-  /** Demux to active sockets.
-   * \todo use some kind of hashing to speed up the search.
+  /* Demux to active sockets. Connected sockets are in the bucket
+   * of the remote end, the others in the bucket of 'dstPort'.
    */
-  for (s = _udp_allsocs; s; s = s->next)
+  if (!ip_bcast)
   {
-    if (s->safetysig != SAFETY_UDP)
+    s = udp_demux_active (udp_hash[sock_slot(source,srcPort,dstPort)],
+                          destin, source, srcPort, dstPort);
+    if (!s)
+       s = udp_demux_active (udp_hash[port_slot],
+                             destin, source, srcPort, dstPort);
+    if (s && s->safetysig != SAFETY_UDP)
     {
       outsnl (_LANG("Error in udp_demux()"));
       s->safetysig = SAFETY_UDP;
@@ -911,122 +1207,65 @@ static _udp_Socket *udp_demux (const in_Header *ip, BOOL ip_bcast,
       *udp_err = TRUE;
       return (NULL);
     }
-
-    if (!ip_bcast              &&
-        (s->hisport != 0)      &&
-        (dstPort == s->myport) &&
-        (srcPort == s->hisport))
+    if (s)
     {
-      if (s->is_ip6)
-      {
-#if defined(USE_IPV6)
-        if (!is_ip4 &&
-            IN6_ARE_ADDR_EQUAL(&ip6_src,&s->his6addr))  /* !!mask */
-        {
-          DEBUG_RX (s, ip);
-          break;
-        }
-#endif
-      }
-      else if (is_ip4 &&
-               ((destin & sin_mask) == (s->myaddr & sin_mask)) &&
-               (intel(ip->source)   == s->hisaddr))
-      {
-        DEBUG_RX (s, ip);
-        break;
-      }
+      DEBUG_RX (s, ip);
+      return (s);
     }
   }
 
-  if (!s)
+  /* demux to passive sockets
+   */
+  for (s = udp_hash[port_slot]; s; s = s->hash_next)
   {
-    /* demux to passive sockets
-     */
-    for (s = _udp_allsocs; s; s = s->next)
+    if (!s->is_ip6 && (s->hisaddr == 0 || s->hisaddr == IP_BCAST_ADDR) &&
+        dstPort == s->myport)
     {
-      if (s->is_ip6)
-      {
-#if defined(USE_IPV6)
-        if (!is_ip4 && dstPort == s->myport &&
-            IN6_IS_ADDR_UNSPECIFIED(&s->his6addr))
-        {
-          DEBUG_RX (s, ip);
-
-          memcpy (&s->his6addr, &ip6_src, sizeof(s->his6addr));
-          s->hisport = srcPort;
-          SET_PEER_MAC_ADDR (s, ip6);
-          if (!ip_bcast)
-             memcpy (&s->my6addr, &ip6_dst, sizeof(s->my6addr));
-          break;
-        }
-#endif
-      }
-      else if (is_ip4 && (s->hisaddr == 0 || s->hisaddr == IP_BCAST_ADDR) &&
-               dstPort == s->myport)
+      DEBUG_RX (s, ip);
+
+      if (s->hisaddr == 0)
       {
-        DEBUG_RX (s, ip);
+        s->hisaddr = source;    /* socket now active */
+        s->hisport = srcPort;
+        SET_PEER_MAC_ADDR (s, ip);
 
-        if (s->hisaddr == 0)
-        {
-          s->hisaddr = intel (ip->source);  /* socket now active */
-          s->hisport = srcPort;
-          SET_PEER_MAC_ADDR (s, ip);
-
-          /* take on value of expected destination
-           * unless it is broadcast
-           */
-          if (!ip_bcast)
-             s->myaddr = destin;
-        }
-        break;
+        /* take on value of expected destination
+         * unless it is broadcast
+         */
+        if (!ip_bcast)
+           s->myaddr = destin;
+        _udp_rehash (s);
       }
+      return (s);
     }
   }
 
-
 #if defined(USE_MULTICAST)
-  if (is_ip4 && !s)
+  if (_ip4_is_multicast(destin))
   {
     /* demux to multicast sockets
      */
-    for (s = _udp_allsocs; s; s = s->next)
+    for (s = udp_hash[port_slot]; s; s = s->hash_next)
     {
-      if (s->hisport != 0         &&
-          s->hisaddr == destin    &&
-          dstPort    == s->myport &&
-          _ip4_is_multicast(destin))
+      if (s->hisport != 0      &&
+          s->hisaddr == destin &&
+          dstPort    == s->myport)
       {
         DEBUG_RX (s, ip);
-        break;
+        return (s);
       }
     }
   }
 #endif
 
-  if (!s)
+  /* Demux to broadcast sockets.
+   */
+  for (s = udp_hash[port_slot]; s; s = s->hash_next)
   {
-    /* Demux to broadcast sockets.
-     */
-    for (s = _udp_allsocs; s; s = s->next)
+    if (s->hisaddr == IP_BCAST_ADDR && dstPort == s->myport)
     {
-      if (s->is_ip6 && !is_ip4)
-      {
-#if defined(USE_IPV6)
-        if (dstPort == s->myport && IN6_IS_ADDR_UNSPECIFIED(&s->his6addr))
-        {
-          DEBUG_RX (s, ip);
-          break;
-        }
-#endif
-      }
-      else if (is_ip4)
-      {
-        if (s->hisaddr == IP_BCAST_ADDR && dstPort == s->myport)
-        {
-          DEBUG_RX (s, ip);
-          break;
-        }
-      }
+      DEBUG_RX (s, ip);
+      break;
     }
   }
   return (s);
@@ -1211,178 +1450,257 @@ _udp_Socket *_udp_handler (const in_Header *ip, BOOL broadcast)
 
 #if !defined(USE_UDP_ONLY)
 /**
- * Called periodically to perform retransmissions.
- * \arg if 'force == 1' do it now.
+ * Earliest of 'expire' and timer 't' (if set). A timer that expired
+ * without tcp_timer_expired() acting on it sets '*poll'.
  */
-void tcp_Retransmitter (BOOL force)
+static DWORD tcp_timer_min (DWORD expire, DWORD t, BOOL *poll)
 {
-  _tcp_Socket *s, *next;
-
-  static DWORD timeout = 0UL;
+  if (t == 0UL)
+     return (expire);
+  if (chk_timeout(t))
+  {
+    *poll = TRUE;
+    return (expire);
+  }
+  if (expire == 0UL || (long)(t - expire) < 0)
+     return (t);
+  return (expire);
+}
 
-  SIO_TRACE (("tcp_Retransmitter"));
+/**
+ * Put 's' on the timer wheel for the first time tcp_Retransmitter()
+ * has something to do with it; nothing is done for sockets without
+ * running timers. Must be called after changing the timers, state or
+ * Tx-data of a socket on the '_tcp_allsocs' list.
+ *
+ * Sockets waiting for ARP, Rx-data to be read (before the socket can
+ * be unthreaded) or Rx-buffer space (to send a window update) are
+ * checked every tcp_RETRAN_TIME.
+ */
+void _tcp_timer_sched (_tcp_Socket *s)
+{
+  DWORD expire = 0UL;
+  BOOL  poll   = FALSE;
 
-  /* do this once per tcp_RETRAN_TIME
-   */
-  if (!force && timeout && !chk_timeout(timeout))
+  if (!s->hash_slot)        /* not threaded */
      return;
 
-  timeout = set_timeout (tcp_RETRAN_TIME);
+  if (!tcp_timers_init)
+  {
+    tw_init (&tcp_timers, set_timeout(0));
+    tcp_timers_init = TRUE;
+  }
 
-  for (s = _tcp_allsocs; s; s = next)
+  if (s->state == tcp_StateRESOLVE || s->state == tcp_StateCLOSED ||
+      (s->locflags & LF_WINUPDATE))
+     poll = TRUE;
+
+  if (s->tx_datalen > 0 || s->unhappy || s->karn_count == 1)
   {
-    next = s->next;
+    expire = tcp_timer_min (expire, s->rtt_time, &poll);
+    expire = tcp_timer_min (expire, s->datatimer, &poll);
+  }
+  expire = tcp_timer_min (expire, s->inactive_to, &poll);
 
-    /* Check on ARP resolve status, GvB 2002-09
-     */
-    if (s->state == tcp_StateRESOLVE)
-    {
-      if (arp_lookup (s->hisaddr, &s->his_ethaddr))   /* Success */
-      {
-        UINT rtt, MTU;
+  if (s->state != tcp_StateESTAB && s->state != tcp_StateESTCL)
+     expire = tcp_timer_min (expire, s->timeout, &poll);
 
-        s->state   = tcp_StateSYNSENT;
-        s->timeout = set_timeout (tcp_LONGTIMEOUT);
-        TCP_SEND (s);  /* send opening SYN */
+  if (poll)
+     expire = tcp_timer_min (expire, set_timeout(tcp_RETRAN_TIME), &poll);
 
-        /* find previous RTT replacing RTT set in tcp_send() above
-         */
-        if (tcp_rtt_get(s, &rtt, &MTU))
-             s->rtt_time = set_timeout (rtt);
-        else s->rtt_time = set_timeout (tcp_OPEN_TO);
-      }
+  if (expire == 0UL)
+  {
+    tw_del (&tcp_timers, &s->timer);
+    return;
+  }
+
+  /* Never straight to the due list; tcp_Retransmitter() may be
+   * calling us while emptying it.
+   */
+  if ((long)(expire - tcp_timers.now) < 0)
+     expire = tcp_timers.now;
 
-      /* If ARP no longer pending (timed out), hence we abort
+  s->timer.arg = s;
+  tw_add (&tcp_timers, &s->timer, expire);
+}
+
+/**
+ * Handle the timers of a socket.
+ */
+static void tcp_timer_expired (_tcp_Socket *s)
+{
+  /* Check on ARP resolve status, GvB 2002-09
+   */
+  if (s->state == tcp_StateRESOLVE)
+  {
+    if (arp_lookup (s->hisaddr, &s->his_ethaddr))   /* Success */
+    {
+      UINT rtt;
+      BOOL cached = tcp_rtt_get (s, &rtt);  /* before MSS is sent */
+
+      s->state   = tcp_StateSYNSENT;
+      s->timeout = set_timeout (tcp_LONGTIMEOUT);
+      TCP_SEND (s);  /* send opening SYN */
+
+      /* use previous RTT replacing RTT set in tcp_send() above
        */
-      else if (!arp_lookup_pending(s->hisaddr))    /* ARP timed out */
-      {
-        tcp_no_arp (s);
-        next = TCP_ABORT (s);
-      }
-      continue;    /* don't do anything more on this TCB */
+      if (cached)
+           s->rtt_time = set_timeout (rtt);
+      else s->rtt_time = set_timeout (tcp_OPEN_TO);
     }
 
-    /* possible to be closed with Rx-data still queued
+    /* If ARP no longer pending (timed out), hence we abort
      */
-    if (s->state == tcp_StateCLOSED)
+    else if (!arp_lookup_pending(s->hisaddr))    /* ARP timed out */
     {
-      if (s->rx_datalen == 0)
-      {
-        maybe_reuse_localport (s);
-        next = _tcp_unthread (s, TRUE);
-      }
-      continue;
+      tcp_no_arp (s);
+      TCP_ABORT (s);
     }
+    return;    /* don't do anything more on this TCB */
+  }
 
-    /* Need to send a window update? Because we advertised a 0 window
-     * in a previous _tcp_send() (but only in ESTAB state).
-     */
-    if ((s->locflags & LF_WINUPDATE) && sock_rbleft((sock_type*)s) > 0)
+  /* possible to be closed with Rx-data still queued
+   */
+  if (s->state == tcp_StateCLOSED)
+  {
+    if (s->rx_datalen == 0)
     {
-      STAT (tcpstats.tcps_sndwinup++);
-      s->locflags &= ~LF_WINUPDATE;
-      s->flags |= tcp_FlagACK;
-      TCP_SEND (s);
+      maybe_reuse_localport (s);
+      _tcp_unthread (s, TRUE);
     }
+    return;
+  }
 
-    else if (s->tx_datalen > 0 || s->unhappy || s->karn_count == 1)
+  /* Need to send a window update? Because we advertised a 0 window
+   * in a previous _tcp_send() (but only in ESTAB state).
+   */
+  if ((s->locflags & LF_WINUPDATE) && sock_rbleft((sock_type*)s) > 0)
+  {
+    STAT (tcpstats.tcps_sndwinup++);
+    s->locflags &= ~LF_WINUPDATE;
+    s->flags |= tcp_FlagACK;
+    TCP_SEND (s);
+  }
+
+  else if (s->tx_datalen > 0 || s->unhappy || s->karn_count == 1)
+  {
+    if (chk_timeout(s->rtt_time))  /* retransmission timeout */
     {
-      if (chk_timeout(s->rtt_time))  /* retransmission timeout */
-      {
-        s->rtt_time = 0UL;           /* stop RTT timer */
+      s->rtt_time = 0UL;           /* stop RTT timer */
 
-        TCP_CONSOLE_MSG (3, ("Regular retran TO set unacked back to "
-                             "0 from %ld\n", s->send_una));
+      TCP_CONSOLE_MSG (3, ("Regular retran TO set unacked back to "
+                           "0 from %ld\n", s->send_una));
 
-        /* strategy handles closed windows.  JD + EE
+      /* strategy handles closed windows.  JD + EE
+       */
+      if (s->window == 0 && s->karn_count == 2)
+          s->window = 1;
+
+      if (s->karn_count == 0)
+      {
+        /* Use the backed off RTO - implied, no code necessary.
+         * Set "Slow-start" threshold to half the data in flight
+         * and restart from a window of 1 segment.
          */
-        if (s->window == 0 && s->karn_count == 2)
-            s->window = 1;
-
-        if (s->karn_count == 0)
-        {
-          /* Simple "Slow start" algorithm:
-           * Use the backed off RTO - implied, no code necessary.
-           * Reduce the congestion window by 25%
-           */
-          unsigned cwindow = ((unsigned)(s->cwindow + 1) * 3) >> 2;
-
-          s->cwindow = (BYTE) cwindow;
-          if (s->cwindow == 0)
-              s->cwindow = 1;
-
-          s->wwindow = 0;       /**< dup ACK counter ? */
-#if 0
-          /**< \todo set "Slow-start" threshold */
-          s->send_ssthresh = s->cwindow * s->max_seg;
-#endif
-          /* if really did timeout
-           */
-          s->karn_count = 2;
-          s->send_una   = 0;
-        }
-
-        if (s->tx_datalen > 0)
-        {
-          s->flags |= (tcp_FlagPUSH | tcp_FlagACK);
-          if (s->cwindow > 1)
-             s->cwindow--;
-        }
-
-        if (s->unhappy)
-           STAT (tcpstats.tcps_rexmttimeo++);  /* Normal re-xmit */
-        else if (s->flags & tcp_FlagACK)
-           STAT (tcpstats.tcps_delack++);
-
-        TCP_SEND (s);
-
-        if (s->state == tcp_StateSYNSENT)
-        {
-          /**< \todo Allow for 3 SYN before giving up
-           */
-          TCP_TRACE_MSG (("SYN (re)sent in tcp_Retransmitter(), "
-                          " rtt_time %ld\n",
-                          get_timediff(s->rtt_time,set_timeout(0))));
-        }
+        _tcp_cc_timeout (s);
+
+        /* if really did timeout
+         */
+        s->karn_count = 2;
+        s->send_una   = 0;
       }
 
-      /* handle inactive tcp timeouts (not sending data)
-       */
-      else if (chk_timeout(s->datatimer))  /* EE 99.08.23 */
+      if (s->tx_datalen > 0)
+         s->flags |= (tcp_FlagPUSH | tcp_FlagACK);
+
+      if (s->unhappy)
+         STAT (tcpstats.tcps_rexmttimeo++);  /* Normal re-xmit */
+      else if (s->flags & tcp_FlagACK)
+         STAT (tcpstats.tcps_delack++);
+
+      TCP_SEND (s);
+
+      if (s->state == tcp_StateSYNSENT)
       {
-        next = TCP_ABORT (s);
-        s->datatimer = 0UL;
-        s->err_msg   = _LANG ("Connection timed out - no data sent");
+        /**< \todo Allow for 3 SYN before giving up
+         */
+        TCP_TRACE_MSG (("SYN (re)sent in tcp_Retransmitter(), "
+                        " rtt_time %ld\n",
+                        get_timediff(s->rtt_time,set_timeout(0))));
       }
-    }  /* end of retransmission strategy */
+    }
 
+    /* handle inactive tcp timeouts (not sending data)
+     */
+    else if (chk_timeout(s->datatimer))  /* EE 99.08.23 */
+    {
+      TCP_ABORT (s);
+      s->datatimer = 0UL;
+      s->err_msg   = _LANG ("Connection timed out - no data sent");
+    }
+  }  /* end of retransmission strategy */
 
-    /* handle inactive TCP timeouts (not received anything)
+
+  /* handle inactive TCP timeouts (not received anything)
+   */
+  if (chk_timeout(s->inactive_to))
+  {
+    /* this baby has timed out. Don't do this again.
      */
-    if (chk_timeout(s->inactive_to))
+    s->inactive_to = 0UL;
+    s->err_msg     = _LANG ("Timeout, nothing received");
+    sock_close ((sock_type*)s);
+  }
+  else if (chk_timeout(s->timeout))
+  {
+    if (s->state == tcp_StateTIMEWT)
     {
-      /* this baby has timed out. Don't do this again.
-       */
-      s->inactive_to = 0UL;
-      s->err_msg     = _LANG ("Timeout, nothing received");
-      sock_close ((sock_type*)s);
+      s->state = tcp_StateCLOSED;
+      return;
     }
-    else if (chk_timeout(s->timeout))
+    if (s->state != tcp_StateESTAB && s->state != tcp_StateESTCL)
     {
-      if (s->state == tcp_StateTIMEWT)
-      {
-        s->state = tcp_StateCLOSED;
-        break;
-      }
-      if (s->state != tcp_StateESTAB && s->state != tcp_StateESTCL)
-      {
-        next = TCP_ABORT (s);
-        s->err_msg = _LANG ("Timeout, aborting");
-        break;
-      }
+      TCP_ABORT (s);
+      s->err_msg = _LANG ("Timeout, aborting");
     }
   }
 }
+
+/**
+ * Called periodically to perform retransmissions.
+ * \arg if 'force == 1' do it now.
+ *
+ * Only sockets whose timers expired are looked at; they're taken
+ * from the 'tcp_timers' wheel and put back by _tcp_timer_sched().
+ */
+void tcp_Retransmitter (BOOL force)
+{
+  timer_node *node;
+
+  static DWORD timeout = 0UL;
+
+  SIO_TRACE (("tcp_Retransmitter"));
+
+  /* do this once per tcp_RETRAN_TIME
+   */
+  if (!force && timeout && !chk_timeout(timeout))
+     return;
+
+  timeout = set_timeout (tcp_RETRAN_TIME);
+
+  if (!tcp_timers_init)
+     return;
+
+  tw_run (&tcp_timers, set_timeout(0));
+
+  while ((node = tw_pop(&tcp_timers)) != NULL)
+  {
+    _tcp_Socket *s = (_tcp_Socket*) node->arg;
+
+    tcp_timer_expired (s);
+    _tcp_timer_sched (s);
+  }
+}
 #endif /* !USE_UDP_ONLY */
 
 
@@ -1619,6 +1937,7 @@ static void sock_reduce_mss (sock_type *s, WORD MTU)
     else if (tcp->max_seg > MSS_MIN)
          tcp->max_seg -= MSS_REDUCE;
     tcp->max_seg = min (max(MSS_MIN, tcp->max_seg), _mss);
+    tcp_rtt_add (tcp, tcp->rto, tcp->max_seg + TCP_OVERHEAD);
 
     TCP_TRACE_MSG (("MSS for %s reduced to %u\n",
                     _inet_ntoa(NULL,tcp->hisaddr), tcp->max_seg));
@@ -1796,12 +2115,11 @@ void _tcp_cancel (const in_Header *ip, int icmp_type, int icmp_code,
 
       case ICMP_SOURCEQUENCH:
       quench_it:
-           s->cwindow = 1;       /* slow-down tx-rate */
-           s->wwindow = 1;
+           _tcp_cc_timeout (s);  /* slow-down tx-rate */
            s->vj_sa <<= 2;
            s->vj_sd <<= 2;
            s->rto   <<= 2;
-           tcp_rtt_add (s, s->rto, _mtu);
+           tcp_rtt_add (s, s->rto, 0);
            break;
 
       case ICMP_REDIRECT:
@@ -1910,6 +2228,7 @@ static int tcp_write (_tcp_Socket *s, const BYTE *data, UINT len)
     if (sock_data_timeout)
          s->datatimer = set_timeout (1000*sock_data_timeout); /* EE 99.08.23 */
     else s->datatimer = 0;
+    _tcp_timer_sched (s);
 
     if (s->sockmode & SOCK_MODE_LOCAL) /* queue up data, flush on next write */
     {
@@ -1987,12 +2306,13 @@ static void tcp_sockreset (_tcp_Socket *s, BOOL proxy)
   if (s->locflags & LF_IS_SERVER)
   {
     CLR_PEER_MAC_ADDR (s);
-    s->cwindow  = 1;
+    _tcp_cc_init (s);
     s->rtt_time = 0UL;
     s->unhappy  = FALSE;
     s->hisport  = 0;
     s->hisaddr  = 0UL;
     s->locflags &= ~(LF_WINUPDATE | LF_KEEPALIVE | LF_GOT_FIN | LF_GOT_ICMP);
+    _tcp_rehash (s);
 
     s->datatimer   = 0UL;
     s->inactive_to = 0;
@@ -2120,34 +2440,18 @@ static void tcp_rtt_win (_tcp_Socket *s)
      */
     s->rto = tcp_RTO_BASE + (((s->vj_sa >> 2) + (s->vj_sd)) >> 1);
 
-    tcp_rtt_add (s, s->rto, _mtu);
+    tcp_rtt_add (s, s->rto, 0);
 
     TCP_CONSOLE_MSG (2, ("RTO %u  sa %lu  sd %lu  cwindow %u"
-                     "  wwindow %u  unacked %ld\n",
+                     "  ssthresh %u  unacked %ld\n",
                      s->rto, s->vj_sa, s->vj_sd, s->cwindow,
-                     s->wwindow, s->send_una));
+                     s->ssthresh, s->send_una));
   }
 
+  /* The congestion window is opened in _tcp_cc_ack() when
+   * new data is ACK'ed.
+   */
   s->karn_count = 0;
-  if (s->wwindow != 255)
-  {
-    /** \todo Use the threshold to signify "end-of-Slow-Start" (equilibrium)
-     */
-#if 0
-    if (s->cwindow * s->max_seg < s->send_ssthresh)
-        s->cwindow++;
-#else
-
-    /* A. Iljasov (iljasov@oduurl.ru) suggested this pre-increment
-     */
-    if (++s->wwindow >= s->cwindow)
-    {
-      if (s->cwindow != 255)
-          s->cwindow++;
-      s->wwindow = 0;    /* mdurkin -- added 95.05.02 */
-    }
-#endif
-  }
 
   /* Restart RTT timer or postpone retransmission based on
    * calculated RTO. Make sure date/date_ms variables are updated
@@ -2244,6 +2548,19 @@ static __inline void finalise_md5_sign (const in_Header *ip,
 #endif
 
 
+/**
+ * Insert SACK-permitted option. We process the SACK blocks peer sends
+ * (in tcp_cc.c), but we never send any.
+ */
+static __inline int tcp_opt_sack_ok (BYTE *opt)
+{
+  *opt++ = TCPOPT_NOP;
+  *opt++ = TCPOPT_NOP;
+  *opt++ = TCPOPT_SACK_PERM;
+  *opt++ = 2;
+  return (4);
+}
+
 #if defined(NOT_USED_YET)
 /**
  * Pad options to multiple of 4 bytes.
@@ -2271,15 +2588,6 @@ static __inline int tcp_opt_winscale (const _tcp_Socket *s, BYTE *opt)
   return (4);
 }
 
-static __inline int tcp_opt_sack_ok (const _tcp_Socket *s, BYTE *opt)
-{
-  *opt++ = TCPOPT_SACKOK;
-  *opt++ = 2;
-  *opt++ = TCPOPT_NOP;
-  *opt++ = TCPOPT_NOP;
-  return (4);
-}
-
 static __inline int tcp_opt_sack (const _tcp_Socket *s, BYTE *opt,
                                   const struct SACK_list *sack)
 {
@@ -2315,11 +2623,15 @@ static __inline int tcp_options (_tcp_Socket *s, BYTE *opt, BOOL is_syn)
 
     if (tcp_opt_ts)
        len += tcp_opt_timestamp (s, opt+len, 0UL);
+
+    /* Send SACK-permitted in our SYN, or in SYN-ACK if peer sent it.
+     */
+    if (tcp_opt_sack &&
+        (!(s->flags & tcp_FlagACK) || (s->locflags & LF_SACK_PERMIT)))
+       len += tcp_opt_sack_ok (opt+len);
 #if 0
     if (s->locflags & LF_REQ_SCALE)
        len += tcp_opt_winscale (s, opt+len);
-    if (tcp_opt_sack)
-       len += tcp_opt_sack_ok (s, opt+len);
 #endif
   }
   else if (tcp_opt_ts &&
@@ -2342,9 +2654,17 @@ static __inline int tcp_options (_tcp_Socket *s, BYTE *opt, BOOL is_syn)
   return (len);
 }
 
+/*
+ * Set by _tcp_rexmit() to resend a single segment from this
+ * offset in tx_data[].
+ */
+static long rexmit_ofs = 0;
+static long rexmit_len = 0;
+
 /**
  * Format and send an outgoing TCP segment.
- * Several packets may be sent depending on peer's window.
+ * Several packets may be sent depending on peer's window and
+ * the congestion window.
  */
 int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
 {
@@ -2367,6 +2687,8 @@ int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
   int          tcp_len;          /* total length of TCP segment */
   int          opt_len;          /* total length of TCP options */
   int          pkt_num;          /* 0 .. s->cwindow-1 */
+  UINT         pkt_max;          /* max # of packets to send */
+  long         limit;            /* data allowed in flight */
   int          rtt;
 
   SIO_TRACE (("_tcp_send"));
@@ -2391,18 +2713,28 @@ int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
 
   data = (BYTE*) (tcp+1);   /* data starts here if no options */
 
-  if (s->karn_count == 2)   /* doing slow-start */
+  /* Don't send beyond peer's window or the congestion window.
+   */
+  limit = min ((long)s->tx_datalen, (long)s->window);
+  limit = min (limit, TCP_CWND_BYTES(s));
+  pkt_max = s->cwindow;
+
+  if (rexmit_len > 0)       /* fast retransmit of one segment */
+  {
+    send_tot_data = (int) rexmit_len;
+    start_data    = (int) rexmit_ofs;
+    pkt_max       = 1;
+  }
+  else if (s->karn_count == 2)   /* doing slow-start */
   {
-    send_tot_data = min (s->tx_datalen, s->window);
+    send_tot_data = (int) limit;
     start_data = 0;
   }
   else
   {
     /* Morten Terstrup <MorTer@dk-online.dk> found this signed bug
      */
-    int size = min (s->tx_datalen, s->window);
-
-    send_tot_data = size - s->send_una;
+    send_tot_data = (int) (limit - s->send_una);
     if (send_tot_data < 0)
         send_tot_data = 0;
     start_data = s->send_una;   /* relative tx_data[] */
@@ -2410,7 +2742,7 @@ int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
 
   /* step through our packets
    */
-  for (pkt_num = 0; pkt_num < s->cwindow; pkt_num++)
+  for (pkt_num = 0; pkt_num < (int)pkt_max; pkt_num++)
   {
 #if 1
     if (s->safetysig != SAFETY_TCP || s->safetytcp != SAFETY_TCP)
@@ -2523,6 +2855,20 @@ int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
     }
   }
 
+  if (rexmit_len > 0)
+  {
+    /* send_una and the timers are unchanged. Karn: no RTT sample
+     * from a retransmitted segment.
+     */
+    TCP_CONSOLE_MSG (2, ("tcp_send (called from %s/%u): resent %u bytes "
+                     "at SEQ %lu\n", file, line, send_tot_len,
+                     s->send_next + rexmit_ofs));
+    STAT (tcpstats.tcps_sndrexmitpack++);
+    STAT (tcpstats.tcps_sndrexmitbyte += send_tot_len);
+    s->vj_last = 0UL;
+    return (send_tot_len);
+  }
+
   s->send_una = start_data;  /* relative start of tx_data[] buffer */
 
   TCP_CONSOLE_MSG (2, ("tcp_send (called from %s/%u): sent %u bytes in %u "
@@ -2555,9 +2901,30 @@ int _tcp_send (_tcp_Socket *s, char *file, unsigned line)
   if (send_tot_len > 0)
      s->rtt_lasttran = s->rtt_time;
 
+  _tcp_timer_sched (s);
   return (send_tot_len);
 }
 
+/**
+ * Resend 'len' bytes of unacknowledged data starting at offset 'ofs'
+ * in tx_data[]. Used by fast retransmit and recovery in tcp_cc.c.
+ */
+int _tcp_rexmit (_tcp_Socket *s, long ofs, long len, char *file, unsigned line)
+{
+  int rc;
+
+  SIO_TRACE (("_tcp_rexmit"));
+
+  if (ofs < 0 || len <= 0 || ofs + len > s->send_una)
+     return (0);
+
+  rexmit_ofs = ofs;
+  rexmit_len = len;
+  rc = _tcp_send (s, file, line);
+  rexmit_len = 0;
+  return (rc);
+}
+
 /**
  * Format and send a reset (RST) tcp packet.
  * \note We modify the orignal segment (orig_tcp) to use it for sending.
@@ -3224,19 +3591,105 @@ int delwattcpd (void (*func)(void))
 #if !defined(USE_UDP_ONLY)
 
 /**
- * Round-trip timing cache routines.
- * These functions implement a very simple system for keeping track of
- * network performance for future use in new connections.
- * The emphasis here is on speed of update (rather than optimum cache
- * hit ratio) since tcp_rtt_add() is called every time a TCP connection
- * updates its round trip estimate.
+ * TCP metrics cache.
+ * Keeps the smoothed RTT, RTT variance, RTO, path MTU and the last
+ * congestion window and slow-start threshold of recent peers. New
+ * connections to a cached peer start from these instead of the defaults.
+ *
+ * The cache is RTT_WAYS-way set associative; a peer hashes to one set
+ * and the least recently used entry in that set is replaced. Hence
+ * tcp_rtt_add(), which is called every time a TCP connection updates
+ * its round trip estimate, only looks at a few entries. The number of
+ * entries is set by "TCP.RTT_CACHE" in WATTCP.CFG (0 disables it).
+ *
  * \note 'rto' is either in ticks or milli-sec depending on if PC has an
  *       8254 Time chip.
  *
- * These routines are modified versions from \b KA9Q by \b Phil Karn.
+ * Originally based on \b KA9Q by \b Phil Karn.
  */
-static struct tcp_rtt rtt_cache [RTTCACHE];
+static struct tcp_rtt *rtt_cache = NULL;
+static unsigned        rtt_sets  = 0;    /* # of sets, a power of 2 */
+static DWORD           rtt_clock = 0UL;  /* LRU stamp */
 
+static void tcp_rtt_exit (void)
+{
+  if (rtt_cache)
+     free (rtt_cache);
+  rtt_cache = NULL;
+  rtt_sets  = 0;
+}
+
+/*
+ * Allocate the cache on first use.
+ */
+static BOOL tcp_rtt_init (void)
+{
+  unsigned sets = 1;
+
+  if (rtt_cache)
+     return (TRUE);
+  if (tcp_rtt_size == 0)
+     return (FALSE);
+
+  while (sets * RTT_WAYS < tcp_rtt_size && sets < RTT_MAX_SETS)
+        sets <<= 1;
+
+  rtt_cache = calloc (sets * RTT_WAYS, sizeof(*rtt_cache));
+  if (!rtt_cache)
+  {
+    tcp_rtt_size = 0;      /* don't try again */
+    return (FALSE);
+  }
+  rtt_sets = sets;
+  RUNDOWN_ADD (tcp_rtt_exit, 259);
+  return (TRUE);
+}
+
+/*
+ * Only cache unicast peers. Not our network or broadcast address.
+ */
+static BOOL tcp_rtt_ok (DWORD addr)
+{
+  DWORD host = addr & ~sin_mask;
+
+  if (!addr || addr == IP_BCAST_ADDR || _ip4_is_multicast(addr))
+     return (FALSE);
+  if (((addr ^ my_ip_addr) & sin_mask) == 0 && (host == 0 || host == ~sin_mask))
+     return (FALSE);
+  return (TRUE);
+}
+
+/*
+ * Return the first entry of the set 'addr' hashes to.
+ */
+static struct tcp_rtt *tcp_rtt_set (DWORD addr)
+{
+  DWORD h = addr * 0x9E3779B1UL;
+
+  return (rtt_cache + RTT_WAYS * (unsigned)((h >> 16) & (rtt_sets-1)));
+}
+
+/*
+ * Return the entry for 'addr', or NULL if not cached.
+ */
+static struct tcp_rtt *tcp_rtt_find (DWORD addr)
+{
+  struct tcp_rtt *rtt;
+  int    i;
+
+  if (!rtt_cache || !addr)
+     return (NULL);
+
+  rtt = tcp_rtt_set (addr);
+  for (i = 0; i < RTT_WAYS; i++, rtt++)
+      if (rtt->ip == addr)
+         return (rtt);
+  return (NULL);
+}
+
+/**
+ * Save the metrics of 's'. 'MTU' is the path-MTU, 0 if unchanged.
+ */
 void tcp_rtt_add (const _tcp_Socket *s, UINT rto, UINT MTU)
 {
   struct tcp_rtt *rtt;
@@ -3244,57 +3697,633 @@ void tcp_rtt_add (const _tcp_Socket *s, UINT rto, UINT MTU)
 
   SIO_TRACE (("tcp_rtt_add"));
 
-  if (~addr & ~sin_mask)  /* 0.0.0.0 or broadcast addresses? */
+  if (!tcp_rtt_ok(addr) || !tcp_rtt_init())
      return;
 
-  rtt = &rtt_cache [(WORD)addr % RTTCACHE];
-
-  /* Cache-slot is vacant or we're updating previous RTO
-   * for same peer
-   */
-  if (!rtt->ip || rtt->ip == addr)
+  rtt = tcp_rtt_find (addr);
+  if (!rtt)
   {
-    rtt->ip  = addr;
-    rtt->rto = rto;
-    rtt->MTU = MTU;
-    STAT (tcpstats.tcps_cachedrtt++);
+    /* Take a vacant entry or the least recently used one in the set.
+     */
+    struct tcp_rtt *set = tcp_rtt_set (addr);
+    int    i;
+
+    rtt = set;
+    for (i = 1; i < RTT_WAYS && rtt->ip; i++)
+        if (!set[i].ip || (long)(set[i].used - rtt->used) < 0)
+           rtt = set + i;
+
+    if (rtt->ip)
+       STAT (tcpstats.tcps_rttcachedrop++);
+    memset (rtt, 0, sizeof(*rtt));
+    rtt->ip = addr;
   }
+
+  rtt->used     = ++rtt_clock;
+  rtt->rto      = rto;
+  rtt->vj_sa    = s->vj_sa;
+  rtt->vj_sd    = s->vj_sd;
+  rtt->cwindow  = s->cwindow;
+  rtt->ssthresh = s->ssthresh;
+  if (MTU)
+     rtt->MTU = MTU;
+
+  STAT (tcpstats.tcps_cachedrtt++);
+  STAT (tcpstats.tcps_cachedrttvar++);
+  if (s->ssthresh < TCP_MAX_CWND)
+     STAT (tcpstats.tcps_cachedssthresh++);
 }
 
-BOOL tcp_rtt_get (const _tcp_Socket *s, UINT *rto, UINT *MTU)
+/**
+ * Look for the peer of 's' in the cache. If found, start 's' with the
+ * cached SRTT, RTTVAR, RTO and slow-start threshold, reduce the MSS
+ * to fit the cached path-MTU and return the RTO in '*rto'.
+ * Call it before sending SYN or SYN-ACK.
+ *
+ * The congestion window is not reused; it's saved for diagnostics
+ * only (RFC-2140 advises against it without pacing).
+ */
+BOOL tcp_rtt_get (_tcp_Socket *s, UINT *rto)
 {
-  struct tcp_rtt *rtt = &rtt_cache [(WORD)s->hisaddr % RTTCACHE];
+  struct tcp_rtt *rtt;
 
   SIO_TRACE (("tcp_rtt_get"));
 
   STAT (tcpstats.tcps_segstimed++);
 
-  if (s->hisaddr && rtt->ip == s->hisaddr && rtt->rto > 0)
+  rtt = tcp_rtt_find (s->hisaddr);
+  if (!rtt || rtt->rto == 0)
   {
+    if (s->hisaddr && rtt_cache)
+       STAT (tcpstats.tcps_rttcachemiss++);
+    return (FALSE);
+  }
+
 #if defined(USE_DEBUG) && !defined(_MSC_VER) /* MSC6 crashes below */
-    dbug_printf ("\nRTT-cache: host %s: %ss\n\n",
-                 _inet_ntoa(NULL, rtt->ip), time_str(rtt->rto));
+  dbug_printf ("\nRTT-cache: host %s: %ss, MTU %u, cwnd %u, ssthresh %u\n\n",
+               _inet_ntoa(NULL, rtt->ip), time_str(rtt->rto), rtt->MTU,
+               rtt->cwindow, rtt->ssthresh);
 #endif
 
-    STAT (tcpstats.tcps_usedrtt++);
-    if (rto)
-       *rto = rtt->rto;
-    if (MTU)
-       *MTU = rtt->MTU;
-    return (TRUE);
+  rtt->used = ++rtt_clock;
+  s->vj_sa  = rtt->vj_sa;
+  s->vj_sd  = rtt->vj_sd;
+  s->rto    = rtt->rto;
+  STAT (tcpstats.tcps_usedrtt++);
+  STAT (tcpstats.tcps_usedrttvar++);
+
+  if (rtt->ssthresh < TCP_MAX_CWND)
+  {
+    s->ssthresh = max (rtt->ssthresh, 2);
+    STAT (tcpstats.tcps_usedssthresh++);
   }
-  return (FALSE);
+  if (rtt->MTU >= MSS_MIN + TCP_OVERHEAD && rtt->MTU < _mtu)
+     s->max_seg = min (s->max_seg, rtt->MTU - TCP_OVERHEAD);
+
+  if (rto)
+     *rto = rtt->rto;
+  return (TRUE);
 }
 
+/**
+ * Forget the peer of 's'.
+ */
 void tcp_rtt_clr (const _tcp_Socket *s)
 {
-  struct tcp_rtt *rtt = &rtt_cache [(WORD)s->hisaddr % RTTCACHE];
+  struct tcp_rtt *rtt = tcp_rtt_find (s->hisaddr);
+
+  if (rtt)
+     memset (rtt, 0, sizeof(*rtt));
+}
+#endif /* !USE_UDP_ONLY */
+
+
+#if defined(TEST_PROG)  /* a small benchmark (djgpp/Watcom/HighC) */
 
-  if (s->hisaddr && rtt->ip == s->hisaddr)
+#include <time.h>
+
+/*
+ * Replay a segment stream against 10, 100 and 1000 TCP and UDP sockets.
+ * Compares the list walk done by the demultiplexers before the hashes
+ * were added, with the hashed lookups. The stream is made up like the
+ * traffic of a busy collector; most segments belongs to an established
+ * connection, some are SYNs to a listener and some hits a closed port.
+ */
+#if (DOSX)
+  #define NUM_SEGMENTS  20000
+#else
+  #define NUM_SEGMENTS  2000
+#endif
+#define NUM_PASSES      10
+#define LOCAL_IP        0x0A000001UL   /* 10.0.0.1 */
+#define LISTEN_PORT     502
+#define CLOSED_PORT     9999
+
+struct segment {
+       DWORD source;
+       WORD  srcPort;
+       WORD  dstPort;
+       BOOL  syn;
+     };
+
+static struct segment *stream;
+
+/*
+ * Make up the stream from the connected sockets 'peer[0..num-1]'.
+ */
+static void make_stream (const DWORD *peer, const WORD *peer_port,
+                         const WORD *my_port, int num, WORD bcast_port)
+{
+  int i;
+
+  srand (1);
+  for (i = 0; i < NUM_SEGMENTS; i++)
   {
-    rtt->ip  = 0;
-    rtt->rto = 0;
-    rtt->MTU = 0;
+    struct segment *seg = stream + i;
+    int    r = rand() % 100;
+    int    j = rand() % num;
+
+    seg->syn = FALSE;
+    if (r < 90)             /* to an established connection */
+    {
+      seg->source  = peer [j];
+      seg->srcPort = peer_port [j];
+      seg->dstPort = my_port [j];
+    }
+    else if (r < 95)        /* new session */
+    {
+      seg->source  = 0x0A030000UL + j;
+      seg->srcPort = 1024 + rand() % 30000;
+      seg->dstPort = bcast_port;
+      seg->syn     = TRUE;
+    }
+    else                    /* to a closed port */
+    {
+      seg->source  = peer [j];
+      seg->srcPort = peer_port [j];
+      seg->dstPort = CLOSED_PORT;
+      seg->syn     = (r & 1);
+    }
   }
 }
-#endif /* !USE_UDP_ONLY */
+
+static void report (const char *proto, int num, clock_t walk,
+                    clock_t hashed, int errors)
+{
+  double scale = 1E6 / CLOCKS_PER_SEC / ((double)NUM_SEGMENTS * NUM_PASSES);
+
+  printf ("%-5s %5d %12.3f %12.3f %s\n", proto, num, scale * walk,
+          scale * hashed, errors ? "MISMATCH" : "");
+}
+
+#if !defined(USE_UDP_ONLY)
+static _tcp_Socket *tcp_walk (const struct segment *seg)
+{
+  _tcp_Socket *s;
+
+  for (s = _tcp_allsocs; s; s = s->next)
+      if (s->hisport && LOCAL_IP == s->myaddr && seg->source == s->hisaddr &&
+          seg->dstPort == s->myport && seg->srcPort == s->hisport)
+         return (s);
+
+  if (seg->syn)
+     for (s = _tcp_allsocs; s; s = s->next)
+         if (s->hisport == 0 && s->myport == seg->dstPort)
+            break;
+  return (s);
+}
+
+static _tcp_Socket *tcp_lookup (const struct segment *seg)
+{
+  _tcp_Socket *s = tcp_demux4 (LOCAL_IP, seg->source,
+                               seg->dstPort, seg->srcPort);
+  if (!s && seg->syn)
+     s = tcp_listener (seg->dstPort);
+  return (s);
+}
+
+static int tcp_bench (int num)
+{
+  static const WORD listen_ports[] = { 21, 23, 80, LISTEN_PORT };
+  _tcp_Socket *socks = calloc (num, sizeof(*socks));
+  DWORD       *peer  = calloc (num, sizeof(*peer));
+  WORD        *hport = calloc (num, sizeof(*hport));
+  WORD        *mport = calloc (num, sizeof(*mport));
+  clock_t      walk, hashed;
+  int          i, j, conn = 0, errors = 0;
+
+  if (!socks || !peer || !hport || !mport)
+  {
+    printf ("tcp   %5d: no memory\n", num);
+    return (1);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    _tcp_Socket *s = socks + i;
+
+    s->ip_type   = TCP_PROTO;
+    s->safetysig = SAFETY_TCP;
+    s->safetytcp = SAFETY_TCP;
+
+    if (i < DIM(listen_ports))
+    {
+      s->myport = listen_ports [i];
+      s->state  = tcp_StateLISTEN;
+    }
+    else
+    {
+      /* Every other connection is accepted on LISTEN_PORT.
+       */
+      s->myaddr  = LOCAL_IP;
+      s->myport  = (i & 1) ? LISTEN_PORT : 1024 + i;
+      s->hisaddr = 0x0A010000UL + i;
+      s->hisport = (i & 1) ? 1024 + i : 80;
+      s->state   = tcp_StateESTAB;
+      peer [conn]  = s->hisaddr;
+      hport [conn] = s->hisport;
+      mport [conn] = s->myport;
+      conn++;
+    }
+    s->next      = _tcp_allsocs;
+    _tcp_allsocs = s;
+    _tcp_hash_insert (s);
+  }
+
+  make_stream (peer, hport, mport, conn, LISTEN_PORT);
+
+  for (i = 0; i < NUM_SEGMENTS; i++)
+      if (tcp_walk(stream+i) != tcp_lookup(stream+i))
+         errors++;
+
+  walk = clock();
+  for (j = 0; j < NUM_PASSES; j++)
+      for (i = 0; i < NUM_SEGMENTS; i++)
+          tcp_walk (stream+i);
+  walk = clock() - walk;
+
+  hashed = clock();
+  for (j = 0; j < NUM_PASSES; j++)
+      for (i = 0; i < NUM_SEGMENTS; i++)
+          tcp_lookup (stream+i);
+  hashed = clock() - hashed;
+
+  report ("tcp", num, walk, hashed, errors);
+
+  _tcp_allsocs = NULL;
+  _sock_hash_reset();
+  free (mport);
+  free (hport);
+  free (peer);
+  free (socks);
+  return (errors != 0);
+}
+#endif  /* !USE_UDP_ONLY */
+
+static _udp_Socket *udp_walk (const struct segment *seg)
+{
+  _udp_Socket *s;
+
+  for (s = _udp_allsocs; s; s = s->next)
+      if (!s->is_ip6 && s->hisport != 0 &&
+          seg->dstPort == s->myport && seg->srcPort == s->hisport &&
+          (LOCAL_IP & sin_mask) == (s->myaddr & sin_mask) &&
+          seg->source == s->hisaddr)
+         return (s);
+
+  for (s = _udp_allsocs; s; s = s->next)
+      if (!s->is_ip6 && (s->hisaddr == 0 || s->hisaddr == IP_BCAST_ADDR) &&
+          seg->dstPort == s->myport)
+         return (s);
+
+  for (s = _udp_allsocs; s; s = s->next)
+      if (s->hisaddr == IP_BCAST_ADDR && seg->dstPort == s->myport)
+         break;
+  return (s);
+}
+
+static _udp_Socket *udp_lookup (const struct segment *seg)
+{
+  in_Header ip;
+  BOOL      err;
+
+  memset (&ip, 0, sizeof(ip));
+  ip.ver    = 4;
+  ip.source = intel (seg->source);
+  return udp_demux (&ip, FALSE, LOCAL_IP, seg->srcPort, seg->dstPort, &err);
+}
+
+static int udp_bench (int num)
+{
+  static const WORD bcast_ports[] = { 161, 514 };
+  _udp_Socket *socks = calloc (num, sizeof(*socks));
+  DWORD       *peer  = calloc (num, sizeof(*peer));
+  WORD        *hport = calloc (num, sizeof(*hport));
+  WORD        *mport = calloc (num, sizeof(*mport));
+  clock_t      walk, hashed;
+  int          i, j, conn = 0, errors = 0;
+
+  if (!socks || !peer || !hport || !mport)
+  {
+    printf ("udp   %5d: no memory\n", num);
+    return (1);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    _udp_Socket *s = socks + i;
+
+    s->ip_type   = UDP_PROTO;
+    s->safetysig = SAFETY_UDP;
+    s->myaddr    = LOCAL_IP;
+
+    if (i < DIM(bcast_ports))
+    {
+      s->myport  = bcast_ports [i];
+      s->hisaddr = IP_BCAST_ADDR;
+    }
+    else
+    {
+      s->myport  = 1024 + i;
+      s->hisaddr = 0x0A020000UL + i;
+      s->hisport = 161;
+      peer [conn]  = s->hisaddr;
+      hport [conn] = s->hisport;
+      mport [conn] = s->myport;
+      conn++;
+    }
+    s->next      = _udp_allsocs;
+    _udp_allsocs = s;
+    udp_hash_insert (s);
+  }
+
+  make_stream (peer, hport, mport, conn, bcast_ports[1]);
+
+  for (i = 0; i < NUM_SEGMENTS; i++)
+      if (udp_walk(stream+i) != udp_lookup(stream+i))
+         errors++;
+
+  walk = clock();
+  for (j = 0; j < NUM_PASSES; j++)
+      for (i = 0; i < NUM_SEGMENTS; i++)
+          udp_walk (stream+i);
+  walk = clock() - walk;
+
+  hashed = clock();
+  for (j = 0; j < NUM_PASSES; j++)
+      for (i = 0; i < NUM_SEGMENTS; i++)
+          udp_lookup (stream+i);
+  hashed = clock() - hashed;
+
+  report ("udp", num, walk, hashed, errors);
+
+  _udp_allsocs = NULL;
+  _sock_hash_reset();
+  free (mport);
+  free (hport);
+  free (peer);
+  free (socks);
+  return (errors != 0);
+}
+
+#if !defined(USE_UDP_ONLY)
+/*
+ * Run the timers of 100, 1000 and 10000 connections for NUM_TICKS ticks
+ * of tcp_RETRAN_TIME. Most connections are idle with an inactivity timer
+ * minutes ahead, every 20th has a short (RTO-like) timer. Compares the
+ * socket scan done by tcp_Retransmitter() before the timer wheel, with
+ * running the wheel. An expired timer is restarted with the same period.
+ */
+#define NUM_TICKS  3000
+
+static _tcp_Socket *timer_socks;
+
+static DWORD timer_period (const _tcp_Socket *s)
+{
+  DWORD i = (DWORD) (s - timer_socks);
+
+  if (i % 20 == 0)
+     return (200 + (i * 37) % 1000);           /* 0.2 - 1.2 sec */
+  return (30000UL + (i * 7919UL) % 570000UL);  /* 30 - 600 sec */
+}
+
+static long timer_scan (void)
+{
+  _tcp_Socket *s;
+  long  expired = 0;
+
+  for (s = _tcp_allsocs; s; s = s->next)
+  {
+    if (s->state == tcp_StateRESOLVE || s->state == tcp_StateCLOSED)
+       continue;
+
+    if ((s->locflags & LF_WINUPDATE) && sock_rbleft((sock_type*)s) > 0)
+       ;
+    else if (s->tx_datalen > 0 || s->unhappy || s->karn_count == 1)
+    {
+      if (!chk_timeout(s->rtt_time))
+         chk_timeout (s->datatimer);
+    }
+
+    if (chk_timeout(s->inactive_to))
+    {
+      s->inactive_to = set_timeout (timer_period(s));
+      expired++;
+    }
+    else
+      chk_timeout (s->timeout);
+  }
+  return (expired);
+}
+
+static long timer_run (void)
+{
+  timer_node *node;
+  long  expired = 0;
+
+  tw_run (&tcp_timers, set_timeout(0));
+
+  while ((node = tw_pop(&tcp_timers)) != NULL)
+  {
+    _tcp_Socket *s = (_tcp_Socket*) node->arg;
+
+    if (chk_timeout(s->inactive_to))
+    {
+      s->inactive_to = set_timeout (timer_period(s));
+      expired++;
+    }
+    _tcp_timer_sched (s);
+  }
+  return (expired);
+}
+
+static int timer_bench (int num)
+{
+  DWORD   start = user_tick_msec;
+  long    scan_exp = 0, wheel_exp = 0;
+  clock_t scan, wheel;
+  int     i;
+
+  timer_socks = calloc (num, sizeof(*timer_socks));
+  if (!timer_socks)
+  {
+    printf ("%5d: no memory\n", num);
+    return (1);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    _tcp_Socket *s = timer_socks + i;
+
+    s->ip_type     = TCP_PROTO;
+    s->safetysig   = SAFETY_TCP;
+    s->safetytcp   = SAFETY_TCP;
+    s->state       = tcp_StateESTAB;
+    s->myaddr      = LOCAL_IP;
+    s->myport      = 1024 + i;
+    s->hisaddr     = 0x0A010000UL + i;
+    s->hisport     = 80;
+    s->inactive_to = set_timeout (timer_period(s));
+    s->next        = _tcp_allsocs;
+    _tcp_allsocs   = s;
+    _tcp_hash_insert (s);
+  }
+
+  scan = clock();
+  for (i = 0; i < NUM_TICKS; i++)
+  {
+    userTimerTick (tcp_RETRAN_TIME);
+    scan_exp += timer_scan();
+  }
+  scan = clock() - scan;
+
+  /* Same again with the wheel
+   */
+  user_tick_msec = start;
+  tw_init (&tcp_timers, set_timeout(0));
+  tcp_timers_init = TRUE;
+
+  for (i = 0; i < num; i++)
+  {
+    _tcp_Socket *s = timer_socks + i;
+
+    s->inactive_to = set_timeout (timer_period(s));
+    _tcp_timer_sched (s);
+  }
+
+  wheel = clock();
+  for (i = 0; i < NUM_TICKS; i++)
+  {
+    userTimerTick (tcp_RETRAN_TIME);
+    wheel_exp += timer_run();
+  }
+  wheel = clock() - wheel;
+
+  printf ("%5d %12.3f %12.3f %8ld %s\n", num,
+          1E6 * scan / CLOCKS_PER_SEC / NUM_TICKS,
+          1E6 * wheel / CLOCKS_PER_SEC / NUM_TICKS, wheel_exp,
+          scan_exp != wheel_exp ? "MISMATCH" : "");
+
+  for (i = 0; i < num; i++)
+      tw_del (&tcp_timers, &timer_socks[i].timer);
+  _tcp_allsocs = NULL;
+  _sock_hash_reset();
+  free (timer_socks);
+  return (scan_exp != wheel_exp);
+}
+
+/*
+ * Open NUM_CONNECT connections to NUM_PEERS peers, some more popular
+ * than others, and compare the hit ratio of the metrics cache with the
+ * old 16 entry direct-mapped RTT cache. The peers are 192.168.x.1 (say
+ * routers), which all went into the same slot of the old cache.
+ */
+#define NUM_CONNECT  10000
+#define NUM_PEERS    48
+
+static int rtt_bench (void)
+{
+  static DWORD old_cache [16];
+  _tcp_Socket  s;
+  long  old_hits = 0, new_hits = 0;
+  int   i;
+
+  memset (&s, 0, sizeof(s));
+  srand (1);
+
+  for (i = 0; i < NUM_CONNECT; i++)
+  {
+    int    j    = (rand() % NUM_PEERS) * (rand() % NUM_PEERS) / NUM_PEERS;
+    DWORD  peer = 0xC0A80001UL + ((DWORD)j << 8);
+    DWORD *old  = &old_cache [(WORD)peer % DIM(old_cache)];
+    UINT   rto;
+
+    if (*old == peer)
+       old_hits++;
+    else if (!*old)
+       *old = peer;
+
+    s.hisaddr  = peer;
+    s.max_seg  = _mss;
+    s.ssthresh = TCP_MAX_CWND;
+    if (tcp_rtt_get(&s, &rto))
+       new_hits++;
+    s.vj_sa = 8 * (100 + j);
+    tcp_rtt_add (&s, 100 + j, 0);
+  }
+
+  printf ("\n%d connections to %d peers. RTT cache hits:\n",
+          NUM_CONNECT, NUM_PEERS);
+  printf ("direct-mapped (16):   %5.1f%%\n", 100.0 * old_hits / NUM_CONNECT);
+  printf ("%d-way LRU (%u):       %5.1f%%\n", RTT_WAYS, tcp_rtt_size,
+          100.0 * new_hits / NUM_CONNECT);
+  return (new_hits < old_hits);
+}
+#endif  /* !USE_UDP_ONLY */
+
+int main (void)
+{
+  static const int sizes[] = { 10, 100, 1000 };
+  int   i, rc = 0;
+
+  stream = calloc (NUM_SEGMENTS, sizeof(*stream));
+  if (!stream)
+  {
+    puts ("no memory");
+    return (1);
+  }
+
+  printf ("%d segments, %d passes. Time per lookup:\n", NUM_SEGMENTS, NUM_PASSES);
+  printf ("proto  socks    walk (us)  hashed (us)\n");
+
+  for (i = 0; i < DIM(sizes); i++)
+  {
+#if !defined(USE_UDP_ONLY)
+    rc |= tcp_bench (sizes[i]);
+#endif
+    rc |= udp_bench (sizes[i]);
+  }
+  free (stream);
+
+#if !defined(USE_UDP_ONLY)
+  {
+    static const int conns[] = { 100, 1000,
+#if (DOSX)
+                                 10000
+#endif
+                               };
+
+    init_userSuppliedTimerTick();
+    userTimerTick (1000);
+
+    printf ("\n%d ticks of %u ms. Time per tick:\n", NUM_TICKS, tcp_RETRAN_TIME);
+    printf ("socks    scan (us)   wheel (us)  expired\n");
+
+    for (i = 0; i < DIM(conns); i++)
+        rc |= timer_bench (conns[i]);
+  }
+  rc |= rtt_bench();
+#endif
+  return (rc);
+}
+#endif  /* TEST_PROG */
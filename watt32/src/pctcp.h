@@ -19,6 +19,7 @@
 #define DEF_RST_TIME      100UL     /* # of msec before sending RST */
 #define DEF_RETRAN_TIME   10UL      /* do retransmit logic every 10ms */
 #define DEF_RECV_WIN     (16*1024)  /* default receive window, 16kB */
+#define DEF_RTT_CACHE     64        /* default # of TCP metrics cache entries */
 #define MAX_DAEMONS       20        /* max # of background daemons */
 #define DAEMON_PERIOD     500       /* run daemons every 500msec */
 
@@ -115,6 +116,7 @@
 #define tcp_opt_sack    NAMESPACE (tcp_opt_sack)
 #define tcp_opt_wscale  NAMESPACE (tcp_opt_wscale)
 #define tcp_recv_win    NAMESPACE (tcp_recv_win)
+#define tcp_rtt_size    NAMESPACE (tcp_rtt_size)
 
 W32_DATA unsigned _mtu, _mss;
 W32_DATA DWORD    my_ip_addr;
@@ -133,6 +135,7 @@ extern BOOL tcp_nagle;
 extern BOOL tcp_opt_ts;
 extern BOOL tcp_opt_sack;
 extern BOOL tcp_opt_wscale;
+extern unsigned tcp_rtt_size;
 
 extern _tcp_Socket *_tcp_allsocs;
 extern _udp_Socket *_udp_allsocs;
@@ -172,18 +175,26 @@ extern void _tcp_cancel (const in_Header*, int, int, const char *, const void *)
 extern void _tcp_close    (_tcp_Socket *s);
 extern void  tcp_rtt_add  (const _tcp_Socket *s, UINT rto, UINT MTU);
 extern void  tcp_rtt_clr  (const _tcp_Socket *s);
-extern BOOL  tcp_rtt_get  (const _tcp_Socket *s, UINT *rto, UINT *MTU);
+extern BOOL  tcp_rtt_get  (_tcp_Socket *s, UINT *rto);
 
 extern int   tcp_established (const _tcp_Socket *s);
 extern int  _tcp_send        (_tcp_Socket *s, char *file, unsigned line);
 extern int  _tcp_sendsoon    (_tcp_Socket *s, char *file, unsigned line);
+extern int  _tcp_rexmit      (_tcp_Socket *s, long ofs, long len,
+                              char *file, unsigned line);
 extern int  _tcp_keepalive   (_tcp_Socket *s);
 
 extern void tcp_Retransmitter (BOOL force);
+extern void _tcp_timer_sched  (_tcp_Socket *s);
 
 extern _udp_Socket *_udp_handler  (const in_Header *ip, BOOL broadcast);
 extern _tcp_Socket *_tcp_handler  (const in_Header *ip, BOOL broadcast);
 extern _tcp_Socket *_tcp_unthread (_tcp_Socket *s, BOOL free_tx);
+extern void         _tcp_hash_insert (_tcp_Socket *s);
+extern void         _tcp_hash_remove (_tcp_Socket *s);
+extern void         _tcp_rehash      (_tcp_Socket *s);
+extern void         _udp_rehash      (_udp_Socket *s);
+extern void         _sock_hash_reset (void);
 extern _tcp_Socket *_tcp_abort    (_tcp_Socket *s, const char *file, unsigned line);
 extern int          _tcp_send_reset (_tcp_Socket *s, const in_Header *ip,
                                      const tcp_Header *tcp, const char *file,
@@ -191,6 +202,8 @@ extern int          _tcp_send_reset (_tcp_Socket *s, const in_Header *ip,
 
 #define TCP_SEND(s)     _tcp_send     (s, __FILE__, __LINE__)
 #define TCP_SENDSOON(s) _tcp_sendsoon (s, __FILE__, __LINE__)
+#define TCP_REXMIT(s,ofs,len) \
+                        _tcp_rexmit   (s, ofs, len, __FILE__, __LINE__)
 #define TCP_ABORT(s)    _tcp_abort    (s, __FILE__, __LINE__)
 
 #define TCP_SEND_RESET(s, ip, tcp) \
@@ -253,15 +266,26 @@ W32_FUNC int MS_CDECL sock_scanf (sock_type *s, const char *fmt, ...)
 
 /*!\struct tcp_rtt
  *
- * A simple RTT cache based on Phil Karn's KA9Q.
+ * An entry in the TCP metrics cache (per destination).
  */
 struct tcp_rtt {
-       DWORD  ip;     /**< IP-address of this entry */
-       UINT   rto;    /**< Round-trip timeout for this entry */
-       UINT   MTU;    /**< Path-MTU discovered for this entry */
+       DWORD  ip;        /**< IP-address of this entry, 0 if vacant */
+       DWORD  vj_sa;     /**< smoothed RTT (SRTT) */
+       DWORD  vj_sd;     /**< RTT variance (RTTVAR) */
+       DWORD  used;      /**< LRU stamp */
+       UINT   rto;       /**< Round-trip timeout for this entry */
+       UINT   MTU;       /**< Path-MTU discovered for this entry */
+       UINT   cwindow;   /**< last congestion window (segments) */
+       UINT   ssthresh;  /**< last slow-start threshold (segments) */
      };
 
-#define RTTCACHE  16  /**< # of TCP round-trip-time cache entries */
+#define RTT_WAYS      4     /**< # of entries per set in the metrics cache */
+
+#if (DOSX)
+  #define RTT_MAX_SETS  1024  /**< max # of sets in the metrics cache */
+#else
+  #define RTT_MAX_SETS  512   /**< max # that will fit in 64 kB */
+#endif
 
 
 #if defined(USE_BSD_API)
@@ -452,6 +452,7 @@ static void tcp_shutdown (void)
   _tcp_allsocs = NULL;
 #endif
   _udp_allsocs = NULL;
+  _sock_hash_reset();
 
 #if defined(USE_DHCP)
   /*
@@ -40,6 +40,7 @@
 #include "pcdbug.h"
 #include "pcicmp6.h"
 #include "udp_dom.h"
+#include "tcp_cc.h"
 
 #if defined(USE_BSD_API)
 
@@ -2083,8 +2084,6 @@ int _TCP6_open (Socket *socket, const void *dst, WORD loc_port, WORD rem_port)
   tcp->state        = tcp_StateSYNSENT;
   tcp->ip_type      = TCP_PROTO;
   tcp->max_seg      = _mss;        /** \todo use mss from setsockopt() */
-  tcp->cwindow      = 1;
-  tcp->wwindow      = 0;                           /* slow start VJ algorithm */
   tcp->vj_sa        = INIT_VJSA;
   tcp->rto          = tcp_OPEN_TO;                 /* added 14-Dec 1999, GV */
   tcp->myaddr       = my_ip_addr;
@@ -2097,6 +2096,7 @@ int _TCP6_open (Socket *socket, const void *dst, WORD loc_port, WORD rem_port)
   tcp->unhappy      = TRUE;
   tcp->protoHandler = NULL;
   tcp->usr_yield    = NULL;
+  _tcp_cc_init (tcp);                              /* slow start */
 
   tcp->safetysig    = SAFETY_TCP;                /* marker signatures */
   tcp->safetytcp    = SAFETY_TCP;
@@ -2105,6 +2105,7 @@ int _TCP6_open (Socket *socket, const void *dst, WORD loc_port, WORD rem_port)
 /* sock_yield (tcp, tcp6_yield); */ /**< \todo Yield for IPv6 sockets */
 
   _tcp_allsocs    = tcp;
+  _tcp_hash_insert (tcp);
 
   /** \todo use TCP_NODELAY set in setsockopt()
    */
@@ -2118,9 +2119,10 @@ int _TCP6_open (Socket *socket, const void *dst, WORD loc_port, WORD rem_port)
 
   /* find previous RTT replacing RTT set in tcp_send() above
    */
-  if (tcp_rtt_get(tcp, &rtt, NULL))
+  if (tcp_rtt_get(tcp, &rtt))
        tcp->rtt_time = set_timeout (rtt);
   else tcp->rtt_time = set_timeout (tcp_OPEN_TO);
+  _tcp_timer_sched (tcp);
   return (1);
 }
 
@@ -0,0 +1,343 @@
+/*!\file tcp_cc.c
+ *
+ * TCP congestion control.
+ *
+ * Slow start and congestion avoidance (RFC-5681), fast retransmit
+ * and fast recovery with the NewReno modification (RFC-6582). If the
+ * peer sends SACK blocks (RFC-2018), holes below the highest SACK'ed
+ * SEQ are resent during recovery instead of waiting for partial ACKs.
+ *
+ * The congestion window 'cwindow' and 'ssthresh' are counted in
+ * segments of 's->max_seg' bytes. _tcp_send() limits the data in
+ * flight to TCP_CWND_BYTES().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wattcp.h"
+#include "strings.h"
+#include "misc.h"
+#include "pcconfig.h"
+#include "pcstat.h"
+#include "pcdbug.h"
+#include "pctcp.h"
+#include "tcp_cc.h"
+
+#if !defined(USE_UDP_ONLY)
+
+/**
+ * Initial window from the MSS (RFC-3390).
+ */
+static UINT initial_window (UINT max_seg)
+{
+  if (max_seg > 2190)
+     return (2);
+  if (max_seg > 1095)
+     return (3);
+  return (4);
+}
+
+/**
+ * Slow-start threshold after a loss; half the data in flight,
+ * but at least 2 segments.
+ */
+static UINT half_flight (const _tcp_Socket *s, long flight)
+{
+  long segs = s->max_seg ? flight / (long)s->max_seg : 0;
+
+  return (UINT) max (segs / 2, 2);
+}
+
+/**
+ * Drop SACK blocks covered by a new cumulative ACK.
+ */
+static void sack_trim (_tcp_Socket *s)
+{
+  int i, j;
+
+  for (i = j = 0; i < s->num_sack; i++)
+  {
+    if (SEQ_LEQ(s->sack_right[i], s->send_next))
+       continue;
+    s->sack_left[j]  = s->sack_left[i];
+    s->sack_right[j] = s->sack_right[i];
+    if (SEQ_LT(s->sack_left[j], s->send_next))
+       s->sack_left[j] = s->send_next;
+    j++;
+  }
+  s->num_sack = (BYTE) j;
+}
+
+/**
+ * Find the next hole to resend, starting at 's->rexmit_next'.
+ * Only holes below a SACK'ed block are considered lost.
+ * Returns length of hole (at most one segment) and sets '*seq'.
+ */
+static long sack_next_hole (const _tcp_Socket *s, DWORD *seq)
+{
+  DWORD start = s->rexmit_next;
+  DWORD end;
+  BOOL  found;
+  int   i;
+
+  if (SEQ_LT(start, s->send_next))
+     start = s->send_next;
+
+  /* skip past blocks covering 'start'
+   */
+  do
+  {
+    found = FALSE;
+    for (i = 0; i < s->num_sack; i++)
+        if (SEQ_LEQ(s->sack_left[i], start) &&
+            SEQ_GT(s->sack_right[i], start))
+        {
+          start = s->sack_right[i];
+          found = TRUE;
+        }
+  }
+  while (found);
+
+  /* the hole ends at the nearest block above it
+   */
+  found = FALSE;
+  end   = 0;
+  for (i = 0; i < s->num_sack; i++)
+      if (SEQ_GT(s->sack_left[i], start) &&
+          (!found || SEQ_LT(s->sack_left[i], end)))
+      {
+        end   = s->sack_left[i];
+        found = TRUE;
+      }
+
+  if (!found)
+     return (0);
+
+  *seq = start;
+  return min ((long)(end - start), (long)s->max_seg);
+}
+
+/**
+ * Resend the next lost segment. Use the SACK scoreboard if we have
+ * one, otherwise the first unacknowledged segment (NewReno).
+ */
+static BOOL resend_lost (_tcp_Socket *s)
+{
+  DWORD seq = s->send_next;
+  long  len;
+
+  if (s->num_sack > 0)
+       len = sack_next_hole (s, &seq);
+  else len = min (s->send_una, (long)s->max_seg);
+
+  if (len <= 0)
+     return (FALSE);
+
+  s->rexmit_next = seq + len;
+  s->fast_rexmit++;
+  TCP_REXMIT (s, (long)(seq - s->send_next), len);
+  return (TRUE);
+}
+
+/**
+ * Set initial congestion state of a new connection.
+ * Called after 's->max_seg' and 's->send_next' are set.
+ */
+void _tcp_cc_init (_tcp_Socket *s)
+{
+  s->cwindow     = initial_window (s->max_seg);
+  s->wwindow     = 0;
+  s->ssthresh    = TCP_MAX_CWND;
+  s->dup_acks    = 0;
+  s->in_recovery = FALSE;
+  s->num_sack    = 0;
+  s->recover     = s->send_next;
+  s->rexmit_next = s->send_next;
+}
+
+/**
+ * Peer ACK'ed 'acked' bytes of new data. 'flight' is the amount of
+ * data that was outstanding before this ACK.
+ * Called after tcp_process_ACK() has advanced 's->send_next'.
+ */
+void _tcp_cc_ack (_tcp_Socket *s, long acked, long flight)
+{
+  s->dup_acks = 0;
+  sack_trim (s);
+
+  if (s->in_recovery)
+  {
+    if (SEQ_GEQ(s->send_next, s->recover))
+    {
+      /* Full ACK; deflate the window and leave recovery.
+       */
+      s->cwindow     = s->ssthresh;
+      s->wwindow     = 0;
+      s->in_recovery = FALSE;
+      s->num_sack    = 0;
+      TCP_CONSOLE_MSG (2, ("tcp_cc: recovery done, cwindow %u\n",
+                       s->cwindow));
+    }
+    else
+    {
+      /* Partial ACK; the next segment is lost too. Deflate by the
+       * amount ACK'ed, add back one segment and resend it.
+       */
+      UINT segs = (UINT) (acked / (long)s->max_seg);
+
+      s->cwindow = (s->cwindow > segs) ? s->cwindow - segs : 0;
+      s->cwindow++;
+      resend_lost (s);
+    }
+    return;
+  }
+
+  /* Only grow the window if it limited what we could send.
+   */
+  if (flight + (long)s->max_seg <= TCP_CWND_BYTES(s) ||
+      s->cwindow >= TCP_MAX_CWND)
+     return;
+
+  if (s->cwindow < s->ssthresh)    /* slow start */
+  {
+    s->cwindow++;
+  }
+  else if (++s->wwindow >= s->cwindow) /* congestion avoidance */
+  {
+    s->cwindow++;
+    s->wwindow = 0;
+  }
+}
+
+/**
+ * Got a duplicate ACK; an ACK for 's->send_next' without data, SYN,
+ * FIN or window change while data is outstanding.
+ */
+void _tcp_cc_dupack (_tcp_Socket *s)
+{
+  STAT (tcpstats.tcps_rcvdupack++);
+
+  if (s->dup_acks < 255)
+      s->dup_acks++;
+
+  if (s->in_recovery)
+  {
+    /* Each dup-ACK means a segment left the network. With SACK, use
+     * it to resend the next hole. Otherwise inflate the window so new
+     * data can be sent.
+     */
+    if (s->num_sack > 0 && resend_lost(s))
+       return;
+
+    if (s->cwindow < TCP_MAX_CWND)
+       s->cwindow++;
+    if ((long)s->tx_datalen > s->send_una &&
+        TCP_CWND_BYTES(s) > s->send_una)
+       TCP_SEND (s);
+    return;
+  }
+
+  if (s->dup_acks != TCP_DUPACK_THRESH)
+     return;
+
+  /* Don't restart recovery for losses in the window that had a
+   * retransmission timeout or fast retransmit already.
+   */
+  if (SEQ_LT(s->send_next, s->recover))
+     return;
+
+  s->ssthresh    = half_flight (s, s->send_una);
+  s->recover     = s->send_next + s->send_una;
+  s->rexmit_next = s->send_next;
+  s->in_recovery = TRUE;
+
+  TCP_CONSOLE_MSG (2, ("tcp_cc: fast retransmit, ssthresh %u, "
+                   "%d SACK blocks\n", s->ssthresh, s->num_sack));
+
+  resend_lost (s);
+  s->cwindow = s->ssthresh + TCP_DUPACK_THRESH;
+  s->wwindow = 0;
+}
+
+/**
+ * Retransmission timeout (or ICMP source quench). Restart in
+ * slow start and forget the SACK scoreboard (the peer may renege).
+ * Called before 's->send_una' is reset.
+ */
+void _tcp_cc_timeout (_tcp_Socket *s)
+{
+  s->ssthresh    = half_flight (s, s->send_una);
+  s->recover     = s->send_next + s->send_una;
+  s->rexmit_next = s->send_next;
+  s->cwindow     = 1;
+  s->wwindow     = 0;
+  s->dup_acks    = 0;
+  s->in_recovery = FALSE;
+  s->num_sack    = 0;
+}
+
+/**
+ * Merge the blocks of a received SACK option into the scoreboard.
+ * 'opt' points to the first block, 'len' is the length of blocks.
+ * The scoreboard is kept sorted on left edge without overlaps.
+ */
+void _tcp_cc_sack (_tcp_Socket *s, const BYTE *opt, int len)
+{
+  DWORD high = s->send_next + s->send_una;  /* highest SEQ sent + 1 */
+
+  for ( ; len >= 8; len -= 8, opt += 8)
+  {
+    DWORD left  = intel (*(DWORD*)opt);
+    DWORD right = intel (*(DWORD*)(opt+4));
+    int   i, j;
+
+    if (SEQ_LEQ(right, s->send_next) || SEQ_GT(right, high) ||
+        SEQ_GEQ(left, right))
+       continue;                /* old, bogus or D-SACK block */
+
+    if (SEQ_LT(left, s->send_next))
+       left = s->send_next;
+
+    /* find insert position, then absorb overlapping blocks
+     */
+    for (i = 0; i < s->num_sack; i++)
+        if (SEQ_GEQ(s->sack_right[i], left))
+           break;
+
+    for (j = i; j < s->num_sack && SEQ_LEQ(s->sack_left[j], right); j++)
+    {
+      if (SEQ_LT(s->sack_left[j], left))
+         left = s->sack_left[j];
+      if (SEQ_GT(s->sack_right[j], right))
+         right = s->sack_right[j];
+    }
+
+    if (j == i)   /* no overlap; make room, dropping the highest block */
+    {
+      if (s->num_sack == TCP_MAX_SACK)
+      {
+        if (i == TCP_MAX_SACK)
+           continue;
+        s->num_sack--;
+      }
+      memmove (s->sack_left+i+1, s->sack_left+i,
+               (s->num_sack-i) * sizeof(DWORD));
+      memmove (s->sack_right+i+1, s->sack_right+i,
+               (s->num_sack-i) * sizeof(DWORD));
+      s->num_sack++;
+    }
+    else if (j > i+1)  /* merged several; close the gap */
+    {
+      memmove (s->sack_left+i+1, s->sack_left+j,
+               (s->num_sack-j) * sizeof(DWORD));
+      memmove (s->sack_right+i+1, s->sack_right+j,
+               (s->num_sack-j) * sizeof(DWORD));
+      s->num_sack -= (BYTE) (j-i-1);
+    }
+    s->sack_left[i]  = left;
+    s->sack_right[i] = right;
+  }
+}
+#endif  /* !USE_UDP_ONLY */
@@ -0,0 +1,29 @@
+/*!\file tcp_cc.h
+ */
+#ifndef _w32_TCP_CC_H
+#define _w32_TCP_CC_H
+
+/**
+ * Upper limit for the congestion window and initial slow-start
+ * threshold (in segments). Effectively "arbitrarily high" since the
+ * peer's window is never above MAX_WINDOW.
+ */
+#define TCP_MAX_CWND  4096
+
+/**
+ * # of duplicate ACKs that triggers a fast retransmit (RFC-5681).
+ */
+#define TCP_DUPACK_THRESH  3
+
+extern void _tcp_cc_init    (_tcp_Socket *s);
+extern void _tcp_cc_ack     (_tcp_Socket *s, long acked, long flight);
+extern void _tcp_cc_dupack  (_tcp_Socket *s);
+extern void _tcp_cc_timeout (_tcp_Socket *s);
+extern void _tcp_cc_sack    (_tcp_Socket *s, const BYTE *opt, int len);
+
+/**
+ * Number of bytes the congestion window allows in flight.
+ */
+#define TCP_CWND_BYTES(s)  ((long)(s)->cwindow * (s)->max_seg)
+
+#endif
@@ -29,6 +29,7 @@
 #include "pcdbug.h"
 #include "pcstat.h"
 #include "pctcp.h"
+#include "tcp_cc.h"
 
 #if !defined(USE_UDP_ONLY)
 
@@ -59,6 +60,8 @@ static int  tcp_timewt_state  (_tcp_Socket**, const in_Header*, tcp_Header*, int
 static int  tcp_process_data (_tcp_Socket *s, const tcp_Header *tcp, int len, int *flags);
 static void tcp_set_window   (_tcp_Socket *s, const tcp_Header *tcp);
 static int  tcp_process_ACK  (_tcp_Socket *s, long *unack);
+static void tcp_process_options (_tcp_Socket *s, const tcp_Header *tcp,
+                                 const BYTE *tcp_data, int flags);
 
 static tcp_StateProc tcp_state_tab [] = {
   tcp_listen_state,   /* tcp_StateLISTEN  : listening for connection */
@@ -179,6 +182,15 @@ static int tcp_listen_state (_tcp_Socket **sp, const in_Header *ip,
     if (is_ip4 && ip->tos > s->tos)
        s->tos = ip->tos;
 
+    if (is_ip4)
+       tcp_rtt_get (s, NULL);   /* start from cached RTT, ssthresh and MTU */
+
+    /* Need peer's MSS and SACK-permitted before we reply
+     */
+    if (tcp->offset > sizeof(*tcp)/4)
+       tcp_process_options (s, tcp, (const BYTE*)tcp + (tcp->offset << 2),
+                            flags);
+
     s->recv_next = seqnum + 1;
     s->flags     = flag_SYN_ACK;
     s->state     = tcp_StateSYNREC;
@@ -334,9 +346,11 @@ static int tcp_estab_state (_tcp_Socket **sp, const in_Header *ip,
 {
   const in6_Header *ip6 = (const in6_Header*) ip;
   _tcp_Socket      *s   = *sp;
-  int   len;
+  int   len, rc;
   long  ldiff;      /* how much still ACK'ed */
-  BOOL  did_tx;
+  long  flight;     /* unacked data before this ACK */
+  UINT  window;     /* peer's window before this segment */
+  BOOL  ack_ok, did_tx;
 
   /* handle lost SYN
    */
@@ -352,7 +366,10 @@ static int tcp_estab_state (_tcp_Socket **sp, const in_Header *ip,
 
   s->timeout = 0UL;             /* we do not timeout at this point */
 
-  if (!tcp_process_ACK(s,&ldiff))
+  flight = s->send_una;
+  window = s->window;
+  ack_ok = tcp_process_ACK (s, &ldiff);
+  if (!ack_ok)
   {
     TCP_CONSOLE_MSG (2, ("_tcp_fsm() confused so set unacked "
                      "back to 0 from %ld\n", s->send_una));
@@ -369,7 +386,19 @@ static int tcp_estab_state (_tcp_Socket **sp, const in_Header *ip,
        len = intel16 (ip->length) - in_GetHdrLen (ip);
   else len = intel16 (ip6->len);
 
-  if (tcp_process_data (s, tcp, len, &flags) < 0)
+  rc = tcp_process_data (s, tcp, len, &flags);
+
+  /* Congestion control after SACK options are processed. A duplicate
+   * ACK has no data, SYN/FIN or window change and data is outstanding.
+   */
+  if (ack_ok && ldiff > 0)
+     _tcp_cc_ack (s, ldiff, flight);
+  else if (ack_ok && ldiff == 0 && s->send_una > 0 &&
+           len == (tcp->offset << 2) && s->window == window &&
+           !(flags & (tcp_FlagSYN|tcp_FlagFIN)))
+     _tcp_cc_dupack (s);
+
+  if (rc < 0)
   {
     TCP_SEND (s);  /* An out-of-order or missing segment; do fast ACK */
     return (1);
@@ -771,10 +800,26 @@ static void tcp_process_options (_tcp_Socket *s, const tcp_Header *tcp,
 
       case TCPOPT_SACK_PERM:
            if (flags & tcp_FlagSYN)
-              s->locflags |= LF_SACK_PERMIT;  /* no effect yet */
+              s->locflags |= LF_SACK_PERMIT;
            opt += 2;
            break;
 
+      case TCPOPT_SACK:     /* SACK,length,left,right,.. */
+           {
+             int len = *(opt+1);
+
+             /* Don't trust the length; the blocks must fit in the
+              * option space and be a whole number of edges.
+              */
+             if (len < 2 || len > tcp_data - opt)
+                return;
+             if (tcp_opt_sack && (s->locflags & LF_SACK_PERMIT) &&
+                 ((len - 2) % 8) == 0)
+                _tcp_cc_sack (s, opt+2, len - 2);
+             opt += len;
+           }
+           break;
+
       case TCPOPT_CHKSUM_REQ:
            opt += 3;
            break;
@@ -1156,11 +1201,6 @@ static void tcp_set_window (_tcp_Socket *s, const tcp_Header *tcp)
   if (s->window > MAX_WINDOW)
       s->window = MAX_WINDOW;
 
-#if 0  /** \todo Set slow-start threshold */
-  if (s->send_ssthresh == 0)
-     s->send_ssthresh = s->window;
-#endif
-
   if (s->tx_data == &s->tx_buf[0] &&  /* Tx-data in _tcp_Socket */
       s->window > s->max_tx_data)     /* His window > our Tx-size */
   {
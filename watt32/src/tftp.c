@@ -328,6 +328,7 @@ static int tftp_open (DWORD server, const char *fname)
      * socket in udp_handler().
      */
     sock->udp.hisaddr = 0;
+    _udp_rehash (&sock->udp);
 
     ibuflen = recv_packet (1);
     if (ibuflen >= 0)
@@ -638,6 +638,189 @@ double filetime_sec (const void *filetime)
 }
 #endif
 
+/*
+ * Timer wheel.
+ *
+ * Nodes that expire less than TW_SLOTS units ahead are kept in the level 0
+ * slot of their expiry time. Nodes further ahead go to a higher level, where
+ * each slot spans TW_SLOTS times as many units as a slot on the level below.
+ * When level 0 wraps, the next slot on level 1 is moved down one level (and
+ * so on upwards). tw_run() moves expired nodes to the 'due' list, where
+ * tw_pop() picks them up. Adding, deleting and expiring a node are O(1).
+ *
+ * Times are in set_timeout() units and compared as signed differences.
+ * Nodes further ahead than the wheel can hold are put in the last slot,
+ * so they may expire early. Users should check their own timers when a
+ * node expires.
+ */
+#define TW_MASK     (TW_SLOTS - 1)
+#define TW_SPAN(n)  (1UL << (TW_BITS * (n)))   /* units spanned by level 'n-1' */
+
+static void tw_link (struct timer_wheel *tw, timer_node **head,
+                     timer_node *node, int level)
+{
+  node->next  = *head;
+  node->pprev = head;
+  node->level = (WORD) level;
+  if (*head)
+     (*head)->pprev = &node->next;
+  *head = node;
+  tw->count [level]++;
+}
+
+/**
+ * Start an empty wheel at time 'now'.
+ */
+void tw_init (struct timer_wheel *tw, DWORD now)
+{
+  memset (tw, 0, sizeof(*tw));
+  tw->now = now;
+}
+
+/**
+ * Remove 'node' from the wheel (if it's in it).
+ */
+void tw_del (struct timer_wheel *tw, timer_node *node)
+{
+  if (!node->pprev)
+     return;
+
+  *node->pprev = node->next;
+  if (node->next)
+     node->next->pprev = node->pprev;
+  node->next  = NULL;
+  node->pprev = NULL;
+  tw->count [node->level]--;
+}
+
+/**
+ * (Re)insert 'node' to expire at time 'expire'.
+ */
+void tw_add (struct timer_wheel *tw, timer_node *node, DWORD expire)
+{
+  long diff;
+  int  level;
+
+  tw_del (tw, node);
+
+  diff = (long) (expire - tw->now);
+  if (diff < 0)
+  {
+    node->expire = expire;
+    tw_link (tw, &tw->due, node, TW_LEVELS);
+    return;
+  }
+
+  if ((DWORD)diff >= TW_SPAN(TW_LEVELS))
+  {
+    diff   = (long) (TW_SPAN(TW_LEVELS) - 1);
+    expire = tw->now + diff;
+  }
+
+  for (level = 0; (DWORD)diff >= TW_SPAN(level+1); level++)
+      ;
+
+  node->expire = expire;
+  tw_link (tw, &tw->slot[level][(expire >> (TW_BITS*level)) & TW_MASK],
+           node, level);
+}
+
+/*
+ * Move the nodes in slot 'idx' of 'level' down the wheel.
+ * Returns 'idx' so the caller knows if 'level' wrapped too.
+ */
+static int tw_cascade (struct timer_wheel *tw, int level, int idx)
+{
+  timer_node *node;
+
+  while ((node = tw->slot[level][idx]) != NULL)
+        tw_add (tw, node, node->expire);
+  return (idx);
+}
+
+/**
+ * Advance the wheel to time 'now'. Nodes that expired are
+ * moved to the due list.
+ */
+void tw_run (struct timer_wheel *tw, DWORD now)
+{
+  long ahead = (long) (now - tw->now);
+
+  /* The clock stepped further than the wheel reaches (or backwards).
+   * Expire everything; the users will reschedule.
+   */
+  if (ahead >= (long)TW_SPAN(TW_LEVELS) || ahead < -(long)TW_SPAN(TW_LEVELS))
+  {
+    int level, idx;
+
+    for (level = 0; level < TW_LEVELS; level++)
+        for (idx = 0; idx < TW_SLOTS; idx++)
+        {
+          timer_node *node;
+
+          while ((node = tw->slot[level][idx]) != NULL)
+          {
+            tw_del (tw, node);
+            tw_link (tw, &tw->due, node, TW_LEVELS);
+          }
+        }
+    tw->now = now + 1;
+    return;
+  }
+
+  while ((long)(now - tw->now) >= 0)
+  {
+    timer_node *node;
+    int   idx = (int) (tw->now & TW_MASK);
+    int   level;
+
+    if (tw->count[0] + tw->count[1] + tw->count[2] + tw->count[3] == 0)
+    {
+      tw->now = now + 1;     /* wheel is empty */
+      break;
+    }
+
+    if (idx == 0)
+       for (level = 1; level < TW_LEVELS; level++)
+           if (tw_cascade(tw, level, (int)((tw->now >> (TW_BITS*level)) & TW_MASK)))
+              break;
+
+    /* Nothing on level 0; skip to where the wheel wraps (or 'now').
+     */
+    if (tw->count[0] == 0)
+    {
+      DWORD wrap = (tw->now | TW_MASK) + 1;
+
+      if ((long)(wrap - now) > 0)
+      {
+        tw->now = now + 1;
+        break;
+      }
+      tw->now = wrap;
+      continue;
+    }
+
+    while ((node = tw->slot[0][idx]) != NULL)
+    {
+      tw_del (tw, node);
+      tw_link (tw, &tw->due, node, TW_LEVELS);
+    }
+    tw->now++;
+  }
+}
+
+/**
+ * Return the next expired node, or NULL if none.
+ */
+timer_node *tw_pop (struct timer_wheel *tw)
+{
+  timer_node *node = tw->due;
+
+  if (node)
+     tw_del (tw, node);
+  return (node);
+}
+
 #if defined(USE_DEBUG)
 /*
  * Return string "x.xx" for timeout value.
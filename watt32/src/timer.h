@@ -43,6 +43,11 @@
 #define elapsed_str       NAMESPACE (elapsed_str)
 #define init_timer_isr    NAMESPACE (init_timer_isr)
 #define exit_timer_isr    NAMESPACE (exit_timer_isr)
+#define tw_init           NAMESPACE (tw_init)
+#define tw_add            NAMESPACE (tw_add)
+#define tw_del            NAMESPACE (tw_del)
+#define tw_run            NAMESPACE (tw_run)
+#define tw_pop            NAMESPACE (tw_pop)
 
 /*
  * System clock at BIOS location 40:6C (dword). Counts upwards.
@@ -80,6 +85,27 @@ W32_FUNC void exit_timer_isr (void);
 W32_FUNC void init_userSuppliedTimerTick (void);
 W32_FUNC void userTimerTick (DWORD elapsedTimeMs);
 
+/*
+ * A hierarchical timer wheel. TW_LEVELS levels of TW_SLOTS slots hold
+ * nodes expiring up to 2^(TW_BITS*TW_LEVELS) set_timeout() units ahead.
+ */
+#define TW_BITS    6
+#define TW_SLOTS   (1 << TW_BITS)
+#define TW_LEVELS  4
+
+struct timer_wheel {
+       DWORD       now;                         /* next unit to expire */
+       timer_node *slot [TW_LEVELS][TW_SLOTS];
+       timer_node *due;                         /* expired nodes */
+       DWORD       count [TW_LEVELS+1];         /* # of nodes per level + due */
+     };
+
+extern void        tw_init (struct timer_wheel *tw, DWORD now);
+extern void        tw_add  (struct timer_wheel *tw, timer_node *node, DWORD expire);
+extern void        tw_del  (struct timer_wheel *tw, timer_node *node);
+extern void        tw_run  (struct timer_wheel *tw, DWORD now);
+extern timer_node *tw_pop  (struct timer_wheel *tw);
+
 
 #if defined(USE_PROFILER)
   extern BOOL   profile_enable;
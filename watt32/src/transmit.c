@@ -688,6 +688,7 @@ static int udp_transmit (Socket *socket, const void *buf, unsigned len)
     sk->udp.hisaddr = INADDR_BROADCAST;
     sk->udp.hisport = IPPORT_ANY;
   }
+  _udp_rehash (&sk->udp);
 
   if (rc <= 0)    /* error in udp_write() */
   {
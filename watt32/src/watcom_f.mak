@@ -21,7 +21,7 @@ CORE_SOURCE = bsdname.c  btree.c    chksum.c   country.c  crc.c      &
               split.c    strings.c  tcp_fsm.c  tftp.c     timer.c    &
               udp_dom.c  udp_rev.c  version.c  wdpmi.c    x32vm.c    &
               pcsarp.c   idna.c     punycode.c tcp_md5.c  dynip.c    &
-              winpcap.c  winmisc.c  packet32.c
+              winpcap.c  winmisc.c  packet32.c tcp_cc.c
 
 BSD_SOURCE = accept.c   adr2asc.c  asc2adr.c  bind.c     bsddbug.c  &
              close.c    connect.c  fcntl.c    fsext.c    get_ai.c   &
@@ -101,7 +101,7 @@ OBJS = &
        $(OBJDIR)/idna.o     $(OBJDIR)/punycode.o  &
        $(OBJDIR)/tcp_md5.o  $(OBJDIR)/dynip.o     &
        $(OBJDIR)/winpcap.o  $(OBJDIR)/winmisc.o   &
-       $(OBJDIR)/packet32.o
+       $(OBJDIR)/packet32.o $(OBJDIR)/tcp_cc.o
 
 
 O = obj
@@ -534,6 +534,20 @@ typedef struct arp_Header {
 #define tcp_MaxBufSize    2048   /* maximum bytes to buffer on input */
 #define udp_MaxBufSize    1520
 #define tcp_MaxTxBufSize  tcp_MaxBufSize  /* and on tcp output */
+#define TCP_MAX_SACK      4      /* max SACK blocks we remember */
+
+/*!\struct timer_node
+ *
+ * An entry in a timer wheel (see timer.c).
+ */
+typedef struct timer_node {
+        struct timer_node  *next;
+        struct timer_node **pprev;     /**< points to us, NULL if not queued */
+        DWORD               expire;    /**< when it expires */
+        void               *arg;       /**< owner of this node */
+        WORD                level;     /**< wheel level we're on */
+        WORD                fill;
+      } timer_node;
 
 /**
  * Fields common to UDP & TCP socket definition.
@@ -581,6 +595,9 @@ typedef struct _udp_Socket {
         ip6_address  my6addr;          /**< my ip6-address */
         ip6_address  his6addr;         /**< peer's ip-6 address */
 #endif
+        struct _udp_Socket *hash_next; /**< next in demux hash chain */
+        WORD         hash_slot;        /**< demux hash bucket + 1, 0 if none */
+        WORD         fill_3;
         DWORD        safetysig;        /**< magic marker */
       } _udp_Socket;
 
@@ -616,9 +633,18 @@ typedef struct _tcp_Socket {
         UINT         window;           /**< other guy's window */
         UINT         adv_win;          /**< our last advertised window */
 
-        BYTE         cwindow;          /**< Congestion window */
-        BYTE         wwindow;          /**< Van Jacobson's algorithm */
-        WORD         fill_4;
+        UINT         cwindow;          /**< Congestion window (segments) */
+        UINT         wwindow;          /**< ACKs counted in congestion avoidance */
+        UINT         ssthresh;         /**< Slow-start threshold (segments) */
+        BYTE         dup_acks;         /**< duplicate ACKs received in a row */
+        BYTE         in_recovery;      /**< TRUE in NewReno fast recovery */
+        BYTE         num_sack;         /**< # of blocks in sack_left/right[] */
+        BYTE         fill_4;
+        DWORD        recover;          /**< SND.NXT when recovery was entered */
+        DWORD        rexmit_next;      /**< next SEQ to resend in recovery */
+        DWORD        sack_left [TCP_MAX_SACK]; /**< SACK'ed SEQ ranges from peer */
+        DWORD        sack_right[TCP_MAX_SACK];
+        DWORD        fast_rexmit;      /**< # of segments fast retransmitted */
 
         DWORD        vj_sa;            /**< VJ's alg, standard average   (SRTT) */
         DWORD        vj_sd;            /**< VJ's alg, standard deviation (RTTVAR) */
@@ -661,6 +687,10 @@ typedef struct _tcp_Socket {
         UINT         max_tx_data;      /**< Last index for tx_data[] */
         BYTE        *tx_data;          /**< Tx data buffer (default tx_buf[]) */
         BYTE         tx_buf[tcp_MaxTxBufSize+1]; /**< data for transmission */
+        struct _tcp_Socket *hash_next; /**< next in demux hash chain */
+        WORD         hash_slot;        /**< demux hash bucket + 1, 0 if none */
+        WORD         fill_6;
+        timer_node   timer;            /**< entry in tcp_Retransmitter() wheel */
         DWORD        safetysig;        /**< magic marker */
         DWORD        safetytcp;        /**< extra magic marker */
       } _tcp_Socket;
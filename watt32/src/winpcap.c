@@ -680,7 +680,7 @@ struct pkt_rx_element *pkt_poll_recv (void)
   ENTER_CRIT();
   q = &_pkt_inf->pkt_queue;
   out = pktq_out_buf (q);
-  empty = (q->in_index == q->out_index);
+  empty = (out == pktq_in_buf(q));
   LEAVE_CRIT();
 
   if (!empty)